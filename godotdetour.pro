@@ -23,13 +23,21 @@ SOURCES += \
         src/detourobstacle.cpp \
         src/godotdetour.cpp \
         src/util/chunkytrimesh.cpp \
+        src/util/compactheightfieldcache.cpp \
+        src/util/decompressedlayercache.cpp \
+        src/util/bulkfile.cpp \
+        src/util/mappedfile.cpp \
+        src/util/savebuffer.cpp \
         src/util/detourinputgeometry.cpp \
         src/util/fastlz.c \
+        src/util/lz4.c \
         src/util/godotdetourdebugdraw.cpp \
         src/util/godotgeometryparser.cpp \
+        src/util/heightfieldcache.cpp \
         src/util/meshdataaccumulator.cpp \
         src/util/navigationmeshhelpers.cpp \
-        src/util/recastcontext.cpp
+        src/util/recastcontext.cpp \
+        src/util/threadpool.cpp
 
 HEADERS += \
     src/detourcrowdagent.h \
@@ -38,11 +46,20 @@ HEADERS += \
     src/detourobstacle.h \
     src/godotdetour.h \
     src/util/chunkytrimesh.h \
+    src/util/compactheightfieldcache.h \
+    src/util/decompressedlayercache.h \
+    src/util/bulkfile.h \
+    src/util/mappedfile.h \
+    src/util/savebuffer.h \
     src/util/detourinputgeometry.h \
     src/util/fastlz.h \
+    src/util/lz4.h \
     src/util/godotdetourdebugdraw.h \
     src/util/godotgeometryparser.h \
+    src/util/heightfieldcache.h \
+    src/util/lrubytecache.h \
     src/util/meshdataaccumulator.h \
     src/util/navigationmeshhelpers.h \
-    src/util/recastcontext.h
+    src/util/recastcontext.h \
+    src/util/threadpool.h
 
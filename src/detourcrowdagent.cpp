@@ -4,6 +4,7 @@
 #include <DetourCrowd.h>
 #include <DetourNavMeshQuery.h>
 #include "util/detourinputgeometry.h"
+#include "util/savebuffer.h"
 
 using namespace godot;
 
@@ -68,7 +69,7 @@ DetourCrowdAgent::~DetourCrowdAgent()
 }
 
 bool
-DetourCrowdAgent::save(Ref<File> targetFile)
+DetourCrowdAgent::save(SaveBuffer* targetFile)
 {
     // Sanity check
     if (!_agent)
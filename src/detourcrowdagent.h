@@ -12,6 +12,7 @@ class dtCrowd;
 class dtNavMeshQuery;
 class dtQueryFilter;
 class DetourInputGeometry;
+class SaveBuffer;
 
 namespace godot
 {
@@ -97,7 +98,7 @@ namespace godot
          * @param targetFile The file to append data to.
          * @return True if everything worked out, false otherwise.
          */
-        bool save(Ref<File> targetFile);
+        bool save(SaveBuffer* targetFile);
 
         /**
          * @brief Loads the agent from the file.
@@ -143,6 +144,11 @@ namespace godot
          */
         Vector3 getTargetPosition();
 
+        /**
+         * @return The current position of this agent.
+         */
+        Vector3 getPosition();
+
         /**
          * @brief Adds the passed agent as a shadow agent that will be updated with the main agent's values regularly.
          */
@@ -236,6 +242,12 @@ namespace godot
     {
         return _targetPosition;
     }
+
+    inline Vector3
+    DetourCrowdAgent::getPosition()
+    {
+        return _position;
+    }
 }
 
 #endif // DETOURCROWDAGENT_H
@@ -5,21 +5,45 @@
 #include <Mesh.hpp>
 #include <File.hpp>
 #include <Directory.hpp>
+#include <ProjectSettings.hpp>
 #include <Variant.hpp>
 #include <thread>
 #include <mutex>
 #include <chrono>
 #include <climits>
+#include <algorithm>
+#include <tuple>
+#include <random>
+#include <Recast.h>
 #include <DetourCrowd.h>
 #include "util/detourinputgeometry.h"
 #include "util/recastcontext.h"
 #include "util/godotdetourdebugdraw.h"
 #include "util/navigationmeshhelpers.h"
+#include "util/threadpool.h"
+#include "util/heightfieldcache.h"
+#include "util/godotgeometryparser.h"
+#include "util/meshdataaccumulator.h"
+#include "util/mappedfile.h"
+#include "util/savebuffer.h"
 #include "detourobstacle.h"
 
 using namespace godot;
 
-#define SAVE_DATA_VERSION 1
+#define SAVE_DATA_VERSION 3
+#define JOURNAL_DATA_VERSION 2
+#define MAX_CACHED_HEIGHTFIELDS 256
+#define BUILD_PROGRESS_INTERVAL_MS 100
+#define PROFILE_SLOWEST_TILES RECAST_SLOWEST_TILES
+
+// Identifies a save file, its journal has to carry the same one. 0 stands for files saved before generations existed
+static uint64_t
+createSaveGeneration()
+{
+    std::random_device device;
+    uint64_t generation = ((uint64_t)device() << 32) ^ device() ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    return generation != 0 ? generation : 1;
+}
 
 void
 DetourNavigationParameters::_register_methods()
@@ -27,31 +51,58 @@ DetourNavigationParameters::_register_methods()
     register_property<DetourNavigationParameters, Array>("navMeshParameters", &DetourNavigationParameters::navMeshParameters, Array());
     register_property<DetourNavigationParameters, int>("ticksPerSecond", &DetourNavigationParameters::ticksPerSecond, 60);
     register_property<DetourNavigationParameters, int>("maxObstacles", &DetourNavigationParameters::maxObstacles, 256);
+    register_property<DetourNavigationParameters, int>("buildThreads", &DetourNavigationParameters::buildThreads, 0);
+    register_property<DetourNavigationParameters, int>("buildQueueDepth", &DetourNavigationParameters::buildQueueDepth, 0);
+    register_property<DetourNavigationParameters, float>("lazyBuildRadius", &DetourNavigationParameters::lazyBuildRadius, 0.0f);
+    register_property<DetourNavigationParameters, int>("parsedGeometryType", &DetourNavigationParameters::parsedGeometryType, PARSED_GEOMETRY_MESH_INSTANCES);
+    register_property<DetourNavigationParameters, bool>("areaVolumes", &DetourNavigationParameters::areaVolumes, false);
 }
 
 void
 DetourNavigation::_register_methods()
 {
     register_method("initialize", &DetourNavigation::initialize);
+    register_method("initializeAsync", &DetourNavigation::initializeAsync);
     register_method("rebuildChangedTiles", &DetourNavigation::rebuildChangedTiles);
     register_method("markConvexArea", &DetourNavigation::markConvexArea);
+    register_method("addGeometry", &DetourNavigation::addGeometry);
+    register_method("removeGeometry", &DetourNavigation::removeGeometry);
+    register_method("freezeGeometry", &DetourNavigation::freezeGeometry);
+    register_method("isGeometryFrozen", &DetourNavigation::isGeometryFrozen);
     register_method("addAgent", &DetourNavigation::addAgent);
     register_method("removeAgent", &DetourNavigation::removeAgent);
     register_method("addBoxObstacle", &DetourNavigation::addBoxObstacle);
     register_method("addCylinderObstacle", &DetourNavigation::addCylinderObstacle);
+    register_method("addActivityAnchor", &DetourNavigation::addActivityAnchor);
+    register_method("moveActivityAnchor", &DetourNavigation::moveActivityAnchor);
+    register_method("removeActivityAnchor", &DetourNavigation::removeActivityAnchor);
     register_method("createDebugMesh", &DetourNavigation::createDebugMesh);
     register_method("setQueryFilter", &DetourNavigation::setQueryFilter);
     register_method("save", &DetourNavigation::save);
+    register_method("saveIncremental", &DetourNavigation::saveIncremental);
+    register_method("saveAsync", &DetourNavigation::saveAsync);
     register_method("load", &DetourNavigation::load);
+    register_method("loadAsync", &DetourNavigation::loadAsync);
+    register_method("loadMapped", &DetourNavigation::loadMapped);
+    register_method("loadLazy", &DetourNavigation::loadLazy);
     register_method("clear", &DetourNavigation::clear);
     register_method("getAgents", &DetourNavigation::getAgents);
     register_method("getObstacles", &DetourNavigation::getObstacles);
     register_method("getMarkedAreaIDs", &DetourNavigation::getMarkedAreaIDs);
     register_method("isInitialized", &DetourNavigation::isInitialized);
+    register_method("isBuilding", &DetourNavigation::isBuilding);
+    register_method("getBuildProfile", &DetourNavigation::getBuildProfile);
+    register_method("resetBuildProfile", &DetourNavigation::resetBuildProfile);
+    register_method("getAllocatorStats", &DetourNavigation::getAllocatorStats);
+    register_method("getGeometryStats", &DetourNavigation::getGeometryStats);
+    register_method("benchmarkCompression", &DetourNavigation::benchmarkCompression);
     register_method("addOffMeshConnection", &DetourNavigation::addOffMeshConnection);
     register_method("removeOffMeshConnection", &DetourNavigation::removeOffMeshConnection);
 
     register_signal<DetourNavigation>("navigation_tick_done", "executionTimeSeconds", Variant::INT);
+    register_signal<DetourNavigation>("build_progress", "tilesDone", Variant::INT, "tilesTotal", Variant::INT);
+    register_signal<DetourNavigation>("build_finished", "success", Variant::BOOL);
+    register_signal<DetourNavigation>("save_finished", "path", Variant::STRING, "success", Variant::BOOL);
 }
 
 DetourNavigation::DetourNavigation()
@@ -65,6 +116,19 @@ DetourNavigation::DetourNavigation()
     , _navigationThread(nullptr)
     , _stopThread(false)
     , _navigationMutex(nullptr)
+    , _buildThread(nullptr)
+    , _building(false)
+    , _buildProgress(nullptr)
+    , _destroying(false)
+    , _saveThread(nullptr)
+    , _lazyBuildRadius(0.0f)
+    , _lazyBuildPool(nullptr)
+    , _lazyBuildGroup(nullptr)
+    , _nextActivityAnchorId(0)
+    , _mappedFile(nullptr)
+    , _journalBaseCompressed(false)
+    , _journalBaseGeneration(0)
+    , _geometryChangedSinceSave(false)
 {
     _navigationMutex = new std::mutex();
     _recastContext = new RecastContext();
@@ -73,6 +137,12 @@ DetourNavigation::DetourNavigation()
 
 DetourNavigation::~DetourNavigation()
 {
+    // A running build can't be cancelled, so wait for it to finish
+    _destroying = true;
+    joinBuildThread();
+    delete _buildProgress;
+    finishAsyncSave();
+
     _stopThread = true;
     if (_navigationThread)
     {
@@ -82,6 +152,7 @@ DetourNavigation::~DetourNavigation()
         }
         delete _navigationThread;
     }
+    stopLazyBuild();
     delete _navigationMutex;
 
     for (int i = 0; i < _navMeshes.size(); ++i)
@@ -89,6 +160,8 @@ DetourNavigation::~DetourNavigation()
         delete _navMeshes[i];
     }
     _navMeshes.clear();
+    deleteHeightfieldCaches();
+    delete _mappedFile;
 
     if (_debugDrawer)
     {
@@ -101,32 +174,92 @@ DetourNavigation::~DetourNavigation()
 
 bool
 DetourNavigation::initialize(Variant inputMeshInstance, Ref<DetourNavigationParameters> parameters)
+{
+    Node* input = prepareInitialize(inputMeshInstance);
+    if (input == nullptr)
+    {
+        return false;
+    }
+
+    if (!buildFromMesh(input, parameters, nullptr))
+    {
+        return false;
+    }
+
+    startNavigationThread();
+    return true;
+}
+
+bool
+DetourNavigation::initializeAsync(Variant inputMeshInstance, Ref<DetourNavigationParameters> parameters)
+{
+    Node* input = prepareInitialize(inputMeshInstance);
+    if (input == nullptr)
+    {
+        return false;
+    }
+
+    startBuildThread([this, input, parameters](BuildProgress* progress) {
+        return buildFromMesh(input, parameters, progress);
+    });
+    return true;
+}
+
+Node*
+DetourNavigation::prepareInitialize(Variant inputMeshInstance)
 {
     // Don't do anything if already initialized
     if (_initialized)
     {
         ERR_PRINT("DetourNavigation already initialized.");
-        return false;
+        return nullptr;
+    }
+    if (_building)
+    {
+        ERR_PRINT("DetourNavigation is already being built.");
+        return nullptr;
     }
 
     // Make sure we got the input we need
-    MeshInstance* meshInstance = Object::cast_to<MeshInstance>(inputMeshInstance.operator Object*());
-    if (meshInstance == nullptr)
+    Node* input = Object::cast_to<Node>(inputMeshInstance.operator Object*());
+    if (input == nullptr)
     {
-        ERR_PRINT("Passed inputMesh must be of type Mesh or MeshInstance.");
-        return false;
+        ERR_PRINT("Passed inputMesh must be of type MeshInstance or a Node containing the geometry.");
+        return nullptr;
     }
 
-    // Check if the mesh instance actually has a mesh
-    Ref<Mesh> meshToConvert = meshInstance->get_mesh();
-    if (meshToConvert.ptr() == nullptr)
+    // Check if the mesh instance actually has a mesh, other nodes are parsed recursively
+    MeshInstance* meshInstance = Object::cast_to<MeshInstance>(input);
+    if (meshInstance != nullptr)
     {
-        ERR_PRINT("Passed MeshInstance does not have a mesh.");
-        return false;
+        Ref<Mesh> meshToConvert = meshInstance->get_mesh();
+        if (meshToConvert.ptr() == nullptr)
+        {
+            ERR_PRINT("Passed MeshInstance does not have a mesh.");
+            return nullptr;
+        }
     }
 
-    // Create the input geometry from the passed mesh
-    if (!_inputGeometry->loadMesh(_recastContext, meshInstance))
+    return input;
+}
+
+bool
+DetourNavigation::buildFromMesh(Node* input, Ref<DetourNavigationParameters> parameters, BuildProgress* progress)
+{
+    _recastContext->resetProfile();
+
+    // Create the input geometry from the passed mesh or scene tree
+    MeshInstance* meshInstance = Object::cast_to<MeshInstance>(input);
+    bool loaded = false;
+    if (meshInstance != nullptr)
+    {
+        loaded = _inputGeometry->loadMesh(_recastContext, meshInstance);
+    }
+    else
+    {
+        loaded = _inputGeometry->loadScene(_recastContext, input, parameters->parsedGeometryType, parameters->buildThreads);
+    }
+    if (!loaded)
     {
         ERR_PRINT("Input geometry failed to load the mesh.");
         return false;
@@ -136,195 +269,783 @@ DetourNavigation::initialize(Variant inputMeshInstance, Ref<DetourNavigationPara
     _ticksPerSecond = parameters->ticksPerSecond;
     _maxObstacles = parameters->maxObstacles;
     _defaultAreaType = parameters->defaultAreaType;
-    for (int i = 0; i < parameters->navMeshParameters.size(); ++i)
+
+    _lazyBuildRadius = parameters->lazyBuildRadius;
+
+    // When building lazily, only the tiles around the anchors and agents known so far are built upfront
+    std::vector<Vector3> initialPositions;
+    _navigationMutex->lock();
+    for (auto const& anchor : _activityAnchors)
+    {
+        initialPositions.push_back(anchor.second);
+    }
+    for (int i = 0; i < _queuedAgentParameters.size(); ++i)
+    {
+        initialPositions.push_back(_queuedAgentParameters[i]->position);
+    }
+    _navigationMutex->unlock();
+
+    int numNavMeshes = parameters->navMeshParameters.size();
+    for (int i = 0; i < numNavMeshes; ++i)
+    {
+        _navMeshes.push_back(new DetourNavigationMesh());
+        if (_lazyBuildRadius > 0.0f)
+        {
+            _navMeshes.back()->enableLazyBuild(_lazyBuildRadius, initialPositions);
+        }
+        if (parameters->areaVolumes)
+        {
+            _navMeshes.back()->enableAreaVolumes();
+        }
+    }
+
+    // Navigation meshes with the same voxel settings rasterize the input geometry only once
+    std::vector<VoxelSettings> voxelSettings;
+    for (int i = 0; i < numNavMeshes; ++i)
+    {
+        Ref<DetourNavigationMeshParameters> navMeshParams = parameters->navMeshParameters[i];
+        VoxelSettings settings;
+        settings.cellSize = navMeshParams->cellSize.x;
+        settings.cellHeight = navMeshParams->cellSize.y;
+        settings.walkableSlopeAngle = navMeshParams->maxAgentSlope;
+        settings.tileSize = navMeshParams->tileSize;
+        settings.fixedBorderSize = 0;
+        settings.borderSize = (int)ceilf(navMeshParams->maxAgentRadius / settings.cellSize) + 3;
+        settings.walkableClimb = (int)floorf(navMeshParams->maxAgentClimb / settings.cellHeight);
+        voxelSettings.push_back(settings);
+    }
+    shareHeightfields(voxelSettings);
+
+    // The navigation meshes are built at the same time, each spreading its tiles over the same pool
+    ThreadPool threadPool(parameters->buildThreads);
+    std::vector<char> navMeshSuccess(numNavMeshes, 0);
+    TaskGroup navMeshGroup;
+    for (int i = 0; i < numNavMeshes; ++i)
     {
         Ref<DetourNavigationMeshParameters> navMeshParams = parameters->navMeshParameters[i];
-        DetourNavigationMesh* navMesh = new DetourNavigationMesh();
+        DetourNavigationMesh* navMesh = _navMeshes[i];
+
+        char& success = navMeshSuccess[i];
+        int queueDepth = parameters->buildQueueDepth;
+        threadPool.submit(navMeshGroup, [this, navMesh, navMeshParams, i, queueDepth, progress, &threadPool, &success]() {
+            success = navMesh->initialize(_inputGeometry, navMeshParams, _maxObstacles, _recastContext, i, &threadPool, queueDepth, progress);
+        });
+    }
+    threadPool.wait(navMeshGroup);
+    clearHeightfieldCaches();
 
-        if (!navMesh->initialize(_inputGeometry, navMeshParams, _maxObstacles, _recastContext, i))
+    for (int i = 0; i < numNavMeshes; ++i)
+    {
+        if (!navMeshSuccess[i])
         {
             ERR_PRINT("Unable to initialize detour navigation mesh!");
             return false;
         }
-        _navMeshes.push_back(navMesh);
     }
 
-    // Start the navigation thread
+    // Everything marked before initialization is part of the navmeshes now
+    markChangesHandled();
+    startLazyBuild(parameters->buildThreads);
+    return true;
+}
+
+void
+DetourNavigation::startNavigationThread()
+{
     _stopThread = false;
     _navigationThread = new std::thread(&DetourNavigation::navigationThreadFunction, this);
-
     _initialized = true;
-    return true;
 }
 
 void
-DetourNavigation::rebuildChangedTiles()
+DetourNavigation::startBuildThread(std::function<bool(BuildProgress*)> buildFunction)
+{
+    // Clean up after the previous build
+    joinBuildThread();
+    delete _buildProgress;
+
+    _building = true;
+    _buildProgress = new BuildProgress([this](int tilesDone, int tilesTotal) {
+        if (!_destroying)
+        {
+            emit_signal("build_progress", tilesDone, tilesTotal);
+        }
+    }, BUILD_PROGRESS_INTERVAL_MS);
+
+    _buildThread = new std::thread([this, buildFunction]() {
+        bool success = buildFunction(_buildProgress);
+        finishBuild(success);
+    });
+}
+
+void
+DetourNavigation::finishBuild(bool success)
 {
     _navigationMutex->lock();
-    for (int i = 0; i < _navMeshes.size(); ++i)
+    if (success)
     {
-        _navMeshes[i]->rebuildChangedTiles(_removedMarkedAreaIDs, _removedOffMeshConnections);
-    }
-    _removedMarkedAreaIDs.clear();
-    _removedOffMeshConnections.clear();
+        // Apply everything that was added while building
+        for (int i = 0; i < _queuedQueryFilters.size(); ++i)
+        {
+            const QueuedQueryFilter& queryFilter = _queuedQueryFilters[i];
+            applyQueryFilter(queryFilter.index, queryFilter.name, queryFilter.weights);
+        }
+        for (int i = 0; i < _queuedAgents.size(); ++i)
+        {
+            if (!placeAgent(_queuedAgents[i], _queuedAgentParameters[i]))
+            {
+                ERR_PRINT("Unable to add agent that was added during the build.");
+            }
+        }
+        for (int i = 0; i < _queuedObstacles.size(); ++i)
+        {
+            for (int j = 0; j < _navMeshes.size(); ++j)
+            {
+                _navMeshes[j]->addObstacle(_queuedObstacles[i]);
+            }
+        }
 
-    // Mark the volumes as handled
-    int volumeCount = _inputGeometry->getConvexVolumeCount();
-    for (int i = 0; i < volumeCount; ++i)
+        startNavigationThread();
+    }
+    else
     {
-        // Get volume
-        ConvexVolume volume = _inputGeometry->getConvexVolumes()[i];
-        volume.isNew = false;
+        // The obstacles added during the build never made it into any navmesh
+        for (int i = 0; i < _queuedObstacles.size(); ++i)
+        {
+            for (int j = 0; j < _obstacles.size(); ++j)
+            {
+                if (_obstacles[j] == _queuedObstacles[i])
+                {
+                    _obstacles.erase(_obstacles.begin() + j);
+                    break;
+                }
+            }
+        }
     }
+    _queuedQueryFilters.clear();
+    _queuedAgents.clear();
+    _queuedAgentParameters.clear();
+    _queuedObstacles.clear();
+    _building = false;
+    _navigationMutex->unlock();
 
-    // Mark the connections as handled
-    int connectionCount = _inputGeometry->getOffMeshConnectionCount();
-    for (int i = 0; i < connectionCount; ++i)
+    // Nobody is listening anymore if the build only finished in the destructor
+    if (!_destroying)
     {
-        _inputGeometry->getOffMeshConnectionNew()[i] = false;
+        _buildProgress->report(true);
+        emit_signal("build_finished", success);
     }
-    _navigationMutex->unlock();
 }
 
-int
-DetourNavigation::markConvexArea(Array vertices, float height, unsigned int areaType)
+void
+DetourNavigation::joinBuildThread()
 {
-    // Sanity checks
-    if (areaType > UCHAR_MAX)
+    if (!_buildThread)
     {
-        ERR_PRINT(String("Passed areaType is too large. {0} (of max allowed {1}).").format(Array::make(areaType, UCHAR_MAX)));
-        return -1;
+        return;
     }
-    if (_inputGeometry->getConvexVolumeCount() >= (DetourInputGeometry::MAX_VOLUMES - 1))
+
+    // A thread can't join itself. If a build_finished handler starts the next build, the previous build thread
+    // is already done with the build and only returns from emitting the signal, so let it end on its own.
+    if (_buildThread->get_id() == std::this_thread::get_id())
     {
-        ERR_PRINT("Cannot mark any more convex area, limit reached.");
-        return -1;
+        _buildThread->detach();
     }
-
-    // Create the vertices array
-    float* vertArray = new float[vertices.size() * 3];
-    float miny = 10000000.0f;
-    for (int i = 0; i < vertices.size(); ++i)
+    else
     {
-        Vector3 vertex = vertices[i];
-        vertArray[i * 3 + 0] = vertex.x;
-        vertArray[i * 3 + 1] = vertex.y;
-        vertArray[i * 3 + 2] = vertex.z;
-
-        if (vertex.y < miny)
-        {
-            miny = vertex.y;
-        }
+        _buildThread->join();
     }
-
-    // Add to the input geometry
-    _inputGeometry->addConvexVolume(vertArray, vertices.size(), miny, miny + height, areaType);
-    delete [] vertArray;
-    int id = _inputGeometry->getConvexVolumeCount() - 1;
-    _markedAreaIDs.push_back(id);
-    return id;
+    delete _buildThread;
+    _buildThread = nullptr;
 }
 
 void
-DetourNavigation::removeConvexAreaMarker(int id)
+DetourNavigation::rebuildChangedTiles()
 {
-    _inputGeometry->deleteConvexVolume(id);
-    for (int i = 0; i < _markedAreaIDs.size(); ++i)
+    if (_building)
     {
-        if (_markedAreaIDs[i] == id)
+        ERR_PRINT("Unable to rebuild tiles while the navigation is being built.");
+        return;
+    }
+
+    lockAndFinishLazyTiles();
+
+    // Columns still in the save file would be read without the changes
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        _navMeshes[i]->forgetSavedRegions(_changedGeometryBounds);
+        _navMeshes[i]->forgetSavedRegions(_changedAreaBounds);
+    }
+    if (!_changedGeometryBounds.empty())
+    {
+        for (int i = 0; i < _navMeshes.size(); ++i)
         {
-            _markedAreaIDs.erase(_markedAreaIDs.begin() +i);
-            break;
+            _navMeshes[i]->rebuildGeometryTiles(_changedGeometryBounds, _obstacles);
         }
+        _changedGeometryBounds.clear();
+        clearHeightfieldCaches();
     }
-
-    // Remember this removal to be able to pass it on to rebuildChangedTiles() later on
-    _removedMarkedAreaIDs.push_back(id);
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        if (_navMeshes[i]->hasAreaVolumes())
+        {
+            _navMeshes[i]->rebuildAreaVolumes(_changedAreaBounds, _obstacles);
+        }
+        else
+        {
+            _navMeshes[i]->rebuildChangedTiles(_removedMarkedAreaIDs, _removedOffMeshConnections);
+        }
+    }
+    _removedMarkedAreaIDs.clear();
+    _removedOffMeshConnections.clear();
+    _changedAreaBounds.clear();
+    clearHeightfieldCaches();
+    markChangesHandled();
+    _navigationMutex->unlock();
 }
 
-int
-DetourNavigation::addOffMeshConnection(Vector3 from, Vector3 to, bool bidirectional, float radius, int areaType)
+void
+DetourNavigation::shareHeightfields(const std::vector<VoxelSettings>& voxelSettings)
 {
-    // Sanity checks
-    if (_offMeshConnections.size() >= DetourInputGeometry::MAX_OFFMESH_CONNECTIONS)
+    deleteHeightfieldCaches();
+
+    // Group the navmeshes by their voxel settings
+    std::map<std::tuple<float, float, float, int, int>, std::vector<int> > groups;
+    for (int i = 0; i < voxelSettings.size(); ++i)
     {
-        ERR_PRINT("Cannot add any more off-mesh connections. Limit reached.");
-        return -1;
+        const VoxelSettings& settings = voxelSettings[i];
+        groups[std::make_tuple(settings.cellSize, settings.cellHeight, settings.walkableSlopeAngle, settings.tileSize, settings.fixedBorderSize)].push_back(i);
     }
 
-    // Create parameters
-    float start[3];
-    float end[3];
-    start[0] = from.x;
-    start[1] = from.y;
-    start[2] = from.z;
-    end[0] = to.x;
-    end[1] = to.y;
-    end[2] = to.z;
-    unsigned short flags;
-    switch (areaType) {
-        case POLY_AREA_GROUND:
-        case POLY_AREA_ROAD:
-        case POLY_AREA_GRASS:
-            flags = POLY_FLAGS_WALK;
-            break;
-        case POLY_AREA_DOOR:
-            flags = POLY_FLAGS_DOOR;
-            break;
-        case POLY_AREA_WATER:
-            flags = POLY_FLAGS_SWIM;
-            break;
-        case POLY_AREA_JUMP:
-            flags = POLY_AREA_JUMP;
-            break;
-        default:
+    for (auto const& group : groups)
+    {
+        const std::vector<int>& members = group.second;
+        if (members.size() < 2)
         {
-            ERR_PRINT(String("Unable to add off-mesh connection. Unknown area type: {0}").format(Array::make(areaType)));
-            return -1;
+            continue;
         }
-    }
 
-    // Add the connection
-    _inputGeometry->addOffMeshConnection(start, end, radius, bidirectional, areaType, flags);
-    int id = _inputGeometry->getOffMeshConnectionCount() - 1;
-    _offMeshConnections.push_back(id);
-    return id;
+        // The shared heightfields need to have the largest border and be rasterized with the smallest climb of all members
+        int borderSize = 0;
+        int climb = INT_MAX;
+        for (int i = 0; i < members.size(); ++i)
+        {
+            borderSize = std::max(borderSize, voxelSettings[members[i]].borderSize);
+            climb = std::min(climb, voxelSettings[members[i]].walkableClimb);
+        }
+
+        HeightfieldCache* cache = new HeightfieldCache(members.size(), MAX_CACHED_HEIGHTFIELDS);
+        _heightfieldCaches.push_back(cache);
+        for (int i = 0; i < members.size(); ++i)
+        {
+            _navMeshes[members[i]]->setHeightfieldCache(cache, borderSize, climb);
+        }
+    }
 }
 
 void
-DetourNavigation::removeOffMeshConnection(int id)
+DetourNavigation::clearHeightfieldCaches()
 {
-    _inputGeometry->deleteOffMeshConnection(id);
-    for (int i = 0; i < _offMeshConnections.size(); ++i)
+    for (int i = 0; i < _heightfieldCaches.size(); ++i)
     {
-        if (_offMeshConnections[i] == id)
-        {
-            _offMeshConnections.erase(_offMeshConnections.begin() + i);
-            break;
-        }
+        _heightfieldCaches[i]->clear();
     }
+}
 
-    // Remember this removal to be able to pass it on to rebuildChangedTiles() later on
-    _removedOffMeshConnections.push_back(id);
+void
+DetourNavigation::deleteHeightfieldCaches()
+{
+    for (int i = 0; i < _heightfieldCaches.size(); ++i)
+    {
+        delete _heightfieldCaches[i];
+    }
+    _heightfieldCaches.clear();
 }
 
-bool
-DetourNavigation::setQueryFilter(int index, String name, Dictionary weights)
+void
+DetourNavigation::startLazyBuild(int numThreads)
 {
-    // Check index
-    if (index >= 16)
+    if (_lazyBuildRadius <= 0.0f)
     {
-        ERR_PRINT(String("Index exceeds allowed number of query filters: {0}").format(Array::make(index)));
-        return false;
+        return;
     }
 
-    // Set weights
+    // Tiles built on demand are rasterized independently, sharing heightfields would only keep them in memory
     for (int i = 0; i < _navMeshes.size(); ++i)
     {
-        dtCrowd* crowd = _navMeshes[i]->getCrowd();
-        dtQueryFilter* filter = crowd->getEditableFilter(index);
+        _navMeshes[i]->detachHeightfieldCache();
+    }
+    deleteHeightfieldCaches();
 
-        for (int j = 0; j < weights.keys().size(); ++j)
+    // At least one worker, so the navigation thread never has to build tiles itself
+    if (numThreads <= 0)
+    {
+        numThreads = std::thread::hardware_concurrency();
+    }
+    _lazyBuildPool = new ThreadPool(std::max(numThreads, 2));
+    _lazyBuildGroup = new TaskGroup();
+}
+
+void
+DetourNavigation::stopLazyBuild()
+{
+    if (!_lazyBuildPool)
+    {
+        return;
+    }
+
+    // Queued tiles return right away, the pool waits for the ones currently being built
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        _navMeshes[i]->cancelLazyBuild();
+    }
+    delete _lazyBuildPool;
+    delete _lazyBuildGroup;
+    _lazyBuildPool = nullptr;
+    _lazyBuildGroup = nullptr;
+}
+
+void
+DetourNavigation::requestLazyTiles(const Vector3& position)
+{
+    std::vector<std::pair<int, int> > tiles;
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        DetourNavigationMesh* navMesh = _navMeshes[i];
+        tiles.clear();
+        navMesh->requestTilesAround(position, tiles);
+        for (int j = 0; j < tiles.size(); ++j)
+        {
+            const int x = tiles[j].first;
+            const int z = tiles[j].second;
+            _lazyBuildPool->submit(*_lazyBuildGroup, [navMesh, x, z]() {
+                navMesh->rasterizeLazyTile(x, z);
+            });
+        }
+    }
+}
+
+void
+DetourNavigation::finishLazyTiles()
+{
+    if (!_lazyBuildPool)
+    {
+        return;
+    }
+
+    _lazyBuildPool->wait(*_lazyBuildGroup);
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        _navMeshes[i]->addLazyTiles(_obstacles);
+    }
+}
+
+void
+DetourNavigation::lockAndFinishLazyTiles()
+{
+    // Most of the queued tiles are built before locking, so the navigation thread keeps ticking meanwhile.
+    // Only those it queued in between are waited for with the lock held.
+    if (_lazyBuildPool)
+    {
+        _lazyBuildPool->wait(*_lazyBuildGroup);
+    }
+    _navigationMutex->lock();
+    finishLazyTiles();
+}
+
+void
+DetourNavigation::rememberChangedVolume(int id)
+{
+    if (id < 0 || id >= _inputGeometry->getConvexVolumeCount())
+    {
+        return;
+    }
+
+    const ConvexVolume& volume = _inputGeometry->getConvexVolumes()[id];
+    const float bounds[6] = { volume.left, volume.hmin, volume.front, volume.right, volume.hmax, volume.back };
+    _changedAreaBounds.insert(_changedAreaBounds.end(), bounds, bounds + 6);
+}
+
+void
+DetourNavigation::rememberChangedConnection(int id)
+{
+    if (id < 0 || id >= _inputGeometry->getOffMeshConnectionCount())
+    {
+        return;
+    }
+
+    // Both ends, as the connection is stored in the tile of its start and linked to the tile of its end
+    const float* verts = &_inputGeometry->getOffMeshConnectionVerts()[id * 6];
+    const float radius = _inputGeometry->getOffMeshConnectionRads()[id];
+    for (int i = 0; i < 2; ++i)
+    {
+        const float* pos = &verts[i * 3];
+        const float bounds[6] = { pos[0] - radius, pos[1] - radius, pos[2] - radius, pos[0] + radius, pos[1] + radius, pos[2] + radius };
+        _changedAreaBounds.insert(_changedAreaBounds.end(), bounds, bounds + 6);
+    }
+}
+
+void
+DetourNavigation::markChangesHandled()
+{
+    // Mark the volumes as handled
+    int volumeCount = _inputGeometry->getConvexVolumeCount();
+    for (int i = 0; i < volumeCount; ++i)
+    {
+        _inputGeometry->getConvexVolumes()[i].isNew = false;
+    }
+
+    // Mark the connections as handled
+    int connectionCount = _inputGeometry->getOffMeshConnectionCount();
+    for (int i = 0; i < connectionCount; ++i)
+    {
+        _inputGeometry->getOffMeshConnectionNew()[i] = false;
+    }
+}
+
+bool
+DetourNavigation::canChangeAreas()
+{
+    if (!_inputGeometry->isFrozen())
+    {
+        return true;
+    }
+
+    // Only area volumes are applied without rasterizing the tiles again
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        if (!_navMeshes[i]->hasAreaVolumes())
+        {
+            ERR_PRINT("Unable to change areas or off-mesh connections, the geometry is frozen and the navmeshes do not use area volumes.");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+DetourNavigation::freezeGeometry()
+{
+    // Sanity checks
+    if (!_initialized || _building)
+    {
+        ERR_PRINT("Unable to freeze the geometry before the navigation is initialized.");
+        return false;
+    }
+    if (_lazyBuildRadius > 0.0f)
+    {
+        ERR_PRINT("Unable to freeze the geometry while tiles are built on demand.");
+        return false;
+    }
+
+    _navigationMutex->lock();
+    if (!_changedGeometryBounds.empty() || !_changedAreaBounds.empty() || !_removedMarkedAreaIDs.empty() || !_removedOffMeshConnections.empty())
+    {
+        ERR_PRINT("Unable to freeze the geometry with changes not applied yet, call rebuildChangedTiles() first.");
+        _navigationMutex->unlock();
+        return false;
+    }
+
+    // Nothing is rasterized anymore, so the shared heightfields can go as well
+    _inputGeometry->freeze();
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        _navMeshes[i]->detachHeightfieldCache();
+    }
+    deleteHeightfieldCaches();
+    _navigationMutex->unlock();
+    return true;
+}
+
+bool
+DetourNavigation::isGeometryFrozen()
+{
+    return _inputGeometry->isFrozen();
+}
+
+int
+DetourNavigation::addGeometry(Variant inputMeshInstance)
+{
+    // Sanity checks
+    if (!_initialized || _building)
+    {
+        ERR_PRINT("Unable to add geometry before the navigation is initialized.");
+        return -1;
+    }
+    if (_inputGeometry->isFrozen())
+    {
+        ERR_PRINT("Unable to add geometry, the geometry is frozen.");
+        return -1;
+    }
+    MeshInstance* meshInstance = Object::cast_to<MeshInstance>(inputMeshInstance.operator Object*());
+    if (meshInstance == nullptr)
+    {
+        ERR_PRINT("Passed geometry must be of type MeshInstance.");
+        return -1;
+    }
+
+    // Add to the input geometry (after tiles being built on demand are done reading it)
+    float bmin[3], bmax[3];
+    lockAndFinishLazyTiles();
+    int id = _inputGeometry->addGeometry(meshInstance, bmin, bmax);
+    if (id >= 0)
+    {
+        _changedGeometryBounds.insert(_changedGeometryBounds.end(), bmin, bmin + 3);
+        _changedGeometryBounds.insert(_changedGeometryBounds.end(), bmax, bmax + 3);
+        _geometryChangedSinceSave = true;
+    }
+    _navigationMutex->unlock();
+
+    // The tiles are laid out over the initial mesh's bounds, there are none beyond that
+    const float* navMin = _inputGeometry->getNavMeshBoundsMin();
+    const float* navMax = _inputGeometry->getNavMeshBoundsMax();
+    if (id >= 0 && (bmin[0] < navMin[0] || bmin[2] < navMin[2] || bmax[0] > navMax[0] || bmax[2] > navMax[2]))
+    {
+        WARN_PRINT("Added geometry exceeds the bounds of the navigation, the part outside will be ignored.");
+    }
+    return id;
+}
+
+void
+DetourNavigation::removeGeometry(int id)
+{
+    if (!_initialized || _building)
+    {
+        ERR_PRINT("Unable to remove geometry before the navigation is initialized.");
+        return;
+    }
+    if (_inputGeometry->isFrozen())
+    {
+        ERR_PRINT("Unable to remove geometry, the geometry is frozen.");
+        return;
+    }
+
+    float bmin[3], bmax[3];
+    lockAndFinishLazyTiles();
+    if (_inputGeometry->removeGeometry(id, bmin, bmax))
+    {
+        _changedGeometryBounds.insert(_changedGeometryBounds.end(), bmin, bmin + 3);
+        _changedGeometryBounds.insert(_changedGeometryBounds.end(), bmax, bmax + 3);
+        _geometryChangedSinceSave = true;
+    }
+    else
+    {
+        ERR_PRINT(String("Unable to remove geometry. Unknown ID: {0}").format(Array::make(id)));
+    }
+    _navigationMutex->unlock();
+}
+
+int
+DetourNavigation::markConvexArea(Array vertices, float height, unsigned int areaType)
+{
+    // Sanity checks
+    if (_building)
+    {
+        ERR_PRINT("Unable to mark convex area while the navigation is being built.");
+        return -1;
+    }
+    if (!canChangeAreas())
+    {
+        return -1;
+    }
+    if (areaType > UCHAR_MAX)
+    {
+        ERR_PRINT(String("Passed areaType is too large. {0} (of max allowed {1}).").format(Array::make(areaType, UCHAR_MAX)));
+        return -1;
+    }
+    if (_inputGeometry->getConvexVolumeCount() >= (DetourInputGeometry::MAX_VOLUMES - 1))
+    {
+        ERR_PRINT("Cannot mark any more convex area, limit reached.");
+        return -1;
+    }
+
+    // Create the vertices array
+    float* vertArray = new float[vertices.size() * 3];
+    float miny = 10000000.0f;
+    for (int i = 0; i < vertices.size(); ++i)
+    {
+        Vector3 vertex = vertices[i];
+        vertArray[i * 3 + 0] = vertex.x;
+        vertArray[i * 3 + 1] = vertex.y;
+        vertArray[i * 3 + 2] = vertex.z;
+
+        if (vertex.y < miny)
+        {
+            miny = vertex.y;
+        }
+    }
+
+    // Add to the input geometry (after tiles being built on demand are done reading it)
+    lockAndFinishLazyTiles();
+    _inputGeometry->addConvexVolume(vertArray, vertices.size(), miny, miny + height, areaType);
+    int id = _inputGeometry->getConvexVolumeCount() - 1;
+    rememberChangedVolume(id);
+    _navigationMutex->unlock();
+    delete [] vertArray;
+    _markedAreaIDs.push_back(id);
+    return id;
+}
+
+void
+DetourNavigation::removeConvexAreaMarker(int id)
+{
+    if (_building)
+    {
+        ERR_PRINT("Unable to remove convex area while the navigation is being built.");
+        return;
+    }
+    if (!canChangeAreas())
+    {
+        return;
+    }
+
+    lockAndFinishLazyTiles();
+    rememberChangedVolume(id);
+    _inputGeometry->deleteConvexVolume(id);
+    _navigationMutex->unlock();
+    for (int i = 0; i < _markedAreaIDs.size(); ++i)
+    {
+        if (_markedAreaIDs[i] == id)
+        {
+            _markedAreaIDs.erase(_markedAreaIDs.begin() +i);
+            break;
+        }
+    }
+
+    // Remember this removal to be able to pass it on to rebuildChangedTiles() later on
+    _removedMarkedAreaIDs.push_back(id);
+}
+
+int
+DetourNavigation::addOffMeshConnection(Vector3 from, Vector3 to, bool bidirectional, float radius, int areaType)
+{
+    // Sanity checks
+    if (_building)
+    {
+        ERR_PRINT("Unable to add off-mesh connection while the navigation is being built.");
+        return -1;
+    }
+    if (!canChangeAreas())
+    {
+        return -1;
+    }
+    if (_offMeshConnections.size() >= DetourInputGeometry::MAX_OFFMESH_CONNECTIONS)
+    {
+        ERR_PRINT("Cannot add any more off-mesh connections. Limit reached.");
+        return -1;
+    }
+
+    // Create parameters
+    float start[3];
+    float end[3];
+    start[0] = from.x;
+    start[1] = from.y;
+    start[2] = from.z;
+    end[0] = to.x;
+    end[1] = to.y;
+    end[2] = to.z;
+    unsigned short flags;
+    switch (areaType) {
+        case POLY_AREA_GROUND:
+        case POLY_AREA_ROAD:
+        case POLY_AREA_GRASS:
+            flags = POLY_FLAGS_WALK;
+            break;
+        case POLY_AREA_DOOR:
+            flags = POLY_FLAGS_DOOR;
+            break;
+        case POLY_AREA_WATER:
+            flags = POLY_FLAGS_SWIM;
+            break;
+        case POLY_AREA_JUMP:
+            flags = POLY_AREA_JUMP;
+            break;
+        default:
+        {
+            ERR_PRINT(String("Unable to add off-mesh connection. Unknown area type: {0}").format(Array::make(areaType)));
+            return -1;
+        }
+    }
+
+    // Add the connection
+    lockAndFinishLazyTiles();
+    _inputGeometry->addOffMeshConnection(start, end, radius, bidirectional, areaType, flags);
+    int id = _inputGeometry->getOffMeshConnectionCount() - 1;
+    rememberChangedConnection(id);
+    _navigationMutex->unlock();
+    _offMeshConnections.push_back(id);
+    return id;
+}
+
+void
+DetourNavigation::removeOffMeshConnection(int id)
+{
+    if (_building)
+    {
+        ERR_PRINT("Unable to remove off-mesh connection while the navigation is being built.");
+        return;
+    }
+    if (!canChangeAreas())
+    {
+        return;
+    }
+
+    lockAndFinishLazyTiles();
+    rememberChangedConnection(id);
+    _inputGeometry->deleteOffMeshConnection(id);
+    _navigationMutex->unlock();
+    for (int i = 0; i < _offMeshConnections.size(); ++i)
+    {
+        if (_offMeshConnections[i] == id)
+        {
+            _offMeshConnections.erase(_offMeshConnections.begin() + i);
+            break;
+        }
+    }
+
+    // Remember this removal to be able to pass it on to rebuildChangedTiles() later on
+    _removedOffMeshConnections.push_back(id);
+}
+
+bool
+DetourNavigation::setQueryFilter(int index, String name, Dictionary weights)
+{
+    // Check index
+    if (index >= 16)
+    {
+        ERR_PRINT(String("Index exceeds allowed number of query filters: {0}").format(Array::make(index)));
+        return false;
+    }
+
+    // The crowds don't exist yet while building
+    _navigationMutex->lock();
+    if (_building)
+    {
+        QueuedQueryFilter queryFilter;
+        queryFilter.index = index;
+        queryFilter.name = name;
+        queryFilter.weights = weights;
+        _queuedQueryFilters.push_back(queryFilter);
+    }
+    else
+    {
+        applyQueryFilter(index, name, weights);
+    }
+    _navigationMutex->unlock();
+
+    return true;
+}
+
+void
+DetourNavigation::applyQueryFilter(int index, String name, Dictionary weights)
+{
+    // Set weights
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        dtCrowd* crowd = _navMeshes[i]->getCrowd();
+        dtQueryFilter* filter = crowd->getEditableFilter(index);
+
+        for (int j = 0; j < weights.keys().size(); ++j)
         {
             int areaIndex = weights.keys()[j];
             float weight = weights[weights.keys()[j]];
@@ -357,14 +1078,42 @@ DetourNavigation::setQueryFilter(int index, String name, Dictionary weights)
 
     // Assign name
     _queryFilterIndices[name] = index;
-
-    return true;
 }
 
 Ref<DetourCrowdAgent> DetourNavigation::addAgent(Ref<DetourCrowdAgentParameters> parameters)
 {
     _navigationMutex->lock();
 
+    // While building, the agent is only placed once the navigation is done
+    Ref<DetourCrowdAgent> agent = DetourCrowdAgent::_new();
+    if (_building)
+    {
+        _queuedAgents.push_back(agent);
+        _queuedAgentParameters.push_back(parameters);
+        _navigationMutex->unlock();
+        return agent;
+    }
+
+    if (!placeAgent(agent, parameters))
+    {
+        _navigationMutex->unlock();
+        return nullptr;
+    }
+
+    _navigationMutex->unlock();
+    return agent;
+}
+
+bool
+DetourNavigation::placeAgent(Ref<DetourCrowdAgent> agent, Ref<DetourCrowdAgentParameters> parameters)
+{
+    // The agent can only be placed on tiles that exist
+    if (_lazyBuildPool)
+    {
+        requestLazyTiles(parameters->position);
+        finishLazyTiles();
+    }
+
     // Find the correct crowd based on the parameters
     DetourNavigationMesh* navMesh = nullptr;
     float bestFitFactor = 10000.0f;
@@ -382,25 +1131,21 @@ Ref<DetourCrowdAgent> DetourNavigation::addAgent(Ref<DetourCrowdAgentParameters>
     if (navMesh == nullptr)
     {
         ERR_PRINT(String("Unable to add agent: Too big for any crowd: radius: {0} width: {1}").format(Array::make(parameters->radius, parameters->height)));
-        _navigationMutex->unlock();
-        return nullptr;
+        return false;
     }
 
     // Make sure the agent uses a known filter
     if (_queryFilterIndices.find(parameters->filterName) == _queryFilterIndices.end())
     {
         ERR_PRINT(String("Unable to add agent: Unknown filter: {0}").format(Array::make(parameters->filterName)));
-        _navigationMutex->unlock();
-        return nullptr;
+        return false;
     }
 
-    // Create and add the agent as main
-    Ref<DetourCrowdAgent> agent = DetourCrowdAgent::_new();
+    // Add the agent as main
     if (!navMesh->addAgent(agent, parameters))
     {
         ERR_PRINT("Unable to add agent.");
-        _navigationMutex->unlock();
-        return nullptr;
+        return false;
     }
     agent->setFilter(_queryFilterIndices[parameters->filterName]);
 
@@ -412,17 +1157,14 @@ Ref<DetourCrowdAgent> DetourNavigation::addAgent(Ref<DetourCrowdAgentParameters>
             if(!_navMeshes[i]->addAgent(agent, parameters, false))
             {
                 ERR_PRINT(String("Unable to add agent's shadow: {0}.").format(Array::make(i)));
-                _navigationMutex->unlock();
-                return nullptr;
+                return false;
             }
         }
     }
 
     // Add to our list of agents
     _agents.push_back(agent);
-
-    _navigationMutex->unlock();
-    return agent;
+    return true;
 }
 
 
@@ -431,6 +1173,18 @@ DetourNavigation::removeAgent(Ref<DetourCrowdAgent> agent)
 {
     _navigationMutex->lock();
 
+    // Queued agents were never placed in any crowd
+    for (int i = 0; i < _queuedAgents.size(); ++i)
+    {
+        if (_queuedAgents[i] == agent)
+        {
+            _queuedAgents.erase(_queuedAgents.begin() + i);
+            _queuedAgentParameters.erase(_queuedAgentParameters.begin() + i);
+            _navigationMutex->unlock();
+            return;
+        }
+    }
+
     // Agents should not be removed while the nav thread is busy
     // Thus this function is used instead of exposing destroy() to GDScript
     if (agent != nullptr)
@@ -460,10 +1214,17 @@ DetourNavigation::addCylinderObstacle(Vector3 position, float radius, float heig
     Ref<DetourObstacle> obstacle = DetourObstacle::_new();
     obstacle->initialize(OBSTACLE_TYPE_CYLINDER, position, Vector3(radius, height, 0.0f), 0.0f);
 
-    // Add the obstacle to all navmeshes
-    for (int i = 0; i < _navMeshes.size(); ++i)
+    // Add the obstacle to all navmeshes (once they are built)
+    if (_building)
+    {
+        _queuedObstacles.push_back(obstacle);
+    }
+    else
     {
-        _navMeshes[i]->addObstacle(obstacle);
+        for (int i = 0; i < _navMeshes.size(); ++i)
+        {
+            _navMeshes[i]->addObstacle(obstacle);
+        }
     }
 
     _obstacles.push_back(obstacle);
@@ -475,25 +1236,72 @@ Ref<DetourObstacle>
 DetourNavigation::addBoxObstacle(Vector3 position, Vector3 dimensions, float rotationRad)
 {
     _navigationMutex->lock();
-
-    // Create the obstacle
-    Ref<DetourObstacle> obstacle = DetourObstacle::_new();
-    obstacle->initialize(OBSTACLE_TYPE_BOX, position, dimensions, rotationRad);
-
-    // Add the obstacle to all navmeshes
-    for (int i = 0; i < _navMeshes.size(); ++i)
+
+    // Create the obstacle
+    Ref<DetourObstacle> obstacle = DetourObstacle::_new();
+    obstacle->initialize(OBSTACLE_TYPE_BOX, position, dimensions, rotationRad);
+
+    // Add the obstacle to all navmeshes (once they are built)
+    if (_building)
+    {
+        _queuedObstacles.push_back(obstacle);
+    }
+    else
+    {
+        for (int i = 0; i < _navMeshes.size(); ++i)
+        {
+            _navMeshes[i]->addObstacle(obstacle);
+        }
+    }
+
+    _obstacles.push_back(obstacle);
+    _navigationMutex->unlock();
+    return obstacle;
+}
+
+int
+DetourNavigation::addActivityAnchor(Vector3 position)
+{
+    _navigationMutex->lock();
+    int id = _nextActivityAnchorId++;
+    _activityAnchors[id] = position;
+    _navigationMutex->unlock();
+    return id;
+}
+
+void
+DetourNavigation::moveActivityAnchor(int id, Vector3 position)
+{
+    _navigationMutex->lock();
+    auto it = _activityAnchors.find(id);
+    if (it == _activityAnchors.end())
+    {
+        ERR_PRINT(String("Unable to move activity anchor. Unknown ID: {0}").format(Array::make(id)));
+    }
+    else
     {
-        _navMeshes[i]->addObstacle(obstacle);
+        it->second = position;
     }
+    _navigationMutex->unlock();
+}
 
-    _obstacles.push_back(obstacle);
+void
+DetourNavigation::removeActivityAnchor(int id)
+{
+    _navigationMutex->lock();
+    _activityAnchors.erase(id);
     _navigationMutex->unlock();
-    return obstacle;
 }
 
 MeshInstance*
 DetourNavigation::createDebugMesh(int index, bool drawCacheBounds)
 {
+    if (_building)
+    {
+        ERR_PRINT("Unable to create debug mesh while the navigation is being built.");
+        return nullptr;
+    }
+
     _navigationMutex->lock();
 
     // Sanity check
@@ -535,7 +1343,157 @@ DetourNavigation::save(String path, bool compressed)
         return false;
     }
 
-    // Open the file
+#ifdef _WIN32
+    // Windows can't replace a file while it is mapped, the whole save would be written only for the rename to fail
+    if (isMappedFile(path))
+    {
+        ERR_PRINT(String("DTNavSave: Unable to save to the file the navigation is mapped from, clear() it first: {0}").format(Array::make(path)));
+        return false;
+    }
+#endif
+
+    // A save still being written would replace this one once done
+    finishAsyncSave();
+    if (isRegionFile(path))
+    {
+        loadRemainingRegions();
+    }
+
+    // Written next to the target and only moved over it once complete, so a failed save keeps the previous one.
+    // On Linux & macOS a mapping of the previous file (see loadMapped()) keeps its data, Windows refuses to save to it above
+    String tempPath = path + ".tmp";
+    Ref<File> saveFile = createSaveFile(tempPath, compressed);
+    if (saveFile.ptr() == nullptr)
+    {
+        return false;
+    }
+
+    // Only copying into memory happens while locked, writing the file does not block the navigation
+    SaveBuffer buffer;
+    if (!bufferSaveData(&buffer, path, compressed))
+    {
+        saveFile->close();
+        Ref<Directory> dir = Directory::_new();
+        dir->remove(tempPath);
+        return false;
+    }
+    return writeSaveFile(&buffer, saveFile, tempPath, path);
+}
+
+bool
+DetourNavigation::saveAsync(String path, bool compressed)
+{
+    // Sanity check
+    if (!_initialized)
+    {
+        ERR_PRINT("DTNavSave: Unable to save navigation data. Navigation not initialized.");
+        return false;
+    }
+
+#ifdef _WIN32
+    // Windows can't replace a file while it is mapped, the whole save would be written only for the rename to fail
+    if (isMappedFile(path))
+    {
+        ERR_PRINT(String("DTNavSave: Unable to save to the file the navigation is mapped from, clear() it first: {0}").format(Array::make(path)));
+        return false;
+    }
+#endif
+
+    // One save at a time
+    finishAsyncSave();
+    if (isRegionFile(path))
+    {
+        loadRemainingRegions();
+    }
+
+    // Written next to the target and only moved over it once complete, so a failed save keeps the previous one
+    String tempPath = path + ".tmp";
+    Ref<File> saveFile = createSaveFile(tempPath, compressed);
+    if (saveFile.ptr() == nullptr)
+    {
+        return false;
+    }
+
+    // Only copying into memory happens while locked, writing and compressing the file happens in the background
+    SaveBuffer* buffer = new SaveBuffer();
+    if (!bufferSaveData(buffer, path, compressed))
+    {
+        delete buffer;
+        saveFile->close();
+        Ref<Directory> dir = Directory::_new();
+        dir->remove(tempPath);
+        return false;
+    }
+
+    _saveThread = new std::thread([this, buffer, saveFile, path, tempPath]() {
+        bool success = writeSaveFile(buffer, saveFile, tempPath, path);
+        delete buffer;
+
+        // Nobody is listening anymore if the save only finished in the destructor
+        if (!_destroying)
+        {
+            emit_signal("save_finished", path, success);
+        }
+    });
+    return true;
+}
+
+bool
+DetourNavigation::bufferSaveData(SaveBuffer* buffer, String path, bool compressed)
+{
+    // Tile columns of a lazily loaded navigation are copied from its file, read them before locking
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        _navMeshes[i]->readSavedRegions();
+    }
+
+    uint64_t generation = createSaveGeneration();
+    lockAndFinishLazyTiles();
+    bool success = writeSaveData(buffer, generation);
+    if (success)
+    {
+        // Incremental saves wait for the file to be written, so they already build on it
+        _journalBasePath = path;
+        _journalBaseCompressed = compressed;
+        _journalBaseGeneration = generation;
+        _geometryChangedSinceSave = false;
+    }
+    _navigationMutex->unlock();
+    return success;
+}
+
+bool
+DetourNavigation::writeSaveFile(const SaveBuffer* buffer, Ref<File> saveFile, String tempPath, String path)
+{
+    // Compressed files are only compressed and written once closed
+    buffer->writeTo(saveFile);
+    saveFile->close();
+    bool success = replaceSaveFile(tempPath, path);
+
+    _navigationMutex->lock();
+    if (success)
+    {
+        // The new base contains everything the journal did
+        Ref<Directory> dir = Directory::_new();
+        String journalPath = getJournalPath(path);
+        if (dir->file_exists(journalPath))
+        {
+            dir->remove(journalPath);
+        }
+    }
+    else
+    {
+        // The previous base is not the one incremental saves would build on anymore
+        _journalBasePath = "";
+    }
+    _navigationMutex->unlock();
+
+    return success;
+}
+
+Ref<File>
+DetourNavigation::createSaveFile(String path, bool compressed)
+{
     Ref<File> saveFile = File::_new();
     Error result;
     Ref<Directory> dir = Directory::_new();
@@ -543,7 +1501,7 @@ DetourNavigation::save(String path, bool compressed)
     if (result != Error::OK)
     {
         ERR_PRINT(String("DTNavSave: Error while creating navigation file path: {0} {1}").format(Array::make(path, (int)result)));
-        return false;
+        return nullptr;
     }
     if (compressed)
     {
@@ -556,13 +1514,32 @@ DetourNavigation::save(String path, bool compressed)
     if (result != Error::OK)
     {
         ERR_PRINT(String("DTNavSave: Error while opening navigation save file: {0} {1}").format(Array::make(path, (int)result)));
+        return nullptr;
+    }
+
+    return saveFile;
+}
+
+bool
+DetourNavigation::replaceSaveFile(String tempPath, String path)
+{
+    Ref<Directory> dir = Directory::_new();
+    Error result = dir->rename(tempPath, path);
+    if (result != Error::OK)
+    {
+        ERR_PRINT(String("DTNavSave: Error while replacing navigation save file: {0} {1}").format(Array::make(path, (int)result)));
+        dir->remove(tempPath);
         return false;
     }
+    return true;
+}
 
-    // Version
+bool
+DetourNavigation::writeSaveData(SaveBuffer* saveFile, uint64_t generation)
+{
+    // Version & generation
     saveFile->store_16(SAVE_DATA_VERSION);
-
-    _navigationMutex->lock();
+    saveFile->store_64(generation);
 
     // Input geometry
     if (!_inputGeometry->save(saveFile))
@@ -582,6 +1559,166 @@ DetourNavigation::save(String path, bool compressed)
         }
     }
 
+    // Agents, obstacles, areas etc.
+    return saveState(saveFile);
+}
+
+void
+DetourNavigation::loadRemainingRegions()
+{
+    // Tile columns not loaded yet are read by the lazy build threads like any other, the navigation keeps running meanwhile
+    lockAndFinishLazyTiles();
+    if (_lazyBuildPool)
+    {
+        std::vector<std::pair<int, int> > tiles;
+        for (int i = 0; i < _navMeshes.size(); ++i)
+        {
+            DetourNavigationMesh* navMesh = _navMeshes[i];
+            tiles.clear();
+            navMesh->requestRemainingRegions(tiles);
+            for (int j = 0; j < tiles.size(); ++j)
+            {
+                const int x = tiles[j].first;
+                const int z = tiles[j].second;
+                _lazyBuildPool->submit(*_lazyBuildGroup, [navMesh, x, z]() {
+                    navMesh->rasterizeLazyTile(x, z);
+                });
+            }
+        }
+    }
+    _navigationMutex->unlock();
+
+    // Only adding them needs the lock
+    lockAndFinishLazyTiles();
+    _navigationMutex->unlock();
+}
+
+bool
+DetourNavigation::isRegionFile(String path) const
+{
+    return !_regionFilePath.empty() && ProjectSettings::get_singleton()->globalize_path(path) == _regionFilePath;
+}
+
+bool
+DetourNavigation::isMappedFile(String path) const
+{
+    return !_mappedFilePath.empty() && ProjectSettings::get_singleton()->globalize_path(path) == _mappedFilePath;
+}
+
+void
+DetourNavigation::finishAsyncSave()
+{
+    if (_saveThread)
+    {
+        _saveThread->join();
+        delete _saveThread;
+        _saveThread = nullptr;
+    }
+}
+
+bool
+DetourNavigation::saveIncremental(String path)
+{
+    // Sanity check
+    if (!_initialized)
+    {
+        ERR_PRINT("DTNavSave: Unable to save navigation data. Navigation not initialized.");
+        return false;
+    }
+
+    // Start a new base if there is none to append to (added geometry is not journaled)
+    finishAsyncSave();
+    Ref<File> baseFile = File::_new();
+    if (path != _journalBasePath || _geometryChangedSinceSave || !baseFile->file_exists(path))
+    {
+        return save(path, path == _journalBasePath && _journalBaseCompressed);
+    }
+
+    // A record cut short (e.g. by a crash) would hide everything appended after it, compact instead
+    Ref<File> journal;
+    std::vector<int64_t> records;
+    if (!openJournal(path, _journalBaseGeneration, journal, records))
+    {
+        return save(path, _journalBaseCompressed);
+    }
+    if (journal.ptr() != nullptr)
+    {
+        bool complete = journal->get_position() == journal->get_len();
+        journal->close();
+        if (!complete)
+        {
+            WARN_PRINT("DTNavSave: Journal is incomplete, saving a new base instead.");
+            return save(path, _journalBaseCompressed);
+        }
+    }
+
+    // Open the journal for appending, or start a new one if there is none belonging to the save file
+    bool appending = journal.ptr() != nullptr;
+    String journalPath = getJournalPath(path);
+    journal = File::_new();
+    Error result = appending ? journal->open(journalPath, File::READ_WRITE) : journal->open(journalPath, File::WRITE);
+    if (result != Error::OK)
+    {
+        ERR_PRINT(String("DTNavSave: Error while opening navigation journal: {0} {1}").format(Array::make(journalPath, (int)result)));
+        return false;
+    }
+    if (!appending)
+    {
+        journal->store_16(JOURNAL_DATA_VERSION);
+        journal->store_64(_journalBaseGeneration);
+    }
+    journal->seek_end(0);
+
+    // The record is copied into memory while locked and appended afterwards
+    SaveBuffer record;
+    _navigationMutex->lock();
+
+    // Areas & off-mesh connections
+    if (!_inputGeometry->saveAreas(&record))
+    {
+        ERR_PRINT("DTNavSave: Unable to save areas.");
+        _navigationMutex->unlock();
+        journal->close();
+        return false;
+    }
+
+    // Tiles rebuilt since the last save
+    record.store_32(_navMeshes.size());
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        if (!_navMeshes[i]->saveChangedTiles(&record))
+        {
+            ERR_PRINT(String("DTNavSave: Unable to save changed tiles of nav mesh {0}").format(Array::make(i)));
+            _navigationMutex->unlock();
+            journal->close();
+            return false;
+        }
+    }
+
+    // Agents, obstacles, areas etc.
+    if (!saveState(&record))
+    {
+        _navigationMutex->unlock();
+        journal->close();
+        return false;
+    }
+
+    _navigationMutex->unlock();
+
+    // Record size, only written once the record is complete
+    int64_t recordStart = journal->get_position();
+    journal->store_32(0);
+    record.writeTo(journal);
+    journal->seek(recordStart);
+    journal->store_32(record.get_position());
+    journal->close();
+
+    return true;
+}
+
+bool
+DetourNavigation::saveState(SaveBuffer* saveFile)
+{
     // Query filters
     saveFile->store_32(_queryFilterIndices.size());
     for (const auto& entry : _queryFilterIndices)
@@ -621,35 +1758,145 @@ DetourNavigation::save(String path, bool compressed)
         }
     }
 
-    // Marked area IDs
-    saveFile->store_32(_markedAreaIDs.size());
-    for (int i = 0; i < _markedAreaIDs.size(); ++i)
+    // Marked area IDs
+    saveFile->store_32(_markedAreaIDs.size());
+    for (int i = 0; i < _markedAreaIDs.size(); ++i)
+    {
+        saveFile->store_32(_markedAreaIDs[i]);
+    }
+
+    // Off-mesh connections
+    saveFile->store_32(_offMeshConnections.size());
+    for (int i = 0; i < _offMeshConnections.size(); ++i)
+    {
+        saveFile->store_32(_offMeshConnections[i]);
+    }
+
+    // Lazy building
+    saveFile->store_float(_lazyBuildRadius);
+    saveFile->store_32(_activityAnchors.size());
+    for (auto const& anchor : _activityAnchors)
+    {
+        saveFile->store_32(anchor.first);
+        saveFile->store_var(anchor.second);
+    }
+    saveFile->store_32(_nextActivityAnchorId);
+
+    return true;
+}
+
+bool
+DetourNavigation::load(String path, bool compressed)
+{
+    Ref<File> saveFile = openSaveFile(path, compressed);
+    if (saveFile.ptr() == nullptr)
+    {
+        return false;
+    }
+
+    bool success = loadFromFile(saveFile, nullptr, nullptr, path, compressed, 0.0f);
+    saveFile->close();
+    if (!success)
+    {
+        return false;
+    }
+
+    startNavigationThread();
+    return true;
+}
+
+bool
+DetourNavigation::loadAsync(String path, bool compressed)
+{
+    Ref<File> saveFile = openSaveFile(path, compressed);
+    if (saveFile.ptr() == nullptr)
+    {
+        return false;
+    }
+
+    startBuildThread([this, saveFile, path, compressed](BuildProgress* progress) {
+        bool success = loadFromFile(saveFile, progress, nullptr, path, compressed, 0.0f);
+        saveFile->close();
+        return success;
+    });
+    return true;
+}
+
+bool
+DetourNavigation::loadMapped(String path)
+{
+    Ref<File> saveFile = openSaveFile(path, false);
+    if (saveFile.ptr() == nullptr)
+    {
+        return false;
+    }
+
+    // Only uncompressed files on disk can be mapped, not those within a pack
+    MappedFile* mappedFile = new MappedFile();
+    if (!mappedFile->open(ProjectSettings::get_singleton()->globalize_path(path)))
+    {
+        ERR_PRINT(String("DTNavLoad: Unable to map navigation save file: {0}").format(Array::make(path)));
+        delete mappedFile;
+        saveFile->close();
+        return false;
+    }
+
+    // The tiles keep pointing into the mapping until the navigation is cleared
+    delete _mappedFile;
+    _mappedFile = mappedFile;
+    bool success = loadFromFile(saveFile, nullptr, _mappedFile, path, false, 0.0f);
+    saveFile->close();
+    if (!success)
+    {
+        return false;
+    }
+    _mappedFilePath = ProjectSettings::get_singleton()->globalize_path(path);
+
+    startNavigationThread();
+    return true;
+}
+
+bool
+DetourNavigation::loadLazy(String path, float radius)
+{
+    if (radius <= 0.0f)
     {
-        saveFile->store_32(_markedAreaIDs[i]);
+        ERR_PRINT(String("DTNavLoad: Invalid radius to load tiles within: {0}").format(Array::make(radius)));
+        return false;
     }
 
-    // Off-mesh connections
-    saveFile->store_32(_offMeshConnections.size());
-    for (int i = 0; i < _offMeshConnections.size(); ++i)
+    // The navmeshes open the file again to read the regions from, it can't be compressed
+    Ref<File> saveFile = openSaveFile(path, false);
+    if (saveFile.ptr() == nullptr)
     {
-        saveFile->store_32(_offMeshConnections[i]);
+        return false;
     }
 
-    _navigationMutex->unlock();
-
+    bool success = loadFromFile(saveFile, nullptr, nullptr, path, false, radius);
     saveFile->close();
+    if (!success)
+    {
+        return false;
+    }
+    _regionFilePath = ProjectSettings::get_singleton()->globalize_path(path);
 
+    startNavigationThread();
     return true;
 }
 
-bool
-DetourNavigation::load(String path, bool compressed)
+Ref<File>
+DetourNavigation::openSaveFile(String path, bool compressed)
 {
     // Sanity check
     if (_initialized)
     {
         ERR_PRINT("DTNavLoad: Unable to load new navigation data. Navigation still running, please use clear().");
-        return false;
+        return nullptr;
+    }
+    if (_building)
+    {
+        ERR_PRINT("DTNavLoad: Unable to load new navigation data. Navigation is still being built.");
+        return nullptr;
     }
 
     // Load the file
@@ -666,13 +1913,29 @@ DetourNavigation::load(String path, bool compressed)
     if (result != Error::OK)
     {
         ERR_PRINT(String("DTNavLoad: Error while opening navigation save file: {0} {1}").format(Array::make(path, (int)result)));
-        return false;
+        return nullptr;
     }
 
-    // Version
+    return saveFile;
+}
+
+bool
+DetourNavigation::loadFromFile(Ref<File> saveFile, BuildProgress* progress, const MappedFile* mappedFile, String path, bool compressed, float regionRadius)
+{
+    // Version & generation
     int version = saveFile->get_16();
-    if (version == SAVE_DATA_VERSION)
+    if (version >= 1 && version <= SAVE_DATA_VERSION)
     {
+        uint64_t generation = version >= 3 ? saveFile->get_64() : 0;
+
+        // A journal written by saveIncremental() is replayed on top
+        Ref<File> journal;
+        std::vector<int64_t> journalRecords;
+        if (!openJournal(path, generation, journal, journalRecords))
+        {
+            return false;
+        }
+
         // Input geometry
         if (!_inputGeometry->load(saveFile))
         {
@@ -680,12 +1943,21 @@ DetourNavigation::load(String path, bool compressed)
             return false;
         }
 
-        // Navmesh(es)
+        // Columns not in the file would have to be rasterized
+        if (regionRadius > 0.0f && _inputGeometry->isFrozen())
+        {
+            ERR_PRINT("DTNavLoad: Unable to load tiles on demand, the saved geometry is frozen.");
+            return false;
+        }
+
+        // Navmesh(es), their tiles are read one after the other but built in parallel
+        ThreadPool threadPool(0);
         int numNavMeshes = saveFile->get_32();
         for (int i = 0; i < numNavMeshes; ++i)
         {
             DetourNavigationMesh* navMesh = new DetourNavigationMesh();
-            if (!navMesh->load(_inputGeometry, _recastContext, saveFile))
+            // Saved navmesh tiles might still have obstacles cut out that were removed since, so build journaled navmeshes from the layers
+            if (!navMesh->load(_inputGeometry, _recastContext, saveFile, progress, mappedFile, journalRecords.empty(), &threadPool, regionRadius > 0.0f))
             {
                 ERR_PRINT("DTNavLoad: Unable to load navmesh.");
                 delete navMesh;
@@ -694,122 +1966,306 @@ DetourNavigation::load(String path, bool compressed)
             _navMeshes.push_back(navMesh);
         }
 
-        // Query filters
-        int numQueryFilters = saveFile->get_32();
-        for (int i = 0; i < numQueryFilters; ++i)
+        // Navmeshes that were built sharing their heightfields continue doing so
+        std::vector<VoxelSettings> voxelSettings;
+        for (int i = 0; i < _navMeshes.size(); ++i)
         {
-            // Get name & index
-            String name = saveFile->get_pascal_string();
-            int index = saveFile->get_32();
-            _queryFilterIndices[name] = index;
-
-            // Get filter values
-            int excludeFlags = saveFile->get_16();
-            float areaCosts[DT_MAX_AREAS];
-            for (int j = 0; j < DT_MAX_AREAS; ++j)
-            {
-                areaCosts[j] = saveFile->get_float();
-            }
+            const rcConfig* config = _navMeshes[i]->getRecastConfig();
+            VoxelSettings settings;
+            settings.cellSize = config->cs;
+            settings.cellHeight = config->ch;
+            settings.walkableSlopeAngle = config->walkableSlopeAngle;
+            settings.tileSize = config->tileSize;
+            settings.fixedBorderSize = config->borderSize;
+            settings.borderSize = config->borderSize;
+            settings.walkableClimb = config->walkableClimb;
+            voxelSettings.push_back(settings);
+        }
+        shareHeightfields(voxelSettings);
 
-            // Apply filter across navmeshes
-            for (int j = 0; j < _navMeshes.size(); ++j)
+        // Regions are read on demand, already for placing the loaded agents
+        if (regionRadius > 0.0f)
+        {
+            _lazyBuildRadius = regionRadius;
+            for (int i = 0; i < _navMeshes.size(); ++i)
             {
-                dtCrowd* crowd = _navMeshes[j]->getCrowd();
-                dtQueryFilter* filter = crowd->getEditableFilter(index);
-                filter->setExcludeFlags(excludeFlags);
-                filter->setAreaCost(j, areaCosts[j]);
+                _navMeshes[i]->enableLazyBuild(_lazyBuildRadius, std::vector<Vector3>());
             }
+            startLazyBuild(0);
         }
 
-        // Agents
-        int numAgents = saveFile->get_32();
-        for (int i = 0; i < numAgents; ++i)
+        // Agents, obstacles, areas etc. of the base, unless the journal has newer ones
+        if (!journalRecords.empty())
         {
-            Ref<DetourCrowdAgent> agent = DetourCrowdAgent::_new();
-            if (!agent->load(saveFile))
+            if (!replayJournal(journal, journalRecords))
             {
-                ERR_PRINT("DTNavLoad: Unable to load agent.");
+                ERR_PRINT("DTNavLoad: Unable to replay journal.");
                 return false;
             }
+        }
+        else if (!loadState(saveFile, version))
+        {
+            return false;
+        }
+        _journalBasePath = path;
+        _journalBaseCompressed = compressed;
+        _journalBaseGeneration = generation;
+        _geometryChangedSinceSave = false;
+    }
+    else
+    {
+        ERR_PRINT(String("DTNavLoad: Unknown version {0}").format(Array::make(version)));
+        return false;
+    }
 
-            // Load parameter values
-            Ref<DetourCrowdAgentParameters> params = DetourCrowdAgentParameters::_new();
-            if (!agent->loadParameterValues(params, saveFile))
-            {
-                ERR_PRINT("DTNavLoad: Unable to load agent parameter values.");
-                return false;
-            }
+    return true;
+}
 
-            // Fully apply the agent
-            for (int j = 0; j < numNavMeshes; ++j)
-            {
-                bool isMain = j == agent->getCrowdIndex();
-                if (!_navMeshes[j]->addAgent(agent, params, isMain))
-                {
-                    ERR_PRINT("DTNavLoad: Unable to add loaded agent via navmesh.");
-                    return false;
-                }
-            }
-            agent->setFilter(agent->getFilterIndex());
+bool
+DetourNavigation::loadState(Ref<File> saveFile, int version)
+{
+    // Query filters
+    int numQueryFilters = saveFile->get_32();
+    for (int i = 0; i < numQueryFilters; ++i)
+    {
+        // Get name & index
+        String name = saveFile->get_pascal_string();
+        int index = saveFile->get_32();
+        _queryFilterIndices[name] = index;
+
+        // Get filter values
+        int excludeFlags = saveFile->get_16();
+        float areaCosts[DT_MAX_AREAS];
+        for (int j = 0; j < DT_MAX_AREAS; ++j)
+        {
+            areaCosts[j] = saveFile->get_float();
+        }
 
-            // Request movement for the target if it was moving (loading agent resent some states so movement has to be requested again)
-            if (agent->isMoving())
-            {
-                agent->moveTowards(agent->getTargetPosition());
-            }
+        // Apply filter across navmeshes
+        for (int j = 0; j < _navMeshes.size(); ++j)
+        {
+            dtCrowd* crowd = _navMeshes[j]->getCrowd();
+            dtQueryFilter* filter = crowd->getEditableFilter(index);
+            filter->setExcludeFlags(excludeFlags);
+            filter->setAreaCost(j, areaCosts[j]);
+        }
+    }
+
+    // Agents
+    int numAgents = saveFile->get_32();
+    for (int i = 0; i < numAgents; ++i)
+    {
+        Ref<DetourCrowdAgent> agent = DetourCrowdAgent::_new();
+        if (!agent->load(saveFile))
+        {
+            ERR_PRINT("DTNavLoad: Unable to load agent.");
+            return false;
+        }
+
+        // Load parameter values
+        Ref<DetourCrowdAgentParameters> params = DetourCrowdAgentParameters::_new();
+        if (!agent->loadParameterValues(params, saveFile))
+        {
+            ERR_PRINT("DTNavLoad: Unable to load agent parameter values.");
+            return false;
+        }
 
-            _agents.push_back(agent);
+        // The agent can only be placed on tiles that are there
+        if (_lazyBuildPool)
+        {
+            requestLazyTiles(params->position);
+            finishLazyTiles();
         }
 
-        // Obstacles
-        int numObstacles = saveFile->get_32();
-        for (int i = 0; i < numObstacles; ++i)
+        // Fully apply the agent
+        for (int j = 0; j < _navMeshes.size(); ++j)
         {
-            Ref<DetourObstacle> obstacle = DetourObstacle::_new();
-            if (!obstacle->load(saveFile))
+            bool isMain = j == agent->getCrowdIndex();
+            if (!_navMeshes[j]->addAgent(agent, params, isMain))
             {
-                ERR_PRINT(String("DTNavLoad: Unable to load obstacle {0}").format(Array::make(i)));
+                ERR_PRINT("DTNavLoad: Unable to add loaded agent via navmesh.");
                 return false;
             }
+        }
+        agent->setFilter(agent->getFilterIndex());
 
-            // Add the obstacle to all navmeshes
-            for (int i = 0; i < _navMeshes.size(); ++i)
-            {
-                _navMeshes[i]->addObstacle(obstacle);
-            }
-            _obstacles.push_back(obstacle);
+        // Request movement for the target if it was moving (loading agent resent some states so movement has to be requested again)
+        if (agent->isMoving())
+        {
+            agent->moveTowards(agent->getTargetPosition());
         }
 
-        // Marked area IDs
-        int numMarkedAreaIds = saveFile->get_32();
-        for (int i = 0; i < numMarkedAreaIds; ++i)
+        _navigationMutex->lock();
+        _agents.push_back(agent);
+        _navigationMutex->unlock();
+    }
+
+    // Obstacles
+    int numObstacles = saveFile->get_32();
+    for (int i = 0; i < numObstacles; ++i)
+    {
+        Ref<DetourObstacle> obstacle = DetourObstacle::_new();
+        if (!obstacle->load(saveFile))
         {
-            _markedAreaIDs.push_back(saveFile->get_32());
+            ERR_PRINT(String("DTNavLoad: Unable to load obstacle {0}").format(Array::make(i)));
+            return false;
         }
 
-        // Off-mesh connections
-        int numConnections = saveFile->get_32();
-        for (int i = 0; i < numConnections; ++i)
+        // Add the obstacle to all navmeshes
+        for (int i = 0; i < _navMeshes.size(); ++i)
         {
-            _offMeshConnections.push_back(saveFile->get_32());
+            _navMeshes[i]->addObstacle(obstacle);
         }
+        _navigationMutex->lock();
+        _obstacles.push_back(obstacle);
+        _navigationMutex->unlock();
     }
-    else
+
+    // Marked area IDs
+    int numMarkedAreaIds = saveFile->get_32();
+    for (int i = 0; i < numMarkedAreaIds; ++i)
     {
-        ERR_PRINT(String("DTNavLoad: Unknown version {0}").format(Array::make(version)));
+        _markedAreaIDs.push_back(saveFile->get_32());
+    }
+
+    // Off-mesh connections
+    int numConnections = saveFile->get_32();
+    for (int i = 0; i < numConnections; ++i)
+    {
+        _offMeshConnections.push_back(saveFile->get_32());
+    }
+
+    // Lazy building (older saves were always built completely)
+    if (version >= 2)
+    {
+        float lazyBuildRadius = saveFile->get_float();
+        int numAnchors = saveFile->get_32();
+        _navigationMutex->lock();
+        for (int i = 0; i < numAnchors; ++i)
+        {
+            int id = saveFile->get_32();
+            _activityAnchors[id] = saveFile->get_var(true);
+        }
+        _nextActivityAnchorId = saveFile->get_32();
+        _navigationMutex->unlock();
+
+        // Unless loading regions on demand already started building lazily
+        if (lazyBuildRadius > 0.0f && !_lazyBuildPool)
+        {
+            _lazyBuildRadius = lazyBuildRadius;
+            for (int i = 0; i < _navMeshes.size(); ++i)
+            {
+                _navMeshes[i]->enableLazyBuild(_lazyBuildRadius, std::vector<Vector3>());
+            }
+            startLazyBuild(0);
+        }
+    }
+
+    return true;
+}
+
+bool
+DetourNavigation::openJournal(String path, uint64_t generation, Ref<File>& journal, std::vector<int64_t>& records)
+{
+    journal = Ref<File>();
+    records.clear();
+    String journalPath = getJournalPath(path);
+    Ref<File> file = File::_new();
+    if (!file->file_exists(journalPath))
+    {
+        return true;
+    }
+    Error result = file->open(journalPath, File::READ);
+    if (result != Error::OK)
+    {
+        ERR_PRINT(String("DTNavLoad: Error while opening navigation journal: {0} {1}").format(Array::make(journalPath, (int)result)));
+        return false;
+    }
+    int version = file->get_16();
+    if (version < 1 || version > JOURNAL_DATA_VERSION)
+    {
+        ERR_PRINT(String("DTNavLoad: Unknown journal version {0}").format(Array::make(version)));
+        file->close();
         return false;
     }
 
-    // Done. Start the thread.
-    _stopThread = false;
-    _navigationThread = new std::thread(&DetourNavigation::navigationThreadFunction, this);
-    _initialized = true;
+    // A journal left behind by a save file that was replaced since (e.g. by a crash before it was removed) does not apply
+    uint64_t journalGeneration = version >= 2 ? file->get_64() : 0;
+    if (journalGeneration != generation)
+    {
+        WARN_PRINT(String("DTNavLoad: Ignoring journal of another save file: {0}").format(Array::make(journalPath)));
+        file->close();
+        return true;
+    }
+
+    // Collect the complete records, leaving the position after the last one
+    int64_t length = file->get_len();
+    while (file->get_position() + 4 <= length)
+    {
+        int64_t recordStart = file->get_position();
+        int64_t recordSize = file->get_32();
+        if (recordSize == 0 || recordStart + 4 + recordSize > length)
+        {
+            file->seek(recordStart);
+            break;
+        }
+        records.push_back(recordStart + 4);
+        file->seek(recordStart + 4 + recordSize);
+    }
+    journal = file;
+    return true;
+}
+
+bool
+DetourNavigation::replayJournal(Ref<File> journal, const std::vector<int64_t>& records)
+{
+    for (int i = 0; i < records.size(); ++i)
+    {
+        journal->seek(records[i]);
+
+        // Areas & off-mesh connections, needed to build the tiles
+        if (!_inputGeometry->loadAreas(journal))
+        {
+            ERR_PRINT("DTNavLoad: Unable to load journaled areas.");
+            return false;
+        }
+
+        // Tiles rebuilt before this record
+        int numNavMeshes = journal->get_32();
+        if (numNavMeshes != _navMeshes.size())
+        {
+            ERR_PRINT(String("DTNavLoad: Journal has {0} navmeshes instead of {1}.").format(Array::make(numNavMeshes, (int)_navMeshes.size())));
+            return false;
+        }
+        for (int j = 0; j < numNavMeshes; ++j)
+        {
+            if (!_navMeshes[j]->loadChangedTiles(journal))
+            {
+                ERR_PRINT(String("DTNavLoad: Unable to load changed tiles of navmesh {0}.").format(Array::make(j)));
+                return false;
+            }
+        }
+
+        // Only the latest agents, obstacles etc. are of interest
+        if (i == records.size() - 1 && !loadState(journal, SAVE_DATA_VERSION))
+        {
+            return false;
+        }
+    }
+    journal->close();
+
     return true;
 }
 
 void
 DetourNavigation::clear()
 {
+    if (_building)
+    {
+        ERR_PRINT("Unable to clear the navigation while it is being built.");
+        return;
+    }
+
     // Stop the thread
     _stopThread = true;
     if (_navigationThread)
@@ -821,6 +2277,17 @@ DetourNavigation::clear()
         delete _navigationThread;
     }
     _navigationThread = nullptr;
+    finishAsyncSave();
+    stopLazyBuild();
+    _lazyBuildRadius = 0.0f;
+    _activityAnchors.clear();
+    _changedGeometryBounds.clear();
+    _changedAreaBounds.clear();
+    _journalBasePath = "";
+    _journalBaseCompressed = false;
+    _journalBaseGeneration = 0;
+    _geometryChangedSinceSave = false;
+    _regionFilePath = "";
 
     // Remove all agents
     for (int i = 0; i < _agents.size(); ++i)
@@ -836,10 +2303,13 @@ DetourNavigation::clear()
     }
     _obstacles.clear();
 
-    // Remove all marked areas
-    for (int i = 0; i < _markedAreaIDs.size(); ++i)
+    // Remove all marked areas (frozen geometry refuses to, but is cleared right after anyway)
+    if (!_inputGeometry->isFrozen())
     {
-        removeConvexAreaMarker(_markedAreaIDs[i]);
+        for (int i = 0; i < _markedAreaIDs.size(); ++i)
+        {
+            removeConvexAreaMarker(_markedAreaIDs[i]);
+        }
     }
     _markedAreaIDs.clear();
 
@@ -852,12 +2322,175 @@ DetourNavigation::clear()
         delete _navMeshes[i];
     }
     _navMeshes.clear();
+    deleteHeightfieldCaches();
+
+    // Only now the tiles are gone, the file they pointed into can be released
+    delete _mappedFile;
+    _mappedFile = nullptr;
+    _mappedFilePath = "";
 
     // Other misc stuff
     _queryFilterIndices.clear();
     _initialized = false;
 }
 
+Dictionary
+DetourNavigation::getBuildProfile()
+{
+    if (_building)
+    {
+        ERR_PRINT("Unable to get the build profile while the navigation is being built.");
+        return Dictionary();
+    }
+
+    // Each navmesh builds its tiles with its own contexts, combine them all
+    RecastContext profile;
+    profile.mergeProfile(*_recastContext);
+    lockAndFinishLazyTiles();
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        _navMeshes[i]->collectBuildProfile(profile);
+    }
+    _navigationMutex->unlock();
+    return profile.getProfile(PROFILE_SLOWEST_TILES);
+}
+
+void
+DetourNavigation::resetBuildProfile()
+{
+    if (_building)
+    {
+        ERR_PRINT("Unable to reset the build profile while the navigation is being built.");
+        return;
+    }
+
+    _recastContext->resetProfile();
+    lockAndFinishLazyTiles();
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        _navMeshes[i]->resetBuildProfile();
+    }
+    _navigationMutex->unlock();
+}
+
+Dictionary
+DetourNavigation::getAllocatorStats()
+{
+    Dictionary result;
+    if (_building)
+    {
+        ERR_PRINT("Unable to get the allocator stats while the navigation is being built.");
+        return result;
+    }
+
+    lockAndFinishLazyTiles();
+    AllocatorStats stats;
+    size_t areaCacheSize = 0;
+    size_t layerCacheSize = 0;
+    int layerCacheHits = 0;
+    int layerCacheMisses = 0;
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        stats.add(_navMeshes[i]->getAllocatorStats());
+        areaCacheSize += _navMeshes[i]->getAreaCacheSize();
+
+        size_t size = 0;
+        int hits = 0, misses = 0;
+        _navMeshes[i]->getLayerCacheStats(size, hits, misses);
+        layerCacheSize += size;
+        layerCacheHits += hits;
+        layerCacheMisses += misses;
+    }
+    _navigationMutex->unlock();
+
+    result["capacity"] = (int)stats.capacity;
+    result["live"] = (int)stats.live;
+    result["peak"] = (int)stats.peak;
+    result["overflows"] = stats.overflows;
+    result["failures"] = stats.failures;
+    result["areaCacheSize"] = (int)areaCacheSize;
+    result["layerCacheSize"] = (int)layerCacheSize;
+    result["layerCacheHits"] = layerCacheHits;
+    result["layerCacheMisses"] = layerCacheMisses;
+    return result;
+}
+
+Dictionary
+DetourNavigation::benchmarkCompression()
+{
+    Dictionary result;
+    if (_building)
+    {
+        ERR_PRINT("Unable to benchmark the compression while the navigation is being built.");
+        return result;
+    }
+
+    lockAndFinishLazyTiles();
+    std::vector<CompressionBenchmark> benchmarks;
+    for (int i = 0; i < NUM_TILE_COMPRESSIONS; ++i)
+    {
+        benchmarks.push_back(CompressionBenchmark(i));
+    }
+    for (int i = 0; i < _navMeshes.size(); ++i)
+    {
+        std::vector<CompressionBenchmark> navMeshBenchmarks = _navMeshes[i]->benchmarkCompression();
+        for (int j = 0; j < navMeshBenchmarks.size(); ++j)
+        {
+            benchmarks[navMeshBenchmarks[j].compression].add(navMeshBenchmarks[j]);
+        }
+    }
+    _navigationMutex->unlock();
+
+    // Bytes per microsecond are MB/s
+    for (int i = 0; i < benchmarks.size(); ++i)
+    {
+        const CompressionBenchmark& benchmark = benchmarks[i];
+        Dictionary entry;
+        entry["tiles"] = benchmark.tiles;
+        entry["rawBytes"] = (int)benchmark.rawBytes;
+        entry["compressedBytes"] = (int)benchmark.compressedBytes;
+        entry["ratio"] = benchmark.compressedBytes > 0 ? (float)benchmark.rawBytes / benchmark.compressedBytes : 0.0f;
+        entry["compressMBs"] = (float)benchmark.rawBytes / rcMax(benchmark.compressUsec, (int64_t)1);
+        entry["decompressMBs"] = (float)benchmark.rawBytes / rcMax(benchmark.decompressUsec, (int64_t)1);
+        result[getTileCompressionName(benchmark.compression)] = entry;
+    }
+    return result;
+}
+
+Dictionary
+DetourNavigation::getGeometryStats()
+{
+    Dictionary result;
+    if (_building)
+    {
+        ERR_PRINT("Unable to get the geometry stats while the navigation is being built.");
+        return result;
+    }
+
+    _navigationMutex->lock();
+    const MeshDataAccumulator* mesh = _inputGeometry->getMesh();
+    if (mesh == nullptr)
+    {
+        _navigationMutex->unlock();
+        return result;
+    }
+    MeshPreprocessStats stats = mesh->getPreprocessStats();
+    _navigationMutex->unlock();
+
+    result["inputVertices"] = stats.inputVertices;
+    result["inputTriangles"] = stats.inputTriangles;
+    result["outputVertices"] = stats.outputVertices;
+    result["outputTriangles"] = stats.outputTriangles;
+    result["weldedVertices"] = stats.weldedVertices;
+    result["unusedVertices"] = stats.unusedVertices;
+    result["degenerateTriangles"] = stats.degenerateTriangles;
+    result["invalidTriangles"] = stats.invalidTriangles;
+    result["inputBytes"] = (int)stats.inputBytes;
+    result["outputBytes"] = (int)stats.outputBytes;
+    result["timeUsec"] = (int)stats.timeUsec;
+    return result;
+}
+
 Array
 DetourNavigation::getAgents()
 {
@@ -936,6 +2569,23 @@ DetourNavigation::navigationThreadFunction()
             _agents[i]->applyNewTarget();
         }
 
+        // Add the tiles built on demand since the last tick and request those around agents and anchors
+        if (_lazyBuildPool)
+        {
+            for (int i = 0; i < _navMeshes.size(); ++i)
+            {
+                _navMeshes[i]->addLazyTiles(_obstacles);
+            }
+            for (int i = 0; i < _agents.size(); ++i)
+            {
+                requestLazyTiles(_agents[i]->getPosition());
+            }
+            for (auto const& anchor : _activityAnchors)
+            {
+                requestLazyTiles(anchor.second);
+            }
+        }
+
         // Update the navmeshes
         for (int i = 0; i < _navMeshes.size(); ++i)
         {
@@ -6,12 +6,19 @@
 #include <vector>
 #include <atomic>
 #include <map>
+#include <functional>
 #include "detournavigationmesh.h"
 #include "detourcrowdagent.h"
 
 class DetourInputGeometry;
 class RecastContext;
 class GodotDetourDebugDraw;
+class HeightfieldCache;
+struct BuildProgress;
+struct TaskGroup;
+class ThreadPool;
+class MappedFile;
+class SaveBuffer;
 
 namespace std
 {
@@ -24,6 +31,7 @@ namespace godot
     class DetourObstacle;
     class MeshInstance;
     class Material;
+    class File;
 
     /**
      * @brief Parameters to initialize a DetourNavigation.
@@ -44,6 +52,31 @@ namespace godot
         int ticksPerSecond;         // How many updates per second the navigation shall do in its thread.
         int maxObstacles;           // The maximum amount of obstacles allowed at the same time. Obstacles beyond this amount will be rejected.
         int defaultAreaType;        // The default area type to mark geometry as
+        int buildThreads;           // How many threads to use for building the navigation meshes. 0 means one per CPU core, 1 builds everything on the calling thread.
+        int buildQueueDepth;        // How many tiles of a navigation mesh may be in the build pipeline at once. Limits the memory used while building. 0 means four per build thread.
+        float lazyBuildRadius;      // If > 0, only tiles within this radius of agents and activity anchors are built, the others once something comes close. 0 builds everything upfront.
+        int parsedGeometryType;     // If initialized from a scene tree instead of a MeshInstance: 0 = MeshInstances, CSG shapes and GridMaps, 1 = collision shapes of StaticBodies, 2 = both.
+        bool areaVolumes;           // If true, marked convex areas are applied to the tile cache layers like obstacles, so marking and removing them does not rasterize any tiles again.
+    };
+
+    // Helper struct describing how a navigation mesh voxelizes the input geometry
+    struct VoxelSettings
+    {
+        float   cellSize;
+        float   cellHeight;
+        float   walkableSlopeAngle;
+        int     tileSize;
+        int     fixedBorderSize;    // Only navmeshes with the same fixed border size can share heightfields. 0 if the border can still be chosen.
+        int     borderSize;         // The border size this navmesh needs at least. [vx]
+        int     walkableClimb;      // [vx]
+    };
+
+    // Helper struct remembering a query filter set while building asynchronously
+    struct QueuedQueryFilter
+    {
+        int         index;
+        String      name;
+        Dictionary  weights;
     };
 
     /**
@@ -79,16 +112,57 @@ namespace godot
         /**
          * @brief initalize     Initialize the navigation. If called on an already initialized instance, will return false.
          * @param inputMesh     The input MeshInstance to build the navigation mesh(es) from.
+         *                      Can also be any other Node, then the geometry of all its children is parsed (see DetourNavigationParameters::parsedGeometryType).
          * @param parameters    The parameters for setting up the navigation.
          * @return True if everything worked fine. False otherwise.
          */
         bool initialize(Variant inputMeshInstance, Ref<DetourNavigationParameters> parameters);
 
         /**
-         * @brief Rebuilds all tiles that have changed (by marking areas).
+         * @brief Same as initialize(), but parses the geometry and builds the navigation mesh(es) in a background thread.
+         *          Emits build_progress while building and build_finished once done. The navigation thread is only started after that.
+         *          Agents, obstacles and query filters added in the meantime are applied once the build is done.
+         * @return True if the build was started. False otherwise.
+         */
+        bool initializeAsync(Variant inputMeshInstance, Ref<DetourNavigationParameters> parameters);
+
+        /**
+         * @return True while initializeAsync() or loadAsync() are still building.
+         */
+        bool isBuilding();
+
+        /**
+         * @brief Rebuilds all tiles that have changed (by marking areas or adding/removing geometry).
          */
         void rebuildChangedTiles();
 
+        /**
+         * @brief Adds the geometry of the mesh instance to the input geometry. The affected tiles are rebuilt with the next rebuildChangedTiles().
+         *          Geometry outside of the bounds of the initial mesh is ignored, as those bounds define the tiles of the navmeshes.
+         * @return The ID of the geometry, -1 on error.
+         */
+        int addGeometry(Variant inputMeshInstance);
+
+        /**
+         * @brief Removes the geometry with the passed ID. The affected tiles are rebuilt with the next rebuildChangedTiles().
+         */
+        void removeGeometry(int id);
+
+        /**
+         * @brief Releases the input geometry (meshes, chunky meshes, shared heightfields) for navigations that never rasterize tiles again.
+         *          Saves only contain the tiles, areas and off-mesh connections from then on, and loading them keeps the geometry frozen.
+         *          Adding or removing geometry is refused afterwards, as is changing areas or off-mesh connections unless all
+         *          navmeshes use area volumes. Not possible with lazy building or changes not applied via rebuildChangedTiles() yet.
+         *          Undone by clear().
+         * @return True if the geometry was frozen.
+         */
+        bool freezeGeometry();
+
+        /**
+         * @return True if the input geometry was released via freezeGeometry().
+         */
+        bool isGeometryFrozen();
+
         /**
          * @brief Marks the area as the passed type (influencing crowds based on their area filters).
          * @param vertices  The vertices forming the bottom of the polygon.
@@ -157,6 +231,23 @@ namespace godot
          */
         Ref<DetourObstacle> addBoxObstacle(Vector3 position, Vector3 dimensions, float rotationRad);
 
+        /**
+         * @brief Adds an activity anchor. When building lazily, the tiles around anchors are built just like those around agents.
+         *          Anchors added before initialization determine which tiles are built upfront.
+         * @return The ID of the anchor.
+         */
+        int addActivityAnchor(Vector3 position);
+
+        /**
+         * @brief Moves the activity anchor with the passed ID.
+         */
+        void moveActivityAnchor(int id, Vector3 position);
+
+        /**
+         * @brief Removes the activity anchor with the passed ID. Tiles already built around it are kept.
+         */
+        void removeActivityAnchor(int id);
+
         /**
          * @brief Creates a debug mesh for the navmesh at the passed index.
          * @param index     The index of the navmesh to enable/disable debug drawing for.
@@ -168,9 +259,30 @@ namespace godot
          * @brief Saves the current state of the navigation, including all marked areas, temp obstacles and agents.
          * @param path          The path to the file to save to.
          * @param compressed    If the data should be compressed.
+         *          The navigation is only locked while its data is copied into memory, not while the file is written.
+         *          The data is written next to the target (path + ".tmp") first and replaces it once complete.
          */
         bool save(String path, bool compressed);
 
+        /**
+         * @brief Appends what changed since the last save to the journal next to the save file (path + ".journal"): the tiles rebuilt
+         *          since then, marked areas, off-mesh connections, agents and obstacles. load() replays the journal on top of the save file.
+         *          Falls back to a full save() if there is no save file at that path to append to yet, or if geometry was added or removed.
+         *          Call save() to compact the journal into a new save file.
+         * @param path  The path of the save file the journal belongs to.
+         * @return True if everything worked out, false otherwise.
+         */
+        bool saveIncremental(String path);
+
+        /**
+         * @brief Same as save(), but writing (and compressing) the file happens in a background thread,
+         *          which emits save_finished(path, success) once done.
+         *          The data is written next to the target (path + ".tmp") first and replaces it once complete.
+         *          Any other save waits for this one to finish.
+         * @return True if saving was started. False otherwise.
+         */
+        bool saveAsync(String path, bool compressed);
+
         /**
          * @brief Loads an entire navigation state, including marked areas, temp obstacles and agents.
          * @param path          The path to the file to load from.
@@ -178,12 +290,72 @@ namespace godot
          */
         bool load(String path, bool compressed);
 
+        /**
+         * @brief Same as load(), but loads in a background thread. Emits the same signals as initializeAsync().
+         * @return True if loading was started. False otherwise.
+         */
+        bool loadAsync(String path, bool compressed);
+
+        /**
+         * @brief Same as load(), but maps the (uncompressed) file into memory and uses the tiles right from the mapping
+         *          instead of copying them. Processes loading the same file share its memory.
+         *          The file has to stay unchanged while the navigation uses it, and it must not be within a pack.
+         *          Saving to the same path replaces the file instead of changing it, so on Linux & macOS the mapping keeps the previous data.
+         *          Windows can't replace a mapped file, there saving to the same path fails until clear() was called (incremental saves still work).
+         * @return True if everything worked out, false otherwise.
+         */
+        bool loadMapped(String path);
+
+        /**
+         * @brief Same as load(), but only reads the tile columns within the radius of agents and activity anchors.
+         *          The other columns are read from the (uncompressed) file on demand, like tiles built lazily.
+         *          The file has to stay unchanged while the navigation uses it. Saving to another file copies the columns not read yet
+         *          as they are, only saving to the same file reads all remaining columns first.
+         *          Files saved before the region index existed are loaded completely.
+         * @param radius    The radius around agents and activity anchors within which tile columns are read.
+         * @return True if everything worked out, false otherwise.
+         */
+        bool loadLazy(String path, float radius);
+
         /**
          * @brief Clears the entire navigation (all the data) and stops the navigation thread.
          *          After this, a new initialize (or load) will be required.
          */
         void clear();
 
+        /**
+         * @brief Returns the timings of the tiles built since the last initialize/load or resetBuildProfile().
+         *          Contains the time spent per build stage (with a histogram of single run durations), the
+         *          slowest tiles with their stage times and recast's latest log messages.
+         */
+        Dictionary getBuildProfile();
+
+        /**
+         * @brief Clears the build profile, e.g. to only profile the next rebuildChangedTiles().
+         */
+        void resetBuildProfile();
+
+        /**
+         * @brief Returns the statistics of the allocators used for building tiles, summed up over all navmeshes
+         *          (capacity, live and peak bytes, overflows and failed allocations), plus the bytes used by the area caches
+         *          and the bytes, hits and misses of the decompressed layer caches.
+         */
+        Dictionary getAllocatorStats();
+
+        /**
+         * @brief Returns what preprocessing the input geometry saved (welded vertices, dropped degenerate and invalid triangles,
+         *          bytes before and after, ...). Each dropped triangle is one less to rasterize in every tile it touches.
+         *          Empty after load(), as saved geometry is already preprocessed.
+         */
+        Dictionary getGeometryStats();
+
+        /**
+         * @brief Compresses and decompresses the current tiles of all navmeshes with every supported tile compression.
+         *          Returns a dictionary per compression name (none, fastlz1, fastlz2, lz4) with the compression ratio,
+         *          compress and decompress throughput in MB/s and the raw and compressed bytes.
+         */
+        Dictionary benchmarkCompression();
+
         /**
          * @brief Returns all current agents.
          */
@@ -205,6 +377,200 @@ namespace godot
         void navigationThreadFunction();
 
     private:
+        /**
+         * @brief Checks if initialization is possible and returns the MeshInstance or scene root to build from. nullptr on error.
+         */
+        Node* prepareInitialize(Variant inputMeshInstance);
+
+        /**
+         * @brief Builds the input geometry and the navigation meshes. Does not start the navigation thread.
+         * @param progress  Where to report built tiles to. Can be nullptr.
+         */
+        bool buildFromMesh(Node* input, Ref<DetourNavigationParameters> parameters, BuildProgress* progress);
+
+        /**
+         * @brief Opens the save file after checking if loading is possible. nullptr on error.
+         */
+        Ref<File> openSaveFile(String path, bool compressed);
+
+        /**
+         * @brief Returns true if areas and off-mesh connections can be changed. Prints an error if the geometry needed to apply them is frozen.
+         */
+        bool canChangeAreas();
+
+        /**
+         * @brief Creates the directories of the path and opens the file for writing.
+         * @return The opened file, nullptr on error.
+         */
+        Ref<File> createSaveFile(String path, bool compressed);
+
+        /**
+         * @brief Moves the completely written temp file over the save file. Removes the temp file if that fails.
+         *          Replacing instead of rewriting the file keeps a mapping of the previous one (see loadMapped()) intact on Linux & macOS.
+         * @return True if everything worked out, false otherwise.
+         */
+        bool replaceSaveFile(String tempPath, String path);
+
+        /**
+         * @brief Writes the whole navigation to the buffer of the save file. Expects the navigation mutex to be locked.
+         * @param generation    Identifies the save file, see createSaveGeneration(). Its journal has to carry the same one.
+         */
+        bool writeSaveData(SaveBuffer* saveFile, uint64_t generation);
+
+        /**
+         * @brief Locks the navigation and writes it to the buffer, then makes it the base incremental saves append to.
+         * @return False on error.
+         */
+        bool bufferSaveData(SaveBuffer* buffer, String path, bool compressed);
+
+        /**
+         * @brief Writes the buffer to the opened temp file and replaces the save file with it, then removes the journal of the previous one.
+         *          Only locks the navigation for the journal, so it can run in the background.
+         * @return True if everything worked out, false otherwise.
+         */
+        bool writeSaveFile(const SaveBuffer* buffer, Ref<File> saveFile, String tempPath, String path);
+
+        /**
+         * @brief Reads the tile columns of a lazily loaded navigation still in its save file, as that is about to be replaced.
+         */
+        void loadRemainingRegions();
+
+        /**
+         * @brief Returns if the path is the save file loadLazy() reads the tile columns from.
+         *          Saving anywhere else copies the columns not read yet from it instead of loading them.
+         */
+        bool isRegionFile(String path) const;
+
+        /**
+         * @brief Returns if the path is the save file loadMapped() mapped the navigation from.
+         */
+        bool isMappedFile(String path) const;
+
+        /**
+         * @brief Waits for the background thread of saveAsync() to be done, if there is one.
+         */
+        void finishAsyncSave();
+
+        /**
+         * @brief Loads the navigation from the opened save file. Does not start the navigation thread.
+         * @param progress      Where to report loaded tiles to. Can be nullptr.
+         * @param mappedFile    The save file mapped into memory, to use the tiles from. Can be nullptr.
+         * @param path          The path of the save file, to find its journal.
+         * @param compressed    If the save file is compressed.
+         * @param regionRadius  If > 0, tile columns are only read from the save file within this radius, see loadLazy().
+         */
+        bool loadFromFile(Ref<File> saveFile, BuildProgress* progress, const MappedFile* mappedFile, String path, bool compressed, float regionRadius);
+
+        /**
+         * @brief Saves/loads the query filters, agents, obstacles, marked area IDs, off-mesh connections and lazy building state.
+         *          Expects the navigation mutex to be locked when saving.
+         */
+        bool saveState(SaveBuffer* saveFile);
+        bool loadState(Ref<File> saveFile, int version);
+
+        /**
+         * @brief Opens the journal of the save file and collects the positions of its complete records.
+         *          The journal stays nullptr if there is none, or if it belongs to another generation of the save file.
+         *          The position is left after the last complete record.
+         * @param generation    The generation of the save file.
+         * @return False on error.
+         */
+        bool openJournal(String path, uint64_t generation, Ref<File>& journal, std::vector<int64_t>& records);
+
+        /**
+         * @brief Applies the areas and tiles of all journal records, and the agents, obstacles etc. of the last one.
+         */
+        bool replayJournal(Ref<File> journal, const std::vector<int64_t>& records);
+
+        /**
+         * @brief Returns the path of the journal belonging to the save file.
+         */
+        String getJournalPath(String path) const;
+
+        /**
+         * @brief Starts the navigation thread and marks the navigation as initialized.
+         */
+        void startNavigationThread();
+
+        /**
+         * @brief Runs the passed build function in the build thread, calling finishBuild() with its result.
+         */
+        void startBuildThread(std::function<bool(BuildProgress*)> buildFunction);
+
+        /**
+         * @brief Called from the build thread when done. Applies everything queued during the build and emits build_finished.
+         */
+        void finishBuild(bool success);
+
+        /**
+         * @brief Waits for the previous build thread to end, unless called from it (by a build_finished handler), then detaches it instead.
+         */
+        void joinBuildThread();
+
+        /**
+         * @brief Applies the query filter to all crowds.
+         */
+        void applyQueryFilter(int index, String name, Dictionary weights);
+
+        /**
+         * @brief Adds the agent to the best fitting crowd and its shadows to all others. Expects the navigation mutex to be locked.
+         * @return False on error.
+         */
+        bool placeAgent(Ref<DetourCrowdAgent> agent, Ref<DetourCrowdAgentParameters> parameters);
+
+        /**
+         * @brief Marks all convex volumes and off-mesh connections as handled, so they are not considered new anymore.
+         */
+        void markChangesHandled();
+
+        /**
+         * @brief Lets all navmeshes with the same voxel settings share their rasterized heightfields.
+         * @param voxelSettings The settings of each navmesh, in the same order as the navmeshes.
+         */
+        void shareHeightfields(const std::vector<VoxelSettings>& voxelSettings);
+
+        /**
+         * @brief Frees all heightfields still cached. Called after each build/rebuild is done.
+         */
+        void clearHeightfieldCaches();
+
+        /**
+         * @brief Deletes the heightfield caches altogether.
+         */
+        void deleteHeightfieldCaches();
+
+        /**
+         * @brief Starts building the remaining tiles on demand, if a lazy build radius is set.
+         */
+        void startLazyBuild(int numThreads);
+
+        /**
+         * @brief Cancels all tiles still queued for building on demand and stops the build workers.
+         */
+        void stopLazyBuild();
+
+        /**
+         * @brief Queues the tiles around the position that are not built yet on the build workers. Expects the navigation mutex to be locked.
+         */
+        void requestLazyTiles(const Vector3& position);
+
+        /**
+         * @brief Waits for all queued tiles and adds them to the navmeshes. Expects the navigation mutex to be locked.
+         */
+        void finishLazyTiles();
+
+        /**
+         * @brief Waits for the queued tiles without holding the navigation mutex, then locks it and adds them.
+         */
+        void lockAndFinishLazyTiles();
+
+        /**
+         * @brief Remembers the bounds of the convex volume or off-mesh connection, so rebuildChangedTiles() can update
+         *          the tiles around it when using area volumes. Expects the navigation mutex to be locked.
+         */
+        void rememberChangedVolume(int id);
+        void rememberChangedConnection(int id);
+
         DetourInputGeometry*                _inputGeometry;
         std::vector<DetourNavigationMesh*>  _navMeshes;
         std::vector<Ref<DetourCrowdAgent> > _agents;
@@ -213,6 +579,14 @@ namespace godot
         std::vector<int>                    _removedMarkedAreaIDs;
         std::vector<int>                    _offMeshConnections;
         std::vector<int>                    _removedOffMeshConnections;
+        std::vector<float>                  _changedGeometryBounds;
+        std::vector<float>                  _changedAreaBounds;
+        std::vector<HeightfieldCache*>      _heightfieldCaches;
+
+        std::vector<QueuedQueryFilter>                  _queuedQueryFilters;
+        std::vector<Ref<DetourCrowdAgent> >             _queuedAgents;
+        std::vector<Ref<DetourCrowdAgentParameters> >   _queuedAgentParameters;
+        std::vector<Ref<DetourObstacle> >               _queuedObstacles;
 
 
         RecastContext*          _recastContext;
@@ -228,7 +602,29 @@ namespace godot
         std::atomic_bool    _stopThread;
         std::mutex*         _navigationMutex;
 
+        std::thread*        _buildThread;
+        std::atomic_bool    _building;
+        BuildProgress*      _buildProgress;
+        std::atomic_bool    _destroying;
+
+        std::thread*        _saveThread;
+
         std::map<String, int>   _queryFilterIndices;
+
+        float                   _lazyBuildRadius;
+        ThreadPool*             _lazyBuildPool;
+        TaskGroup*              _lazyBuildGroup;
+        std::map<int, Vector3>  _activityAnchors;
+        int                     _nextActivityAnchorId;
+
+        MappedFile*             _mappedFile;
+        String                  _mappedFilePath;    // The file _mappedFile maps, globalized
+        String                  _regionFilePath;    // The file loadLazy() reads tile columns from, globalized
+
+        String                  _journalBasePath;   // The save file incremental saves can be appended to
+        bool                    _journalBaseCompressed;
+        uint64_t                _journalBaseGeneration; // Stored in the save file and its journal, to tell if they belong together
+        bool                    _geometryChangedSinceSave;
     };
 
     // INLINES
@@ -238,6 +634,18 @@ namespace godot
     {
         return _initialized;
     }
+
+    inline bool
+    DetourNavigation::isBuilding()
+    {
+        return _building;
+    }
+
+    inline String
+    DetourNavigation::getJournalPath(String path) const
+    {
+        return path + ".journal";
+    }
 }
 
 #endif // DETOURNAVIGATION_H
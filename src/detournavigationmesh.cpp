@@ -9,16 +9,82 @@
 #include <DetourDebugDraw.h>
 #include <DetourCrowd.h>
 #include <climits>
+#include <mutex>
+#include <set>
+#include <chrono>
+#include <iterator>
 #include "util/detourinputgeometry.h"
 #include "util/recastcontext.h"
 #include "util/navigationmeshhelpers.h"
 #include "util/meshdataaccumulator.h"
 #include "util/godotdetourdebugdraw.h"
+#include "util/threadpool.h"
+#include "util/heightfieldcache.h"
+#include "util/compactheightfieldcache.h"
+#include "util/decompressedlayercache.h"
+#include "util/bulkfile.h"
+#include "util/mappedfile.h"
 #include "detourobstacle.h"
 
 using namespace godot;
 
-#define NAVMESH_SAVE_VERSION 1
+#define NAVMESH_SAVE_VERSION 10
+
+// Numbers per tile column in the region index: tile x, tile z, first tile, number of tiles, offset in the tile block, size, checksum
+#define REGION_INDEX_STRIDE 7
+
+// Tiles are stored aligned, so they can be used right from a file mapped into memory
+#define TILE_DATA_ALIGNMENT 16
+
+// How many loaded tile layers a single task builds into navmesh tiles
+#define LOADED_TILES_PER_TASK 8
+
+// How many bytes of tile layers are read at once when loading, the whole block can exceed a single buffer
+#define LOADED_TILE_CHUNK_SIZE (64 * 1024 * 1024)
+
+// dtTileCache::MAX_REQUESTS (which is private), the obstacle requests it takes until the next update
+#define MAX_OBSTACLE_REQUESTS 64
+
+static int64_t
+alignTileSize(int64_t size)
+{
+    return (size + TILE_DATA_ALIGNMENT - 1) / TILE_DATA_ALIGNMENT * TILE_DATA_ALIGNMENT;
+}
+
+// Build state of a tile column when building on demand
+enum LazyTileState
+{
+    TILE_NOT_BUILT = 0,
+    TILE_QUEUED,
+    TILE_BUILT
+};
+
+// A single tile column on its way through the build pipeline in DetourNavigationMesh::initialize
+struct PipelinedTile
+{
+    TaskGroup                           rasterizeTask;
+    std::vector<TileCacheData>          layers;
+    TaskGroup                           buildTask;
+    std::vector<dtCompressedTileRef>    refs;
+    std::vector<NavMeshTileData>        navMeshTiles;
+    dtStatus                            buildStatus;
+};
+
+// The layers of a tile column as saved by DetourNavigationMesh::save, each aligned
+struct SavedColumn
+{
+    std::vector<int>            layerSizes;
+    std::vector<unsigned char>  data;
+    uint32_t                    checksum;
+};
+
+// A batch of loaded tile layers built into navmesh tiles by a single task in DetourNavigationMesh::buildLoadedTiles
+struct LoadedTileBatch
+{
+    TaskGroup                       buildTask;
+    std::vector<NavMeshTileData>    navMeshTiles;
+    dtStatus                        buildStatus;
+};
 
 void
 DetourNavigationMeshParameters::_register_methods()
@@ -38,6 +104,10 @@ DetourNavigationMeshParameters::_register_methods()
     register_property<DetourNavigationMeshParameters, int>("layersPerTile", &DetourNavigationMeshParameters::layersPerTile, 0);
     register_property<DetourNavigationMeshParameters, float>("detailSampleDistance", &DetourNavigationMeshParameters::detailSampleDistance, 0.0f);
     register_property<DetourNavigationMeshParameters, float>("detailSampleMaxError", &DetourNavigationMeshParameters::detailSampleMaxError, 0.0f);
+    register_property<DetourNavigationMeshParameters, int>("areaCacheSize", &DetourNavigationMeshParameters::areaCacheSize, 0);
+    register_property<DetourNavigationMeshParameters, int>("tileCompression", &DetourNavigationMeshParameters::tileCompression, TILE_COMPRESSION_FASTLZ1);
+    register_property<DetourNavigationMeshParameters, int>("layerCacheSize", &DetourNavigationMeshParameters::layerCacheSize, 0);
+    register_property<DetourNavigationMeshParameters, bool>("saveNavMeshTiles", &DetourNavigationMeshParameters::saveNavMeshTiles, false);
 }
 
 void
@@ -68,13 +138,35 @@ DetourNavigationMesh::DetourNavigationMesh()
     , _tileSize(0)
     , _layersPerTile(4)
     , _navMeshIndex(0)
+    , _workspaceMutex(nullptr)
+    , _heightfieldCache(nullptr)
+    , _sharedBorderSize(0)
+    , _rasterizationClimb(0)
+    , _areaCacheSize(0)
+    , _areaCache(nullptr)
+    , _tileCompression(TILE_COMPRESSION_FASTLZ1)
+    , _layerCacheSize(0)
+    , _layerCache(nullptr)
+    , _saveNavMeshTiles(false)
+    , _areaVolumes(false)
+    , _unmarkedLayersMutex(nullptr)
+    , _tilesX(0)
+    , _tilesZ(0)
+    , _lazyBuildRadius(0.0f)
+    , _lazyTileMutex(nullptr)
+    , _lazyBuildCancelled(false)
+    , _regionFileMutex(nullptr)
 {
     _rcConfig = new rcConfig();
     _navQuery = dtAllocNavMeshQuery();
     _crowd = dtAllocCrowd();
     _allocator = new LinearAllocator(_maxLayers * 1000);
-    _compressor = new FastLZCompressor();
+    _compressor = createTileCompressor(_tileCompression);
     _meshProcess = new MeshProcess();
+    _workspaceMutex = new std::mutex();
+    _lazyTileMutex = new std::mutex();
+    _unmarkedLayersMutex = new std::mutex();
+    _regionFileMutex = new std::mutex();
 }
 
 DetourNavigationMesh::~DetourNavigationMesh()
@@ -83,14 +175,40 @@ DetourNavigationMesh::~DetourNavigationMesh()
     dtFreeNavMeshQuery(_navQuery);
     dtFreeNavMesh(_navMesh);
     dtFreeTileCache(_tileCache);
+    delete _areaCache;
+    delete _layerCache;
     delete _allocator;
     delete _compressor;
     delete _meshProcess;
     delete _rcConfig;
+
+    for (int i = 0; i < _workspaces.size(); ++i)
+    {
+        delete _workspaces[i];
+    }
+    delete _workspaceMutex;
+
+    // Tiles built on demand that never made it into the tile cache
+    for (int i = 0; i < _lazyTiles.size(); ++i)
+    {
+        for (int j = 0; j < _lazyTiles[i]->layers.size(); ++j)
+        {
+            dtFree(_lazyTiles[i]->layers[j].data);
+        }
+        delete _lazyTiles[i];
+    }
+    delete _lazyTileMutex;
+    delete _unmarkedLayersMutex;
+
+    for (auto const& region : _savedRegions)
+    {
+        delete region.second;
+    }
+    delete _regionFileMutex;
 }
 
 bool
-DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavigationMeshParameters> params, int maxObstacles, RecastContext* recastContext, int index)
+DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavigationMeshParameters> params, int maxObstacles, RecastContext* recastContext, int index, ThreadPool* threadPool, int queueDepth, BuildProgress* progress)
 {
     Godot::print("DTNavMeshInitialize: Initializing navigation mesh");
 
@@ -109,6 +227,26 @@ DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavig
     _cellSize = para->cellSize;
     _tileSize = para->tileSize;
     _layersPerTile = para->layersPerTile;
+    dtTileCacheCompressor* compressor = createTileCompressor(para->tileCompression);
+    if (!compressor)
+    {
+        ERR_PRINT(String("DTNavMeshInitialize: Unknown tile compression {0}.").format(Array::make(para->tileCompression)));
+        return false;
+    }
+    delete _compressor;
+    _compressor = compressor;
+    _tileCompression = para->tileCompression;
+    _layerCacheSize = para->layerCacheSize;
+    _saveNavMeshTiles = para->saveNavMeshTiles;
+    if (_layerCacheSize > 0)
+    {
+        _layerCache = new DecompressedLayerCache(_layerCacheSize, _compressor);
+    }
+    _areaCacheSize = para->areaCacheSize;
+    if (_areaCacheSize > 0)
+    {
+        _areaCache = new CompactHeightfieldCache(_areaCacheSize);
+    }
 
     // Init cache
     const float* bmin = _inputGeom->getNavMeshBoundsMin();
@@ -118,6 +256,9 @@ DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavig
     const int ts = _tileSize;
     const int tw = (gw + ts-1) / ts;
     const int th = (gh + ts-1) / ts;
+    _tilesX = tw;
+    _tilesZ = th;
+    _tileStates.assign(tw * th, TILE_NOT_BUILT);
 
     Godot::print(String("DTNavMeshInitialize: tile sizes {0} {1} {2}").format(Array::make(ts, tw, th)));
     Godot::print(String("DTNavMeshInitialize: grid sizes {0} {1}").format(Array::make(gw, gh)));
@@ -138,13 +279,17 @@ DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavig
     cfg.mergeRegionArea = para->minCellSpanCount;
     cfg.maxVertsPerPoly = para->maxVertsPerPoly;
     cfg.tileSize = _tileSize;
-    cfg.borderSize = cfg.walkableRadius + 3; // Reserve enough padding.
+    cfg.borderSize = rcMax(cfg.walkableRadius + 3, _sharedBorderSize); // Reserve enough padding (and as much as navmeshes sharing the heightfields).
     cfg.width = cfg.tileSize + cfg.borderSize * 2;
     cfg.height = cfg.tileSize + cfg.borderSize * 2;
     cfg.detailSampleDist = para->detailSampleDistance < 0.9f ? 0 : _cellSize.x * para->detailSampleDistance;
     cfg.detailSampleMaxError = _cellSize.y * para->detailSampleMaxError;
     rcVcopy(cfg.bmin, bmin);
     rcVcopy(cfg.bmax, bmax);
+    if (!_heightfieldCache)
+    {
+        _rasterizationClimb = cfg.walkableClimb;
+    }
 
     // Tile cache params.
     dtTileCacheParams tcparams;
@@ -169,7 +314,13 @@ DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavig
         ERR_PRINT("DTNavMeshInitialize: Could not allocate tile cache.");
         return false;
     }
-    dtStatus status = _tileCache->init(&tcparams, _allocator, _compressor, _meshProcess);
+    dtTileCacheCompressor* tileCacheCompressor = _compressor;
+    if (_layerCache)
+    {
+        _layerCache->setTileCache(_tileCache);
+        tileCacheCompressor = _layerCache;
+    }
+    dtStatus status = _tileCache->init(&tcparams, _allocator, tileCacheCompressor, _meshProcess);
     if (dtStatusFailed(status))
     {
         ERR_PRINT("DTNavMeshInitialize: Could not init tile cache.");
@@ -217,61 +368,172 @@ DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavig
     }
     Godot::print("DTNavMeshInitialize: Initialized Detour navmesh query...");
 
-    // Preprocess tiles
-    _recastContext->resetTimers();
+    // Preprocess tiles and build the initial meshes as a pipeline:
+    // Tiles are rasterized in parallel and added to the tile cache as soon as they are done, then built into navmesh
+    // tiles in parallel and added to the navmesh. Both additions happen in a fixed order, so the result does not depend
+    // on the number of threads. At most queueDepth tiles are in the pipeline at the same time.
+    // When building lazily, only the tiles around the initial positions are built, the rest follows on demand.
+    std::chrono::steady_clock::time_point buildStart = std::chrono::steady_clock::now();
+    std::vector<int> tileIndices;
+    if (isLazyBuild())
+    {
+        std::vector<std::pair<int, int> > initialTiles;
+        for (int i = 0; i < _lazyInitialPositions.size(); ++i)
+        {
+            requestTilesAround(_lazyInitialPositions[i], initialTiles);
+        }
+        for (int i = 0; i < initialTiles.size(); ++i)
+        {
+            tileIndices.push_back(initialTiles[i].first + initialTiles[i].second * tw);
+        }
+        Godot::print(String("DTNavMeshInitialize: building {0} of {1} tiles upfront").format(Array::make((int)tileIndices.size(), tw * th)));
+    }
+    else
+    {
+        for (int i = 0; i < tw * th; ++i)
+        {
+            tileIndices.push_back(i);
+        }
+    }
+    const int numTiles = tileIndices.size();
+    if (progress)
+    {
+        progress->addTiles(numTiles);
+    }
+    if (queueDepth <= 0)
+    {
+        queueDepth = threadPool->getThreadCount() * 4;
+    }
+    std::vector<PipelinedTile> pipeline(queueDepth);
 
     int cacheLayerCount = 0;
     int cacheCompressedSize = 0;
     int cacheRawSize = 0;
-    for (int y = 0; y < th; ++y)
+    int numSubmitted = 0;
+    int numCached = 0;
+    int numAdded = 0;
+    bool buildFailed = false;
+    while (numAdded < numTiles)
     {
-        for (int x = 0; x < tw; ++x)
+        // Keep the pipeline filled with tiles to rasterize
+        while (numSubmitted < numTiles && numSubmitted < numAdded + queueDepth)
+        {
+            const int x = tileIndices[numSubmitted] % tw;
+            const int y = tileIndices[numSubmitted] / tw;
+            PipelinedTile& tile = pipeline[numSubmitted % queueDepth];
+            threadPool->submit(tile.rasterizeTask, [this, x, y, &cfg, &tile]() {
+                TileBuildWorkspace* workspace = acquireWorkspace();
+                tile.layers.resize(_maxLayers);
+                workspace->context.beginTile(_navMeshIndex, x, y);
+                int ntiles = rasterizeTileLayers(x, y, cfg, tile.layers.data(), _maxLayers, workspace);
+                workspace->context.endTile();
+                tile.layers.resize(ntiles);
+                releaseWorkspace(workspace);
+            });
+            numSubmitted++;
+        }
+
+        // Prefer adding the oldest navmesh tiles if they are done already, otherwise add the next rasterized tile to the cache
+        bool canCache = numCached < numSubmitted;
+        bool canAdd = numAdded < numCached;
+        if (canCache && (!canAdd || !threadPool->isDone(pipeline[numAdded % queueDepth].buildTask)))
         {
-            TileCacheData* tiles = new TileCacheData[_maxLayers];
-            memset(tiles, 0, sizeof(tiles));
-            int ntiles = rasterizeTileLayers(x, y, cfg, tiles, _maxLayers);
+            PipelinedTile& tile = pipeline[numCached % queueDepth];
+            threadPool->wait(tile.rasterizeTask);
 
-            for (int i = 0; i < ntiles; ++i)
+            tile.refs.clear();
+            for (int i = 0; i < tile.layers.size(); ++i)
             {
-                TileCacheData* tile = &tiles[i];
-                status = _tileCache->addTile(tile->data, tile->dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
+                TileCacheData* layer = &tile.layers[i];
+                dtCompressedTileRef ref = 0;
+                status = _tileCache->addTile(layer->data, layer->dataSize, DT_COMPRESSEDTILE_FREE_DATA, &ref);
                 if (dtStatusFailed(status))
                 {
                     ERR_PRINT(String("DTNavMeshInitialize: Unable to add tile: {0}").format(Array::make(status)));
-                    dtFree(tile->data);
-                    tile->data = 0;
+                    dtFree(layer->data);
+                    layer->data = 0;
                     continue;
                 }
+                tile.refs.push_back(ref);
 
                 cacheLayerCount++;
-                cacheCompressedSize += tile->dataSize;
+                cacheCompressedSize += layer->dataSize;
                 cacheRawSize += calcLayerBufferSize(tcparams.width, tcparams.height);
             }
+            tile.layers.clear();
 
-            delete [] tiles;
+            // Only the refs are used to access the tile cache, so this is safe while more tiles are being added
+            threadPool->submit(tile.buildTask, [this, &tile]() {
+                TileBuildWorkspace* workspace = acquireWorkspace();
+                tile.buildStatus = DT_SUCCESS;
+                for (int i = 0; i < tile.refs.size(); ++i)
+                {
+                    NavMeshTileData tileData;
+                    tile.buildStatus = buildNavMeshTileData(_tileCache, tile.refs[i], &workspace->allocator, workspace->compressor, _meshProcess, &tileData);
+                    if (dtStatusFailed(tile.buildStatus))
+                    {
+                        break;
+                    }
+                    if (tileData.data)
+                    {
+                        tile.navMeshTiles.push_back(tileData);
+                    }
+                }
+                releaseWorkspace(workspace);
+            });
+            numCached++;
         }
-    }
-    Godot::print("DTNavMeshInitialize: Processed input mesh..");
-
-    // Build initial meshes
-    _recastContext->startTimer(RC_TIMER_TOTAL);
-    for (int y = 0; y < th; ++y)
-    {
-        for (int x = 0; x < tw; ++x)
+        else
         {
-            status = _tileCache->buildNavMeshTilesAt(x, y, _navMesh);
-            if (dtStatusFailed(status))
+            const int x = tileIndices[numAdded] % tw;
+            const int y = tileIndices[numAdded] / tw;
+            PipelinedTile& tile = pipeline[numAdded % queueDepth];
+            threadPool->wait(tile.buildTask);
+
+            if (!buildFailed && dtStatusFailed(tile.buildStatus))
             {
                 ERR_PRINT(String("DTNavMeshInitialize: Could not build nav mesh tiles at {0} {1}").format(Array::make(x, y)));
-                return false;
+                buildFailed = true;
+            }
+
+            // After a failure, keep going until all tasks are done, but only to clean up
+            for (int i = 0; i < tile.navMeshTiles.size(); ++i)
+            {
+                NavMeshTileData& navMeshTile = tile.navMeshTiles[i];
+                if (buildFailed)
+                {
+                    dtFree(navMeshTile.data);
+                    continue;
+                }
+
+                status = _navMesh->addTile(navMeshTile.data, navMeshTile.dataSize, DT_TILE_FREE_DATA, 0, 0);
+                if (dtStatusFailed(status))
+                {
+                    ERR_PRINT(String("DTNavMeshInitialize: Could not add nav mesh tile at {0} {1}: {2}").format(Array::make(x, y, status)));
+                    dtFree(navMeshTile.data);
+                    buildFailed = true;
+                }
+            }
+            tile.navMeshTiles.clear();
+            numAdded++;
+            if (progress)
+            {
+                progress->tileDone();
             }
         }
     }
-    _recastContext->stopTimer(RC_TIMER_TOTAL);
+    if (buildFailed)
+    {
+        return false;
+    }
+    for (int i = 0; i < numTiles; ++i)
+    {
+        _tileStates[tileIndices[i]] = TILE_BUILT;
+    }
+    Godot::print("DTNavMeshInitialize: Processed input mesh..");
 
     // Statistics
-    int cacheBuildTimeMs = _recastContext->getAccumulatedTime(RC_TIMER_TOTAL)/1000.0f;
-    size_t cacheBuildMemUsage = static_cast<unsigned int>(_allocator->high);
+    int cacheBuildTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - buildStart).count();
     const dtNavMesh* nav = _navMesh;
     int navmeshMemUsage = 0;
     for (int i = 0; i < nav->getMaxTiles(); ++i)
@@ -281,6 +543,7 @@ DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavig
             navmeshMemUsage += tile->dataSize;
     }
     Godot::print(String("DTNavMeshInitialize: navmesh memory usage: {0} bytes").format(Array::make(navmeshMemUsage)));
+    Godot::print(String("DTNavMeshInitialize: built {0} tile layers in {1} ms using {2} threads").format(Array::make(cacheLayerCount, cacheBuildTimeMs, threadPool->getThreadCount())));
 
     // Initialize the crowd
     if (!initializeCrowd())
@@ -293,7 +556,7 @@ DetourNavigationMesh::initialize(DetourInputGeometry* inputGeom, Ref<DetourNavig
 }
 
 bool
-DetourNavigationMesh::save(Ref<File> targetFile)
+DetourNavigationMesh::save(SaveBuffer* targetFile)
 {
     // Sanity check
     if (_tileCache == nullptr)
@@ -318,6 +581,11 @@ DetourNavigationMesh::save(Ref<File> targetFile)
     targetFile->store_float(_maxAgentHeight);
     targetFile->store_float(_maxAgentClimb);
     targetFile->store_float(_maxAgentRadius);
+    targetFile->store_32(_areaCacheSize);
+    targetFile->store_8(_areaVolumes);
+    targetFile->store_8(_tileCompression);
+    targetFile->store_32(_layerCacheSize);
+    targetFile->store_8(_saveNavMeshTiles);
 
     // rcConfig
     {
@@ -346,30 +614,153 @@ DetourNavigationMesh::save(Ref<File> targetFile)
         targetFile->store_32(_rcConfig->width);
     }
 
-    // Tiles
-    targetFile->store_32(_tileCache->getTileCount());
+    // Tiles grouped by column, so each column can be read on its own via the region index
+    std::map<std::pair<int, int>, std::vector<const dtCompressedTile*> > tilesByColumn;
     for (int i = 0; i < _tileCache->getTileCount(); ++i)
     {
         const dtCompressedTile* tile = _tileCache->getTile(i);
-        if (!tile || !tile->header || !tile->dataSize)
+        if (tile && tile->header && tile->dataSize)
         {
-            targetFile->store_32(0);
-            continue;
+            tilesByColumn[std::make_pair(tile->header->tx, tile->header->ty)].push_back(tile);
+        }
+    }
+
+    // All of their data (each aligned) per column, the checksums are taken from it
+    std::map<std::pair<int, int>, SavedColumn> columns;
+    for (auto const& column : tilesByColumn)
+    {
+        SavedColumn& saved = columns[column.first];
+        int64_t columnSize = 0;
+        for (int i = 0; i < column.second.size(); ++i)
+        {
+            saved.layerSizes.push_back(column.second[i]->dataSize);
+            columnSize += alignTileSize(column.second[i]->dataSize);
+        }
+        saved.data.assign(columnSize, 0);
+        unsigned char* pos = saved.data.data();
+        for (int i = 0; i < column.second.size(); ++i)
+        {
+            memcpy(pos, column.second[i]->data, column.second[i]->dataSize);
+            pos += alignTileSize(column.second[i]->dataSize);
+        }
+        saved.checksum = computeChecksum(saved.data.data(), columnSize);
+    }
+
+    // Columns not read yet from the file they were loaded from are copied from it as they are, instead of loading them all
+    {
+        std::lock_guard<std::mutex> lock(*_regionFileMutex);
+        for (auto const& region : _savedRegions)
+        {
+            // Usually read ahead by readSavedRegions() before the navigation was locked, the copy is not needed anymore afterwards
+            std::vector<unsigned char> data;
+            data.swap(region.second->data);
+            if (_tileStates[region.first.first + region.first.second * _tilesX] != TILE_NOT_BUILT || columns.count(region.first))
+            {
+                continue;
+            }
+            if (data.size() != region.second->size)
+            {
+                _regionFile->seek(region.second->offset);
+                PoolByteArray array = _regionFile->get_buffer(region.second->size);
+                if (array.size() != region.second->size)
+                {
+                    ERR_PRINT(String("DTNavMeshSave: Unable to copy saved tiles at {0} {1}.").format(Array::make(region.first.first, region.first.second)));
+                    return false;
+                }
+                PoolByteArray::Read reader = array.read();
+                data.assign(reader.ptr(), reader.ptr() + array.size());
+            }
+            SavedColumn& saved = columns[region.first];
+            saved.layerSizes = region.second->layerSizes;
+            saved.data.swap(data);
+            saved.checksum = region.second->checksum;
+        }
+    }
+
+    // The index, the tile sizes and the aligned block
+    std::vector<int64_t> regionIndex;
+    std::vector<int> tileSizes;
+    int64_t totalTileSize = 0;
+    for (auto const& column : columns)
+    {
+        regionIndex.push_back(column.first.first);
+        regionIndex.push_back(column.first.second);
+        regionIndex.push_back(tileSizes.size());
+        regionIndex.push_back(column.second.layerSizes.size());
+        regionIndex.push_back(totalTileSize);
+        regionIndex.push_back(column.second.data.size());
+        regionIndex.push_back(column.second.checksum);
+        tileSizes.insert(tileSizes.end(), column.second.layerSizes.begin(), column.second.layerSizes.end());
+        totalTileSize += column.second.data.size();
+    }
+    storeArray(targetFile, regionIndex);
+    storeArray(targetFile, tileSizes);
+    while (targetFile->get_position() % TILE_DATA_ALIGNMENT != 0)
+    {
+        targetFile->store_8(0);
+    }
+    for (auto const& column : columns)
+    {
+        memcpy(targetFile->append(column.second.data.size()), column.second.data.data(), column.second.data.size());
+    }
+
+    // Built navmesh tiles, the same way. Obstacles added or removed since the last update have not been applied
+    // to them yet, which would leave stale cuts in the saved tiles, so process those first.
+    if (_saveNavMeshTiles)
+    {
+        updateTileCache();
+        const dtNavMesh* navMesh = _navMesh;
+        std::vector<int> navMeshTileSizes;
+        std::vector<const dtMeshTile*> navMeshTiles;
+        int64_t totalNavMeshTileSize = 0;
+        for (int i = 0; i < navMesh->getMaxTiles(); ++i)
+        {
+            const dtMeshTile* tile = navMesh->getTile(i);
+            if (tile && tile->header && tile->dataSize)
+            {
+                navMeshTileSizes.push_back(tile->dataSize);
+                navMeshTiles.push_back(tile);
+                totalNavMeshTileSize += alignTileSize(tile->dataSize);
+            }
         }
+        storeArray(targetFile, navMeshTileSizes);
+        while (targetFile->get_position() % TILE_DATA_ALIGNMENT != 0)
+        {
+            targetFile->store_8(0);
+        }
+        if (totalNavMeshTileSize > 0)
+        {
+            unsigned char* pos = targetFile->append(totalNavMeshTileSize);
+            memset(pos, 0, totalNavMeshTileSize);
+            for (int i = 0; i < navMeshTiles.size(); ++i)
+            {
+                memcpy(pos, navMeshTiles[i]->data, navMeshTileSizes[i]);
+                pos += alignTileSize(navMeshTileSizes[i]);
+            }
+        }
+    }
 
-        targetFile->store_32(tile->dataSize);
-        PoolByteArray array;
-        array.resize(tile->dataSize);
-        PoolByteArray::Write writer = array.write();
-        memcpy(writer.ptr(), tile->data, tile->dataSize);
-        targetFile->store_buffer(array);
+    // Layers before marking the area volumes
+    _unmarkedLayersMutex->lock();
+    targetFile->store_32(_unmarkedLayers.size());
+    for (auto const& layer : _unmarkedLayers)
+    {
+        targetFile->store_32(std::get<0>(layer.first));
+        targetFile->store_32(std::get<1>(layer.first));
+        targetFile->store_32(std::get<2>(layer.first));
+        storeArray(targetFile, layer.second);
     }
+    _unmarkedLayersMutex->unlock();
+
+    // Incremental saves start over from here
+    _unsavedTiles.clear();
 
     return true;
 }
 
 bool
-DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recastContext, Ref<File> sourceFile)
+DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recastContext, Ref<File> sourceFile, BuildProgress* progress,
+                           const MappedFile* mappedFile, bool useSavedNavMeshTiles, ThreadPool* threadPool, bool loadRegionsLazily)
 {
     _inputGeom = inputGeom;
     _recastContext = recastContext;
@@ -377,7 +768,10 @@ DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recast
 
     int version = sourceFile->get_16();
 
-    if (version == NAVMESH_SAVE_VERSION)
+    // Version 1 did not have the area cache yet, version 2 no area volumes, version 3 no tile compression, version 4 no layer cache,
+    // version 5 stored the tiles one by one, version 6 did not align them, version 7 never stored the navmesh tiles, version 8 had no region index,
+    // version 9 stored the region index as 32 bit ints
+    if (version >= 1 && version <= NAVMESH_SAVE_VERSION)
     {
         // Properties
         _navMeshIndex = sourceFile->get_32();
@@ -392,6 +786,31 @@ DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recast
         _maxAgentHeight = sourceFile->get_float();
         _maxAgentClimb = sourceFile->get_float();
         _maxAgentRadius = sourceFile->get_float();
+        _areaCacheSize = version >= 2 ? sourceFile->get_32() : 0;
+        _areaVolumes = version >= 3 ? sourceFile->get_8() : false;
+
+        // Older versions always used FastLZ, which detects the level when decompressing
+        _tileCompression = version >= 4 ? sourceFile->get_8() : TILE_COMPRESSION_FASTLZ1;
+        dtTileCacheCompressor* compressor = createTileCompressor(_tileCompression);
+        if (!compressor)
+        {
+            ERR_PRINT(String("DTNavMeshLoad: Unknown tile compression {0}.").format(Array::make(_tileCompression)));
+            return false;
+        }
+        delete _compressor;
+        _compressor = compressor;
+        _layerCacheSize = version >= 5 ? sourceFile->get_32() : 0;
+        _saveNavMeshTiles = version >= 8 ? sourceFile->get_8() : false;
+        if (_layerCacheSize > 0)
+        {
+            delete _layerCache;
+            _layerCache = new DecompressedLayerCache(_layerCacheSize, _compressor);
+        }
+        if (_areaCacheSize > 0)
+        {
+            delete _areaCache;
+            _areaCache = new CompactHeightfieldCache(_areaCacheSize);
+        }
 
         // rcConfig
         {
@@ -419,6 +838,7 @@ DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recast
             _rcConfig->walkableSlopeAngle = sourceFile->get_float();
             _rcConfig->width = sourceFile->get_32();
         }
+        _rasterizationClimb = _rcConfig->walkableClimb;
 
         // NavMesh
         dtFreeNavMesh(_navMesh);
@@ -460,7 +880,13 @@ DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recast
             ERR_PRINT("DTNavMeshLoad: Could not allocate tile cache.");
             return false;
         }
-        dtStatus status = _tileCache->init(&tcparams, _allocator, _compressor, _meshProcess);
+        dtTileCacheCompressor* tileCacheCompressor = _compressor;
+        if (_layerCache)
+        {
+            _layerCache->setTileCache(_tileCache);
+            tileCacheCompressor = _layerCache;
+        }
+        dtStatus status = _tileCache->init(&tcparams, _allocator, tileCacheCompressor, _meshProcess);
         if (dtStatusFailed(status))
         {
             ERR_PRINT("DTNavMeshLoad: Could not init tile cache.");
@@ -500,35 +926,210 @@ DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recast
         }
 
         // Tiles
-        int tileCount = sourceFile->get_32();
+        _tilesX = tw;
+        _tilesZ = th;
+        _tileStates.assign(tw * th, TILE_NOT_BUILT);
+        std::vector<int> tileSizes;
+        const unsigned char* mappedTilePos = nullptr;
+        int tileCount = 0;
+        if (version >= 6)
+        {
+            std::vector<int64_t> regionIndex;
+            if (version >= 10)
+            {
+                if (!loadArray(sourceFile, regionIndex))
+                {
+                    ERR_PRINT("DTNavMeshLoad: Unable to load region index.");
+                    return false;
+                }
+            }
+            else if (version == 9)
+            {
+                std::vector<int> shortRegionIndex;
+                if (!loadArray(sourceFile, shortRegionIndex))
+                {
+                    ERR_PRINT("DTNavMeshLoad: Unable to load region index.");
+                    return false;
+                }
+                regionIndex.assign(shortRegionIndex.begin(), shortRegionIndex.end());
+            }
+            if (!loadArray(sourceFile, tileSizes))
+            {
+                ERR_PRINT("DTNavMeshLoad: Unable to load tile sizes.");
+                return false;
+            }
+            tileCount = tileSizes.size();
+            int64_t totalTileSize = 0;
+            for (int i = 0; i < tileCount; ++i)
+            {
+                if (tileSizes[i] < 0)
+                {
+                    ERR_PRINT(String("DTNavMeshLoad: Invalid size of tile {0}.").format(Array::make(i)));
+                    return false;
+                }
+                totalTileSize += version >= 7 ? alignTileSize(tileSizes[i]) : tileSizes[i];
+            }
+            if (version >= 7)
+            {
+                sourceFile->seek(alignTileSize(sourceFile->get_position()));
+            }
+
+            // Aligned tiles can be used right from the mapped file, everything else is copied
+            int64_t dataStart = sourceFile->get_position();
+            if (loadRegionsLazily && version >= 9)
+            {
+                // Only remember where each column is, it is read once requested
+                _regionFile = File::_new();
+                Error result = _regionFile->open(sourceFile->get_path_absolute(), File::READ);
+                if (result != Error::OK)
+                {
+                    ERR_PRINT(String("DTNavMeshLoad: Unable to open file to load regions from: {0}").format(Array::make((int)result)));
+                    return false;
+                }
+                for (int i = 0; i + REGION_INDEX_STRIDE <= regionIndex.size(); i += REGION_INDEX_STRIDE)
+                {
+                    // Reading a column must stay within the tile block and its tiles, and each column can only be read once
+                    const int64_t* entry = &regionIndex[i];
+                    bool valid = entry[0] >= 0 && entry[0] < tw && entry[1] >= 0 && entry[1] < th
+                            && entry[2] >= 0 && entry[3] >= 0 && entry[2] + entry[3] <= tileCount
+                            && entry[4] >= 0 && entry[5] >= 0 && entry[4] + entry[5] <= totalTileSize
+                            && !_savedRegions.count(std::make_pair((int)entry[0], (int)entry[1]));
+                    int64_t layersSize = 0;
+                    for (int64_t j = entry[2]; valid && j < entry[2] + entry[3]; ++j)
+                    {
+                        layersSize += alignTileSize(tileSizes[j]);
+                    }
+                    if (!valid || layersSize != entry[5])
+                    {
+                        ERR_PRINT(String("DTNavMeshLoad: Invalid region index entry for tile {0} {1}.").format(Array::make(entry[0], entry[1])));
+                        return false;
+                    }
+                    SavedRegion* region = new SavedRegion();
+                    region->offset = dataStart + entry[4];
+                    region->size = entry[5];
+                    region->checksum = (uint32_t)entry[6];
+                    region->layerSizes.assign(tileSizes.begin() + entry[2], tileSizes.begin() + entry[2] + entry[3]);
+                    _savedRegions[std::make_pair((int)entry[0], (int)entry[1])] = region;
+                }
+                sourceFile->seek(dataStart + totalTileSize);
+                tileCount = 0;
+
+                // Navmesh tiles are built once their columns are read
+                useSavedNavMeshTiles = false;
+            }
+            else if (mappedFile && version >= 7)
+            {
+                if (dataStart + totalTileSize > (int64_t)mappedFile->getSize())
+                {
+                    ERR_PRINT("DTNavMeshLoad: Unable to load tiles, mapped file is too small.");
+                    return false;
+                }
+                mappedTilePos = mappedFile->getData() + dataStart;
+                sourceFile->seek(dataStart + totalTileSize);
+            }
+        }
+        else
+        {
+            tileCount = sourceFile->get_32();
+        }
+        if (progress)
+        {
+            progress->addTiles(tileCount);
+        }
+        PoolByteArray tileData;
+        int tileDataPos = 0;
+        std::vector<dtCompressedTileRef> tilesToBuild;
         for (int i = 0; i < tileCount; ++i)
         {
-            int dataSize = sourceFile->get_32();
+            int dataSize = version >= 6 ? tileSizes[i] : sourceFile->get_32();
 
             // Skip empty tiles
             if (dataSize == 0)
             {
+                if (progress)
+                {
+                    progress->tileDone();
+                }
                 continue;
             }
-            unsigned char* data = (unsigned char*)dtAlloc(dataSize, DT_ALLOC_PERM);
-            memset(data, 0, dataSize);
-            PoolByteArray array = sourceFile->get_buffer(dataSize);
-            memcpy(data, array.read().ptr(), dataSize);
+            int64_t storedSize = version >= 7 ? alignTileSize(dataSize) : dataSize;
+            unsigned char* data = nullptr;
+            int flags = DT_COMPRESSEDTILE_FREE_DATA;
+            if (mappedTilePos)
+            {
+                // The tile cache never writes to the tile data, so it can point into the read-only mapping
+                data = (unsigned char*)mappedTilePos;
+                mappedTilePos += storedSize;
+                flags = 0;
+            }
+            else if (version >= 6)
+            {
+                // The next chunk of whole tiles
+                if (tileDataPos == tileData.size())
+                {
+                    int64_t chunkSize = storedSize;
+                    for (int j = i + 1; j < tileCount; ++j)
+                    {
+                        int64_t nextSize = version >= 7 ? alignTileSize(tileSizes[j]) : tileSizes[j];
+                        if (chunkSize + nextSize > LOADED_TILE_CHUNK_SIZE)
+                        {
+                            break;
+                        }
+                        chunkSize += nextSize;
+                    }
+                    tileData = sourceFile->get_buffer(chunkSize);
+                    tileDataPos = 0;
+                    if (tileData.size() != chunkSize)
+                    {
+                        ERR_PRINT("DTNavMeshLoad: Unable to load tiles.");
+                        return false;
+                    }
+                }
+                data = (unsigned char*)dtAlloc(dataSize, DT_ALLOC_PERM);
+                if (!data)
+                {
+                    ERR_PRINT(String("DTNavMeshLoad: Out of memory loading tile {0}.").format(Array::make(i)));
+                    return false;
+                }
+                memcpy(data, tileData.read().ptr() + tileDataPos, dataSize);
+                tileDataPos += storedSize;
+            }
+            else
+            {
+                data = (unsigned char*)dtAlloc(dataSize, DT_ALLOC_PERM);
+                PoolByteArray array = sourceFile->get_buffer(dataSize);
+                memcpy(data, array.read().ptr(), dataSize);
+            }
+
+            // Remember the column as built, in case the rest is built on demand
+            const dtTileCacheLayerHeader* header = (const dtTileCacheLayerHeader*)data;
+            if (header->tx >= 0 && header->tx < tw && header->ty >= 0 && header->ty < th)
+            {
+                _tileStates[header->tx + header->ty * tw] = TILE_BUILT;
+            }
 
             // Add tile
             dtCompressedTileRef tile = 0;
-            dtStatus addTileStatus = _tileCache->addTile(data, dataSize, DT_COMPRESSEDTILE_FREE_DATA, &tile);
+            dtStatus addTileStatus = _tileCache->addTile(data, dataSize, flags, &tile);
             if (dtStatusFailed(addTileStatus))
             {
                 ERR_PRINT(String("DTNavMeshLoad: Unable to add tile: {0}").format(Array::make(addTileStatus)));
-                dtFree(data);
+                if (flags & DT_COMPRESSEDTILE_FREE_DATA)
+                {
+                    dtFree(data);
+                }
                 data = 0;
                 return false;
             }
 
-            // Build navmesh tile
-            if (tile)
+            // Build navmesh tile, unless it was saved as well. With threads, all of them are built once the tiles are read
+            if (tile && !(_saveNavMeshTiles && useSavedNavMeshTiles))
             {
+                if (threadPool)
+                {
+                    tilesToBuild.push_back(tile);
+                    continue;
+                }
                 status = _tileCache->buildNavMeshTile(tile, _navMesh);
                 if (dtStatusFailed(status))
                 {
@@ -536,40 +1137,384 @@ DetourNavigationMesh::load(DetourInputGeometry* inputGeom, RecastContext* recast
                     return false;
                 }
             }
+            if (progress)
+            {
+                progress->tileDone();
+            }
         }
-
-        // Initialize crowd
-        if (!initializeCrowd())
+        if (!tilesToBuild.empty() && !buildLoadedTiles(tilesToBuild, threadPool, progress))
         {
-            ERR_PRINT("DTNavMeshLoad: Unable to initialize crowd.");
             return false;
         }
-    }
-    else {
-        ERR_PRINT(String("DTNavMeshLoad: Unknown version: {0}").format(Array::make(version)));
-        return false;
-    }
 
-    return true;
-}
-
-static int
-pointInPoly(int nvert, const float* verts, const float* p)
-{
-    int i, j, c = 0;
-    for (i = 0, j = nvert-1; i < nvert; j = i++)
-    {
-        const float* vi = &verts[i*3];
-        const float* vj = &verts[j*3];
-        if (((vi[2] > p[2]) != (vj[2] > p[2])) &&
-            (p[0] < (vj[0]-vi[0]) * (p[2]-vi[2]) / (vj[2]-vi[2]) + vi[0]) )
-            c = !c;
-    }
-    return c;
-}
+        // Saved navmesh tiles, copied even from a mapped file as the navmesh links them in place
+        if (_saveNavMeshTiles)
+        {
+            std::vector<int> navMeshTileSizes;
+            if (!loadArray(sourceFile, navMeshTileSizes))
+            {
+                ERR_PRINT("DTNavMeshLoad: Unable to load navmesh tile sizes.");
+                return false;
+            }
+            int64_t totalNavMeshTileSize = 0;
+            for (int i = 0; i < navMeshTileSizes.size(); ++i)
+            {
+                if (navMeshTileSizes[i] < 0)
+                {
+                    ERR_PRINT(String("DTNavMeshLoad: Invalid size of navmesh tile {0}.").format(Array::make(i)));
+                    return false;
+                }
+                totalNavMeshTileSize += alignTileSize(navMeshTileSizes[i]);
+            }
+            sourceFile->seek(alignTileSize(sourceFile->get_position()));
 
-struct ChangedPosData
-{
+            PoolByteArray navMeshTileData;
+            const unsigned char* navMeshTilePos = nullptr;
+            int64_t dataStart = sourceFile->get_position();
+            if (!useSavedNavMeshTiles)
+            {
+                // Already built from the layers
+                sourceFile->seek(dataStart + totalNavMeshTileSize);
+                navMeshTileSizes.clear();
+            }
+            else if (mappedFile)
+            {
+                if (dataStart + totalNavMeshTileSize > (int64_t)mappedFile->getSize())
+                {
+                    ERR_PRINT("DTNavMeshLoad: Unable to load navmesh tiles, mapped file is too small.");
+                    return false;
+                }
+                navMeshTilePos = mappedFile->getData() + dataStart;
+                sourceFile->seek(dataStart + totalNavMeshTileSize);
+            }
+            else
+            {
+                navMeshTileData = sourceFile->get_buffer(totalNavMeshTileSize);
+                if (navMeshTileData.size() != totalNavMeshTileSize)
+                {
+                    ERR_PRINT("DTNavMeshLoad: Unable to load navmesh tiles.");
+                    return false;
+                }
+            }
+            PoolByteArray::Read navMeshTileReader = navMeshTileData.read();
+            if (!navMeshTilePos)
+            {
+                navMeshTilePos = navMeshTileReader.ptr();
+            }
+
+            for (int i = 0; i < navMeshTileSizes.size(); ++i)
+            {
+                int dataSize = navMeshTileSizes[i];
+                unsigned char* data = (unsigned char*)dtAlloc(dataSize, DT_ALLOC_PERM);
+                if (!data)
+                {
+                    ERR_PRINT(String("DTNavMeshLoad: Out of memory loading navmesh tile {0}.").format(Array::make(i)));
+                    return false;
+                }
+                memcpy(data, navMeshTilePos, dataSize);
+                navMeshTilePos += alignTileSize(dataSize);
+
+                status = _navMesh->addTile(data, dataSize, DT_TILE_FREE_DATA, 0, 0);
+                if (dtStatusFailed(status))
+                {
+                    ERR_PRINT(String("DTNavMeshLoad: Unable to add navmesh tile: {0}").format(Array::make(status)));
+                    dtFree(data);
+                    return false;
+                }
+            }
+        }
+
+        // Layers before marking the area volumes
+        if (version >= 3)
+        {
+            int numUnmarkedLayers = sourceFile->get_32();
+            std::lock_guard<std::mutex> lock(*_unmarkedLayersMutex);
+            _unmarkedLayers.clear();
+            for (int i = 0; i < numUnmarkedLayers; ++i)
+            {
+                int tileX = sourceFile->get_32();
+                int tileZ = sourceFile->get_32();
+                int layer = sourceFile->get_32();
+                if (!loadArray(sourceFile, _unmarkedLayers[std::make_tuple(tileX, tileZ, layer)]))
+                {
+                    ERR_PRINT(String("DTNavMeshLoad: Unable to load unmarked layer {0} of tile {1} {2}.").format(Array::make(layer, tileX, tileZ)));
+                    _unmarkedLayers.clear();
+                    return false;
+                }
+            }
+        }
+
+        // Initialize crowd
+        if (!initializeCrowd())
+        {
+            ERR_PRINT("DTNavMeshLoad: Unable to initialize crowd.");
+            return false;
+        }
+    }
+    else {
+        ERR_PRINT(String("DTNavMeshLoad: Unknown version: {0}").format(Array::make(version)));
+        return false;
+    }
+
+    return true;
+}
+
+bool
+DetourNavigationMesh::buildLoadedTiles(const std::vector<dtCompressedTileRef>& refs, ThreadPool* threadPool, BuildProgress* progress)
+{
+    // Only the refs are used to access the tile cache, so the layers can be built independently
+    std::vector<LoadedTileBatch> batches((refs.size() + LOADED_TILES_PER_TASK - 1) / LOADED_TILES_PER_TASK);
+    for (int i = 0; i < batches.size(); ++i)
+    {
+        LoadedTileBatch& batch = batches[i];
+        const int begin = i * LOADED_TILES_PER_TASK;
+        const int end = std::min(begin + LOADED_TILES_PER_TASK, (int)refs.size());
+        threadPool->submit(batch.buildTask, [this, &refs, &batch, begin, end]() {
+            TileBuildWorkspace* workspace = acquireWorkspace();
+            batch.buildStatus = DT_SUCCESS;
+            for (int j = begin; j < end; ++j)
+            {
+                NavMeshTileData tileData;
+                batch.buildStatus = buildNavMeshTileData(_tileCache, refs[j], &workspace->allocator, workspace->compressor, _meshProcess, &tileData);
+                if (dtStatusFailed(batch.buildStatus))
+                {
+                    break;
+                }
+                if (tileData.data)
+                {
+                    batch.navMeshTiles.push_back(tileData);
+                }
+            }
+            releaseWorkspace(workspace);
+        });
+    }
+
+    // Add the navmesh tiles one after the other, in the order they were loaded
+    bool buildFailed = false;
+    for (int i = 0; i < batches.size(); ++i)
+    {
+        LoadedTileBatch& batch = batches[i];
+        threadPool->wait(batch.buildTask);
+        if (!buildFailed && dtStatusFailed(batch.buildStatus))
+        {
+            ERR_PRINT(String("DTNavMeshLoad: Could not build nav mesh tile {0}").format(Array::make(batch.buildStatus)));
+            buildFailed = true;
+        }
+
+        // After a failure, keep going until all tasks are done, but only to clean up
+        for (int j = 0; j < batch.navMeshTiles.size(); ++j)
+        {
+            NavMeshTileData& navMeshTile = batch.navMeshTiles[j];
+            if (buildFailed)
+            {
+                dtFree(navMeshTile.data);
+                continue;
+            }
+
+            dtStatus status = _navMesh->addTile(navMeshTile.data, navMeshTile.dataSize, DT_TILE_FREE_DATA, 0, 0);
+            if (dtStatusFailed(status))
+            {
+                ERR_PRINT(String("DTNavMeshLoad: Could not add nav mesh tile: {0}").format(Array::make(status)));
+                dtFree(navMeshTile.data);
+                buildFailed = true;
+            }
+        }
+        batch.navMeshTiles.clear();
+        if (progress)
+        {
+            const int begin = i * LOADED_TILES_PER_TASK;
+            const int end = std::min(begin + LOADED_TILES_PER_TASK, (int)refs.size());
+            for (int j = begin; j < end; ++j)
+            {
+                progress->tileDone();
+            }
+        }
+    }
+
+    return !buildFailed;
+}
+
+bool
+DetourNavigationMesh::saveChangedTiles(SaveBuffer* targetFile)
+{
+    // Sanity check
+    if (_tileCache == nullptr)
+    {
+        ERR_PRINT("DTNavMeshSave: Cannot save changed tiles, no tile cache present.");
+        return false;
+    }
+
+    targetFile->store_32(_unsavedTiles.size());
+    for (auto const& tilePos : _unsavedTiles)
+    {
+        const int x = tilePos.first;
+        const int z = tilePos.second;
+        targetFile->store_32(x);
+        targetFile->store_32(z);
+
+        // Layers, their sizes as one block followed by all of their data as another
+        dtCompressedTileRef tileRefs[128];
+        int numLayers = _tileCache->getTilesAt(x, z, tileRefs, 128);
+        std::vector<int> layerSizes;
+        std::vector<const dtCompressedTile*> layers;
+        int64_t totalLayerSize = 0;
+        for (int i = 0; i < numLayers; ++i)
+        {
+            const dtCompressedTile* tile = _tileCache->getTileByRef(tileRefs[i]);
+            if (tile && tile->header && tile->dataSize)
+            {
+                layerSizes.push_back(tile->dataSize);
+                layers.push_back(tile);
+                totalLayerSize += tile->dataSize;
+            }
+        }
+        storeArray(targetFile, layerSizes);
+        if (totalLayerSize > 0)
+        {
+            unsigned char* pos = targetFile->append(totalLayerSize);
+            for (int i = 0; i < layers.size(); ++i)
+            {
+                memcpy(pos, layers[i]->data, layerSizes[i]);
+                pos += layerSizes[i];
+            }
+        }
+
+        // Layers of the column before marking the area volumes
+        _unmarkedLayersMutex->lock();
+        auto begin = _unmarkedLayers.lower_bound(std::make_tuple(x, z, INT_MIN));
+        auto end = _unmarkedLayers.lower_bound(std::make_tuple(x, z + 1, INT_MIN));
+        targetFile->store_32(std::distance(begin, end));
+        for (auto it = begin; it != end; ++it)
+        {
+            targetFile->store_32(std::get<2>(it->first));
+            storeArray(targetFile, it->second);
+        }
+        _unmarkedLayersMutex->unlock();
+    }
+    _unsavedTiles.clear();
+
+    return true;
+}
+
+bool
+DetourNavigationMesh::loadChangedTiles(Ref<File> sourceFile)
+{
+    // Sanity check
+    if (_tileCache == nullptr)
+    {
+        ERR_PRINT("DTNavMeshLoad: Cannot load changed tiles, no tile cache present.");
+        return false;
+    }
+
+    int numTiles = sourceFile->get_32();
+    for (int i = 0; i < numTiles; ++i)
+    {
+        const int x = sourceFile->get_32();
+        const int z = sourceFile->get_32();
+        if (x < 0 || x >= _tilesX || z < 0 || z >= _tilesZ)
+        {
+            ERR_PRINT(String("DTNavMeshLoad: Invalid changed tile {0} {1}.").format(Array::make(x, z)));
+            return false;
+        }
+
+        // Replace all layers of the column
+        std::vector<int> layerSizes;
+        if (!loadArray(sourceFile, layerSizes))
+        {
+            ERR_PRINT("DTNavMeshLoad: Unable to load changed layer sizes.");
+            return false;
+        }
+        int64_t totalLayerSize = 0;
+        for (int j = 0; j < layerSizes.size(); ++j)
+        {
+            if (layerSizes[j] <= 0)
+            {
+                ERR_PRINT(String("DTNavMeshLoad: Invalid size of changed layer {0}.").format(Array::make(layerSizes[j])));
+                return false;
+            }
+            totalLayerSize += layerSizes[j];
+        }
+        if (totalLayerSize > (int64_t)(sourceFile->get_len() - sourceFile->get_position()))
+        {
+            ERR_PRINT("DTNavMeshLoad: Changed layers exceed the journal.");
+            return false;
+        }
+        PoolByteArray layerData = sourceFile->get_buffer(totalLayerSize);
+        if ((int64_t)layerData.size() != totalLayerSize)
+        {
+            ERR_PRINT("DTNavMeshLoad: Unable to load changed layers.");
+            return false;
+        }
+
+        removeTileColumn(x, z);
+        if (_areaCache)
+        {
+            _areaCache->invalidate(x, z);
+        }
+        PoolByteArray::Read layerReader = layerData.read();
+        const unsigned char* layerPos = layerReader.ptr();
+        for (int j = 0; j < layerSizes.size(); ++j)
+        {
+            unsigned char* data = (unsigned char*)dtAlloc(layerSizes[j], DT_ALLOC_PERM);
+            if (data == nullptr)
+            {
+                ERR_PRINT(String("DTNavMeshLoad: Out of memory loading changed layer {0}.").format(Array::make(layerSizes[j])));
+                return false;
+            }
+            memcpy(data, layerPos, layerSizes[j]);
+            layerPos += layerSizes[j];
+            dtStatus status = _tileCache->addTile(data, layerSizes[j], DT_COMPRESSEDTILE_FREE_DATA, 0);
+            if (dtStatusFailed(status))
+            {
+                ERR_PRINT(String("DTNavMeshLoad: Unable to add changed tile: {0}").format(Array::make(status)));
+                dtFree(data);
+                return false;
+            }
+        }
+        dtStatus status = _tileCache->buildNavMeshTilesAt(x, z, _navMesh);
+        if (dtStatusFailed(status))
+        {
+            ERR_PRINT(String("DTNavMeshLoad: Could not build nav mesh tiles at {0} {1}: {2}").format(Array::make(x, z, status)));
+            return false;
+        }
+        _tileStates[x + z * _tilesX] = TILE_BUILT;
+
+        // Layers of the column before marking the area volumes
+        clearUnmarkedLayers(x, z);
+        int numUnmarkedLayers = sourceFile->get_32();
+        for (int j = 0; j < numUnmarkedLayers; ++j)
+        {
+            int layer = sourceFile->get_32();
+            std::vector<unsigned char> data;
+            if (!loadArray(sourceFile, data))
+            {
+                ERR_PRINT("DTNavMeshLoad: Unable to load changed unmarked layer.");
+                return false;
+            }
+            storeUnmarkedLayer(x, z, layer, data.data(), data.size());
+        }
+    }
+
+    return true;
+}
+
+static int
+pointInPoly(int nvert, const float* verts, const float* p)
+{
+    int i, j, c = 0;
+    for (i = 0, j = nvert-1; i < nvert; j = i++)
+    {
+        const float* vi = &verts[i*3];
+        const float* vj = &verts[j*3];
+        if (((vi[2] > p[2]) != (vj[2] > p[2])) &&
+            (p[0] < (vj[0]-vi[0]) * (p[2]-vi[2]) / (vj[2]-vi[2]) + vi[0]) )
+            c = !c;
+    }
+    return c;
+}
+
+struct ChangedPosData
+{
     float   lowestY;
     float   highestY;
 };
@@ -947,12 +1892,17 @@ DetourNavigationMesh::rebuildChangedTiles(const std::vector<int>& removedMarkedA
         }
 
         // Remove all affected layers
+        _unsavedTiles.insert(tilePos);
         bool doAllLayers = false;
         removedLayers.clear();
         for (auto const& layer : entry.second)
         {
             ChangedTileLayerData data = layer.second;
             removedLayers.push_back(data.layer);
+            if (_layerCache)
+            {
+                _layerCache->invalidate(data.ref);
+            }
             _tileCache->removeTile(data.ref, 0, 0);
             dtTileRef ref = _navMesh->getTileRefAt(tilePos.first, tilePos.second, data.layer);
             _navMesh->removeTile(ref, 0, 0);
@@ -970,7 +1920,11 @@ DetourNavigationMesh::rebuildChangedTiles(const std::vector<int>& removedMarkedA
             adjustedCfg.bmin[1] = changedPosData[tilePos].lowestY;
             adjustedCfg.bmax[1] = changedPosData[tilePos].highestY;
         }
-        int ntiles = rasterizeTileLayers(tilePos.first, tilePos.second, adjustedCfg, tiles, maxLayersToAdd);
+        TileBuildWorkspace* workspace = acquireWorkspace();
+        workspace->context.beginTile(_navMeshIndex, tilePos.first, tilePos.second);
+        int ntiles = rasterizeTileLayers(tilePos.first, tilePos.second, adjustedCfg, tiles, maxLayersToAdd, workspace);
+        workspace->context.endTile();
+        releaseWorkspace(workspace);
         if (ntiles == 0)
         {
             WARN_PRINT("DTNavMesh: rebuildChangedTiles: rasterize yielded 0 tiles.");
@@ -1029,6 +1983,9 @@ DetourNavigationMesh::rebuildChangedTiles(const std::vector<int>& removedMarkedA
             return;
         }
 
+        // Building the column on demand now would add its layers a second time
+        _tileStates[tilePos.first + tilePos.second * _tilesX] = TILE_BUILT;
+
         delete [] tiles;
     } // END Iterate changed tiles
 }
@@ -1137,7 +2094,8 @@ DetourNavigationMesh::update(float timeDeltaSeconds)
 void
 DetourNavigationMesh::createDebugMesh(GodotDetourDebugDraw* debugDrawer, bool drawCacheBounds)
 {
-    if (!_inputGeom || !_inputGeom->getMesh())
+    // The geometry itself might be frozen, everything drawn here is still there
+    if (!_inputGeom)
         return;
 
 
@@ -1261,7 +2219,7 @@ DetourNavigationMesh::initializeCrowd()
 }
 
 int
-DetourNavigationMesh::rasterizeTileLayers(const int tileX, const int tileZ, const rcConfig& cfg, TileCacheData* tiles, const int maxTiles)
+DetourNavigationMesh::rasterizeTileLayers(const int tileX, const int tileZ, const rcConfig& cfg, TileCacheData* tiles, const int maxTiles, TileBuildWorkspace* workspace)
 {
     if (!_inputGeom || !_inputGeom->getMesh() || !_inputGeom->getChunkyMesh())
     {
@@ -1269,12 +2227,9 @@ DetourNavigationMesh::rasterizeTileLayers(const int tileX, const int tileZ, cons
         return 0;
     }
 
-    FastLZCompressor comp;
-    RasterizationContext rc(_maxLayers);
-
-    const float* verts = _inputGeom->getMesh()->getVerts();
-    const int nverts = _inputGeom->getMesh()->getVertCount();
-    const rcChunkyTriMesh* chunkyMesh = _inputGeom->getChunkyMesh();
+    RecastContext* context = &workspace->context;
+    RasterizationContext& rc = workspace->rasterization;
+    rc.reset();
 
     // Tile bounds.
     const float tcs = cfg.tileSize * cfg.cs;
@@ -1293,103 +2248,42 @@ DetourNavigationMesh::rasterizeTileLayers(const int tileX, const int tileZ, cons
     tcfg.bmax[0] += tcfg.borderSize*tcfg.cs;
     tcfg.bmax[2] += tcfg.borderSize*tcfg.cs;
 
-    // Allocate voxel heightfield where we rasterize our input data to.
-    rc.solid = rcAllocHeightfield();
-    if (!rc.solid)
+    // The voxel heightfield where we rasterize our input data to is reused between tiles.
+    if (!rc.solid || !rc.chf || !rc.lset)
     {
         ERR_PRINT("DTNavMesh::rasterizeTileLayers:  Out of memory 'solid'");
         return 0;
     }
-    if (!rcCreateHeightfield(_recastContext, *rc.solid, tcfg.width, tcfg.height, tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
-    {
-        ERR_PRINT("DTNavMesh::rasterizeTileLayers: Could not create solid heightfield");
-        return 0;
-    }
-
-    // Allocate array that can hold triangle flags.
-    // If you have multiple meshes you need to process, allocate
-    // and array which can hold the max number of triangles you need to process.
-    rc.triareas = new unsigned char[chunkyMesh->maxTrisPerChunk];
-    if (!rc.triareas)
-    {
-        ERR_PRINT(String("DTNavMesh::rasterizeTileLayers: Out of memory 'm_triareas' {0}").format(Array::make(chunkyMesh->maxTrisPerChunk)));
-        return 0;
-    }
 
-    float tbmin[2], tbmax[2];
-    tbmin[0] = tcfg.bmin[0];
-    tbmin[1] = tcfg.bmin[2];
-    tbmax[0] = tcfg.bmax[0];
-    tbmax[1] = tcfg.bmax[2];
-    int cid[512];
-    const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid, 512);
-    if (!ncid)
-    {
-        return 0;
-    }
-
-    if (ncid > 512)
-    {
-        WARN_PRINT(String("DTNavMesh::rasterizeTileLayers: Got more than 512 chunks. FIXME").format(Array::make(ncid)));
-    }
-
-    for (int i = 0; i < ncid; ++i)
+    // The geometry of the tile has not changed since it was last built with this height range, so only the areas need to be marked again
+    if (!_areaCache || !_areaCache->restore(context, tileX, tileZ, tcfg.bmin[1], tcfg.bmax[1], rc))
     {
-        const rcChunkyTriMeshNode& node = chunkyMesh->nodes[cid[i]];
-        const int* tris = &chunkyMesh->tris[node.i*3];
-        const int ntris = node.n;
-
-        memset(rc.triareas, 0, ntris*sizeof(unsigned char));
-        rcMarkWalkableTriangles(_recastContext, tcfg.walkableSlopeAngle, verts, nverts, tris, ntris, rc.triareas);
-
-        if (!rcRasterizeTriangles(_recastContext, verts, nverts, tris, rc.triareas, ntris, *rc.solid, tcfg.walkableClimb))
+        if (!buildErodedHeightfield(tileX, tileZ, tcfg, context, rc))
         {
-            Godot::print("DTNavMesh::rasterizeTileLayers: RasterizeTriangles returned false");
             return 0;
         }
-    }
-
-    // Once all geometry is rasterized, we do initial pass of filtering to
-    // remove unwanted overhangs caused by the conservative rasterization
-    // as well as filter spans where the character cannot possibly stand.
-    rcFilterLowHangingWalkableObstacles(_recastContext, tcfg.walkableClimb, *rc.solid);
-    rcFilterLedgeSpans(_recastContext, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid);
-    rcFilterWalkableLowHeightSpans(_recastContext, tcfg.walkableHeight, *rc.solid);
-
-    rc.chf = rcAllocCompactHeightfield();
-    if (!rc.chf)
-    {
-        ERR_PRINT("DTNavMesh::rasterizeTileLayers: Out of memory 'chf'");
-        return 0;
-    }
-    if (!rcBuildCompactHeightfield(_recastContext, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid, *rc.chf))
-    {
-        ERR_PRINT("DTNavMesh::rasterizeTileLayers: Could not build compact data");
-        return 0;
-    }
-
-    // Erode the walkable area by agent radius.
-    if (!rcErodeWalkableArea(_recastContext, tcfg.walkableRadius, *rc.chf))
-    {
-        ERR_PRINT("DTNavMesh::rasterizeTileLayers: Could not erode");
-        return 0;
+        if (_areaCache)
+        {
+            _areaCache->store(tileX, tileZ, tcfg.bmin[1], tcfg.bmax[1], *rc.chf);
+        }
     }
 
     // Mark areas (as water, grass, road, etc.), by default, everything is ground
-    ConvexVolume* vols = _inputGeom->getConvexVolumes();
-    for (int i  = 0; i < _inputGeom->getConvexVolumeCount(); ++i)
+    // Area volumes are marked on the layers instead, so they can be changed without coming back here
+    if (!_areaVolumes)
     {
-        rcMarkConvexPolyArea(_recastContext, vols[i].verts, vols[i].nverts, vols[i].hmin, vols[i].hmax, (unsigned char)vols[i].area, *rc.chf);
-        vols[i].isNew = false;
+        ConvexVolume* vols = _inputGeom->getConvexVolumes();
+        for (int i  = 0; i < _inputGeom->getConvexVolumeCount(); ++i)
+        {
+            rcMarkConvexPolyArea(context, vols[i].verts, vols[i].nverts, vols[i].hmin, vols[i].hmax, (unsigned char)vols[i].area, *rc.chf);
+        }
     }
-
-    rc.lset = rcAllocHeightfieldLayerSet();
-    if (!rc.lset)
+    else
     {
-        ERR_PRINT("DTNavMesh::rasterizeTileLayers: Out of memory 'lset'");
-        return 0;
+        clearUnmarkedLayers(tileX, tileZ);
     }
-    if (!rcBuildHeightfieldLayers(_recastContext, *rc.chf, tcfg.borderSize, tcfg.walkableHeight, *rc.lset))
+
+    if (!rcBuildHeightfieldLayers(context, *rc.chf, tcfg.borderSize, tcfg.walkableHeight, *rc.lset))
     {
         ERR_PRINT("DTNavMesh::rasterizeTileLayers: Could not build heighfield layers");
         return 0;
@@ -1423,7 +2317,34 @@ DetourNavigationMesh::rasterizeTileLayers(const int tileX, const int tileZ, cons
         header.hmin = (unsigned short)layer->hmin;
         header.hmax = (unsigned short)layer->hmax;
 
-        dtStatus status = dtBuildTileCacheLayer(&comp, &header, layer->heights, layer->areas, layer->cons,
+        // Keep the layer as it was before marking the area volumes, if they changed it
+        if (_areaVolumes)
+        {
+            const int numCells = layer->width * layer->height;
+            std::vector<unsigned char> unmarkedAreas(layer->areas, layer->areas + numCells);
+            dtTileCacheLayer markedLayer;
+            memset(&markedLayer, 0, sizeof(markedLayer));
+            markedLayer.header = &header;
+            markedLayer.heights = layer->heights;
+            markedLayer.areas = layer->areas;
+            markedLayer.cons = layer->cons;
+            if (markAreaVolumes(markedLayer))
+            {
+                unsigned char* unmarkedData = 0;
+                int unmarkedDataSize = 0;
+                dtStatus status = dtBuildTileCacheLayer(workspace->compressor, &header, layer->heights, unmarkedAreas.data(), layer->cons,
+                                                        &unmarkedData, &unmarkedDataSize);
+                if (dtStatusFailed(status))
+                {
+                    ERR_PRINT("DTNavMesh::rasterizeTileLayers: Unable to build unmarked tile cache layer");
+                    return 0;
+                }
+                storeUnmarkedLayer(tileX, tileZ, i, unmarkedData, unmarkedDataSize);
+                dtFree(unmarkedData);
+            }
+        }
+
+        dtStatus status = dtBuildTileCacheLayer(workspace->compressor, &header, layer->heights, layer->areas, layer->cons,
                                                 &tile->data, &tile->dataSize);
         if (dtStatusFailed(status))
         {
@@ -1444,24 +2365,126 @@ DetourNavigationMesh::rasterizeTileLayers(const int tileX, const int tileZ, cons
     return n;
 }
 
-void
-DetourNavigationMesh::debugDrawTiles(GodotDetourDebugDraw* debugDrawer)
+bool
+DetourNavigationMesh::buildErodedHeightfield(const int tileX, const int tileZ, const rcConfig& tcfg, RecastContext* context, RasterizationContext& rc)
 {
-    unsigned int fcol[6];
-    float bmin[3], bmax[3];
-
-    for (int i = 0; i < _tileCache->getTileCount(); ++i)
+    // Rasterize the input geometry, unless a navmesh with the same voxel settings already did so
+    auto rasterize = [this, &tcfg, context](rcHeightfield& solid) {
+        return rasterizeTileHeightfield(tcfg, context, solid);
+    };
+    bool rasterized = false;
+    if (_heightfieldCache)
     {
-        const dtCompressedTile* tile = _tileCache->getTile(i);
-        if (!tile->header)
-        {
-            continue;
-        }
-
-        _tileCache->calcTightTileBounds(tile->header, bmin, bmax);
-
-        const unsigned int col = duIntToCol(i, 64);
-        duCalcBoxColors(fcol, col, col);
+        rasterized = _heightfieldCache->getHeightfield(context, tileX, tileZ, tcfg.bmin[1], tcfg.bmax[1], *rc.solid, rasterize);
+    }
+    else
+    {
+        rasterized = rasterize(*rc.solid);
+    }
+    if (!rasterized)
+    {
+        return false;
+    }
+
+    // Once all geometry is rasterized, we do initial pass of filtering to
+    // remove unwanted overhangs caused by the conservative rasterization
+    // as well as filter spans where the character cannot possibly stand.
+    rcFilterLowHangingWalkableObstacles(context, tcfg.walkableClimb, *rc.solid);
+    rcFilterLedgeSpans(context, tcfg.walkableHeight, tcfg.walkableClimb, *rc.solid);
+    rcFilterWalkableLowHeightSpans(context, tcfg.walkableHeight, *rc.solid);
+
+    if (!rc.buildCompactHeightfield(context, tcfg.walkableHeight, tcfg.walkableClimb))
+    {
+        ERR_PRINT("DTNavMesh::buildErodedHeightfield: Could not build compact data");
+        return false;
+    }
+
+    // Erode the walkable area by agent radius.
+    if (!rcErodeWalkableArea(context, tcfg.walkableRadius, *rc.chf))
+    {
+        ERR_PRINT("DTNavMesh::buildErodedHeightfield: Could not erode");
+        return false;
+    }
+
+    return true;
+}
+
+bool
+DetourNavigationMesh::rasterizeTileHeightfield(const rcConfig& tcfg, RecastContext* context, rcHeightfield& solid)
+{
+    const float* verts = _inputGeom->getMesh()->getVerts();
+    const int nverts = _inputGeom->getMesh()->getVertCount();
+
+    if (!resetHeightfield(context, solid, tcfg.width, tcfg.height, tcfg.bmin, tcfg.bmax, tcfg.cs, tcfg.ch))
+    {
+        ERR_PRINT("DTNavMesh::rasterizeTileHeightfield: Could not create solid heightfield");
+        return false;
+    }
+
+    float tbmin[2], tbmax[2];
+    tbmin[0] = tcfg.bmin[0];
+    tbmin[1] = tcfg.bmin[2];
+    tbmax[0] = tcfg.bmax[0];
+    tbmax[1] = tcfg.bmax[2];
+    // The initial mesh and each piece of geometry added later have their own chunky mesh
+    int totalChunks = 0;
+    for (int c = 0; c < _inputGeom->getChunkyMeshCount(); ++c)
+    {
+        // Most added pieces are small, don't look into the ones far away from this tile
+        const float* pieceMin = _inputGeom->getChunkyMeshBoundsMin(c);
+        const float* pieceMax = _inputGeom->getChunkyMeshBoundsMax(c);
+        if (!dtOverlapBounds(pieceMin, pieceMax, tcfg.bmin, tcfg.bmax))
+        {
+            continue;
+        }
+
+        const rcChunkyTriMesh* chunkyMesh = _inputGeom->getChunkyMesh(c);
+        const unsigned char* walkableAreas = _inputGeom->getWalkableAreas(context, c, tcfg.walkableSlopeAngle);
+        int cid[512];
+        const int ncid = rcGetChunksOverlappingRect(chunkyMesh, tbmin, tbmax, cid, 512);
+        totalChunks += ncid;
+
+        if (ncid > 512)
+        {
+            WARN_PRINT(String("DTNavMesh::rasterizeTileHeightfield: Got more than 512 chunks. FIXME").format(Array::make(ncid)));
+        }
+
+        for (int i = 0; i < ncid; ++i)
+        {
+            const rcChunkyTriMeshNode& node = chunkyMesh->nodes[cid[i]];
+            const int* tris = &chunkyMesh->tris[node.i*3];
+            const int ntris = node.n;
+
+            // The slope of the triangles was classified once for all tiles
+            if (!rcRasterizeTriangles(context, verts, nverts, tris, &walkableAreas[node.i], ntris, solid, _rasterizationClimb))
+            {
+                Godot::print("DTNavMesh::rasterizeTileHeightfield: RasterizeTriangles returned false");
+                return false;
+            }
+        }
+    }
+
+    return totalChunks > 0;
+}
+
+void
+DetourNavigationMesh::debugDrawTiles(GodotDetourDebugDraw* debugDrawer)
+{
+    unsigned int fcol[6];
+    float bmin[3], bmax[3];
+
+    for (int i = 0; i < _tileCache->getTileCount(); ++i)
+    {
+        const dtCompressedTile* tile = _tileCache->getTile(i);
+        if (!tile->header)
+        {
+            continue;
+        }
+
+        _tileCache->calcTightTileBounds(tile->header, bmin, bmax);
+
+        const unsigned int col = duIntToCol(i, 64);
+        duCalcBoxColors(fcol, col, col);
         debugDrawer->debugDrawBox(bmin[0],bmin[1],bmin[2], bmax[0],bmax[1],bmax[2], fcol);
     }
 
@@ -1505,3 +2528,787 @@ DetourNavigationMesh::debugDrawObstacles(GodotDetourDebugDraw* debugDrawer)
         duDebugDrawCylinderWire(debugDrawer, bmin[0],bmin[1],bmin[2], bmax[0],bmax[1],bmax[2], duDarkenCol(col), 2);
     }
 }
+
+void
+DetourNavigationMesh::setHeightfieldCache(HeightfieldCache* cache, int borderSize, int rasterizationClimb)
+{
+    _heightfieldCache = cache;
+    _sharedBorderSize = borderSize;
+    _rasterizationClimb = rasterizationClimb;
+}
+
+void
+DetourNavigationMesh::detachHeightfieldCache()
+{
+    _heightfieldCache = nullptr;
+}
+
+void
+DetourNavigationMesh::enableLazyBuild(float radius, const std::vector<Vector3>& initialPositions)
+{
+    _lazyBuildRadius = radius;
+    _lazyInitialPositions = initialPositions;
+    _lazyBuildCancelled = false;
+}
+
+bool
+DetourNavigationMesh::getTilesAround(const Vector3& position, int& minX, int& minZ, int& maxX, int& maxZ) const
+{
+    const float tileWidth = _tileSize * _cellSize.x;
+    minX = rcMax((int)floorf((position.x - _lazyBuildRadius - _rcConfig->bmin[0]) / tileWidth), 0);
+    maxX = rcMin((int)floorf((position.x + _lazyBuildRadius - _rcConfig->bmin[0]) / tileWidth), _tilesX - 1);
+    minZ = rcMax((int)floorf((position.z - _lazyBuildRadius - _rcConfig->bmin[2]) / tileWidth), 0);
+    maxZ = rcMin((int)floorf((position.z + _lazyBuildRadius - _rcConfig->bmin[2]) / tileWidth), _tilesZ - 1);
+    return minX <= maxX && minZ <= maxZ;
+}
+
+bool
+DetourNavigationMesh::overlapsTile(const float* bmin, const float* bmax, int tileX, int tileZ) const
+{
+    const float tileWidth = _tileSize * _cellSize.x;
+    const float tileMinX = _rcConfig->bmin[0] + tileX * tileWidth;
+    const float tileMinZ = _rcConfig->bmin[2] + tileZ * tileWidth;
+    return bmin[0] <= tileMinX + tileWidth && bmax[0] >= tileMinX
+        && bmin[2] <= tileMinZ + tileWidth && bmax[2] >= tileMinZ;
+}
+
+void
+DetourNavigationMesh::requestTilesAround(const Vector3& position, std::vector<std::pair<int, int> >& tilesToBuild)
+{
+    int minX, minZ, maxX, maxZ;
+    if (!isLazyBuild() || !getTilesAround(position, minX, minZ, maxX, maxZ))
+    {
+        return;
+    }
+
+    // Only take the tiles actually within the radius, not all in the bounding square
+    const float tileWidth = _tileSize * _cellSize.x;
+    const float radiusSqr = _lazyBuildRadius * _lazyBuildRadius;
+    for (int z = minZ; z <= maxZ; ++z)
+    {
+        for (int x = minX; x <= maxX; ++x)
+        {
+            unsigned char& state = _tileStates[x + z * _tilesX];
+            if (state != TILE_NOT_BUILT)
+            {
+                continue;
+            }
+
+            const float tileMinX = _rcConfig->bmin[0] + x * tileWidth;
+            const float tileMinZ = _rcConfig->bmin[2] + z * tileWidth;
+            const float dx = position.x - rcClamp(position.x, tileMinX, tileMinX + tileWidth);
+            const float dz = position.z - rcClamp(position.z, tileMinZ, tileMinZ + tileWidth);
+            if (dx * dx + dz * dz > radiusSqr)
+            {
+                continue;
+            }
+
+            state = TILE_QUEUED;
+            tilesToBuild.push_back(std::make_pair(x, z));
+        }
+    }
+}
+
+void
+DetourNavigationMesh::rasterizeLazyTile(int tileX, int tileZ)
+{
+    // Shutting down, nobody will add this tile anymore
+    if (_lazyBuildCancelled)
+    {
+        return;
+    }
+
+    LazyTile* tile = new LazyTile();
+    tile->tileX = tileX;
+    tile->tileZ = tileZ;
+
+    // Columns still in the save file only need to be read
+    tile->fromSaveFile = loadSavedRegion(tileX, tileZ, tile->layers);
+    if (!tile->fromSaveFile)
+    {
+        tile->layers.resize(_maxLayers);
+        TileBuildWorkspace* workspace = acquireWorkspace();
+        workspace->context.beginTile(_navMeshIndex, tileX, tileZ);
+        int ntiles = rasterizeTileLayers(tileX, tileZ, *_rcConfig, tile->layers.data(), _maxLayers, workspace);
+        workspace->context.endTile();
+        releaseWorkspace(workspace);
+        tile->layers.resize(ntiles);
+    }
+
+    std::lock_guard<std::mutex> lock(*_lazyTileMutex);
+    _lazyTiles.push_back(tile);
+}
+
+int
+DetourNavigationMesh::addLazyTiles(const std::vector<Ref<DetourObstacle> >& obstacles)
+{
+    std::vector<LazyTile*> tiles;
+    {
+        std::lock_guard<std::mutex> lock(*_lazyTileMutex);
+        tiles.swap(_lazyTiles);
+    }
+    if (tiles.empty())
+    {
+        return 0;
+    }
+
+    std::vector<std::pair<int, int> > addedTiles;
+    for (int i = 0; i < tiles.size(); ++i)
+    {
+        LazyTile* tile = tiles[i];
+        addedTiles.push_back(std::make_pair(tile->tileX, tile->tileZ));
+        if (!tile->fromSaveFile)
+        {
+            _unsavedTiles.insert(addedTiles.back());
+        }
+        for (int j = 0; j < tile->layers.size(); ++j)
+        {
+            TileCacheData* layer = &tile->layers[j];
+            dtStatus status = _tileCache->addTile(layer->data, layer->dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
+            if (dtStatusFailed(status))
+            {
+                ERR_PRINT(String("DTNavMesh: addLazyTiles: Unable to add tile: {0}").format(Array::make(status)));
+                dtFree(layer->data);
+                layer->data = 0;
+            }
+        }
+
+        dtStatus status = _tileCache->buildNavMeshTilesAt(tile->tileX, tile->tileZ, _navMesh);
+        if (dtStatusFailed(status))
+        {
+            ERR_PRINT(String("DTNavMesh: addLazyTiles: Could not build nav mesh tiles at {0} {1}: {2}").format(Array::make(tile->tileX, tile->tileZ, status)));
+        }
+        _tileStates[tile->tileX + tile->tileZ * _tilesX] = TILE_BUILT;
+        delete tile;
+    }
+    refreshObstacles(obstacles, addedTiles);
+
+    return addedTiles.size();
+}
+
+bool
+DetourNavigationMesh::loadSavedRegion(int tileX, int tileZ, std::vector<TileCacheData>& layers)
+{
+    // Reading from the file and forgetting the column under the lock, so no other thread reads it as well
+    std::unique_lock<std::mutex> lock(*_regionFileMutex);
+    auto it = _savedRegions.find(std::make_pair(tileX, tileZ));
+    if (it == _savedRegions.end())
+    {
+        return false;
+    }
+    SavedRegion* region = it->second;
+    _savedRegions.erase(it);
+    _regionFile->seek(region->offset);
+    PoolByteArray data = _regionFile->get_buffer(region->size);
+    if (_savedRegions.empty())
+    {
+        _regionFile->close();
+        _regionFile = Ref<File>();
+    }
+    lock.unlock();
+
+    // Rasterizing a damaged column is the better alternative to adding garbage to the tile cache
+    PoolByteArray::Read reader = data.read();
+    if (data.size() != region->size || computeChecksum(reader.ptr(), region->size) != region->checksum)
+    {
+        ERR_PRINT(String("DTNavMesh: Saved tiles at {0} {1} are damaged, rasterizing them instead.").format(Array::make(tileX, tileZ)));
+        delete region;
+        return false;
+    }
+
+    const unsigned char* pos = reader.ptr();
+    for (int i = 0; i < region->layerSizes.size(); ++i)
+    {
+        TileCacheData layer;
+        layer.dataSize = region->layerSizes[i];
+        layer.data = (unsigned char*)dtAlloc(layer.dataSize, DT_ALLOC_PERM);
+        if (!layer.data)
+        {
+            ERR_PRINT(String("DTNavMesh: Out of memory reading saved tiles at {0} {1}.").format(Array::make(tileX, tileZ)));
+            for (int j = 0; j < layers.size(); ++j)
+            {
+                dtFree(layers[j].data);
+            }
+            layers.clear();
+            delete region;
+            return false;
+        }
+        memcpy(layer.data, pos, layer.dataSize);
+        pos += alignTileSize(layer.dataSize);
+        layers.push_back(layer);
+    }
+    delete region;
+    return true;
+}
+
+void
+DetourNavigationMesh::readSavedRegions()
+{
+    std::lock_guard<std::mutex> lock(*_regionFileMutex);
+    for (auto const& region : _savedRegions)
+    {
+        _regionFile->seek(region.second->offset);
+        PoolByteArray array = _regionFile->get_buffer(region.second->size);
+        PoolByteArray::Read reader = array.read();
+        region.second->data.assign(reader.ptr(), reader.ptr() + array.size());
+    }
+}
+
+void
+DetourNavigationMesh::forgetSavedRegions(const std::vector<float>& bounds)
+{
+    std::lock_guard<std::mutex> lock(*_regionFileMutex);
+    if (_savedRegions.empty())
+    {
+        return;
+    }
+
+    // Including the border rasterized around each tile, like collectTileColumns()
+    const float border = _rcConfig->borderSize * _cellSize.x;
+    for (int i = 0; i + 5 < bounds.size(); i += 6)
+    {
+        const float bmin[3] = { bounds[i] - border, bounds[i + 1], bounds[i + 2] - border };
+        const float bmax[3] = { bounds[i + 3] + border, bounds[i + 4], bounds[i + 5] + border };
+        auto it = _savedRegions.begin();
+        while (it != _savedRegions.end())
+        {
+            if (overlapsTile(bmin, bmax, it->first.first, it->first.second))
+            {
+                delete it->second;
+                it = _savedRegions.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
+
+void
+DetourNavigationMesh::requestRemainingRegions(std::vector<std::pair<int, int> >& tilesToBuild)
+{
+    std::lock_guard<std::mutex> lock(*_regionFileMutex);
+    auto it = _savedRegions.begin();
+    while (it != _savedRegions.end())
+    {
+        unsigned char& state = _tileStates[it->first.first + it->first.second * _tilesX];
+        if (state == TILE_NOT_BUILT)
+        {
+            state = TILE_QUEUED;
+            tilesToBuild.push_back(it->first);
+            ++it;
+        }
+        else
+        {
+            // Replaced since loading (e.g. by a journal), never read anymore
+            delete it->second;
+            it = _savedRegions.erase(it);
+        }
+    }
+
+    // The file is closed once the last column is read
+    if (_savedRegions.empty() && _regionFile.ptr() != nullptr)
+    {
+        _regionFile->close();
+        _regionFile = Ref<File>();
+    }
+}
+
+void
+DetourNavigationMesh::refreshObstacles(const std::vector<Ref<DetourObstacle> >& obstacles, const std::vector<std::pair<int, int> >& tiles)
+{
+    // Recreating takes two requests (remove and add), and a removed obstacle keeps its slot until the tile cache
+    // processed the removal. Let the tile cache catch up whenever its requests are full, or obstacles would be lost.
+    int numRequests = 0;
+    for (int i = 0; i < obstacles.size(); ++i)
+    {
+        const dtTileCacheObstacle* ob = _tileCache->getObstacleByRef(obstacles[i]->getReference(_tileCache));
+        if (!ob)
+        {
+            continue;
+        }
+
+        float bmin[3], bmax[3];
+        _tileCache->getObstacleBounds(ob, bmin, bmax);
+        for (int j = 0; j < tiles.size(); ++j)
+        {
+            if (overlapsTile(bmin, bmax, tiles[j].first, tiles[j].second))
+            {
+                if (numRequests + 2 > MAX_OBSTACLE_REQUESTS)
+                {
+                    updateTileCache();
+                    numRequests = 0;
+                }
+                obstacles[i]->recreate(_tileCache);
+                numRequests += 2;
+                break;
+            }
+        }
+    }
+}
+
+void
+DetourNavigationMesh::updateTileCache()
+{
+    bool upToDate = false;
+    while (!upToDate)
+    {
+        dtStatus status = _tileCache->update(0, _navMesh, &upToDate);
+        if (dtStatusFailed(status))
+        {
+            ERR_PRINT(String("DTNavMesh: Unable to update the tile cache: {0}").format(Array::make(status)));
+            return;
+        }
+    }
+}
+
+void
+DetourNavigationMesh::collectTileColumns(const std::vector<float>& bounds, std::set<std::pair<int, int> >& tiles) const
+{
+    const float tileWidth = _tileSize * _cellSize.x;
+    const float border = _rcConfig->borderSize * _cellSize.x;
+    for (int i = 0; i + 5 < bounds.size(); i += 6)
+    {
+        const float* bmin = &bounds[i];
+        const float* bmax = &bounds[i + 3];
+        int minX = rcMax((int)floorf((bmin[0] - border - _rcConfig->bmin[0]) / tileWidth), 0);
+        int maxX = rcMin((int)floorf((bmax[0] + border - _rcConfig->bmin[0]) / tileWidth), _tilesX - 1);
+        int minZ = rcMax((int)floorf((bmin[2] - border - _rcConfig->bmin[2]) / tileWidth), 0);
+        int maxZ = rcMin((int)floorf((bmax[2] + border - _rcConfig->bmin[2]) / tileWidth), _tilesZ - 1);
+        for (int z = minZ; z <= maxZ; ++z)
+        {
+            for (int x = minX; x <= maxX; ++x)
+            {
+                // Tiles not built yet will see the change anyway
+                if (isLazyBuild() && _tileStates[x + z * _tilesX] != TILE_BUILT)
+                {
+                    continue;
+                }
+                tiles.insert(std::make_pair(x, z));
+            }
+        }
+    }
+}
+
+void
+DetourNavigationMesh::rebuildGeometryTiles(const std::vector<float>& changedBounds, const std::vector<Ref<DetourObstacle> >& obstacles)
+{
+    // Collect the tile columns touched by the changed geometry
+    std::set<std::pair<int, int> > changedTiles;
+    collectTileColumns(changedBounds, changedTiles);
+    if (changedTiles.empty())
+    {
+        return;
+    }
+
+    std::vector<TileCacheData> layers(_maxLayers);
+    std::vector<std::pair<int, int> > rebuiltTiles;
+    TileBuildWorkspace* workspace = acquireWorkspace();
+    for (auto const& tilePos : changedTiles)
+    {
+        const int x = tilePos.first;
+        const int z = tilePos.second;
+        removeTileColumn(x, z);
+        _unsavedTiles.insert(tilePos);
+
+        // Rasterize and add the whole column again, the cached heightfield still has the old geometry
+        if (_areaCache)
+        {
+            _areaCache->invalidate(x, z);
+        }
+        workspace->context.beginTile(_navMeshIndex, x, z);
+        int ntiles = rasterizeTileLayers(x, z, *_rcConfig, layers.data(), _maxLayers, workspace);
+        workspace->context.endTile();
+        for (int i = 0; i < ntiles; ++i)
+        {
+            dtStatus status = _tileCache->addTile(layers[i].data, layers[i].dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
+            if (dtStatusFailed(status))
+            {
+                ERR_PRINT(String("DTNavMesh: rebuildGeometryTiles: Unable to add tile: {0}").format(Array::make(status)));
+                dtFree(layers[i].data);
+            }
+            layers[i].data = 0;
+        }
+
+        dtStatus status = _tileCache->buildNavMeshTilesAt(x, z, _navMesh);
+        if (dtStatusFailed(status))
+        {
+            ERR_PRINT(String("DTNavMesh: rebuildGeometryTiles: Could not build nav mesh tiles at {0} {1}: {2}").format(Array::make(x, z, status)));
+        }
+        rebuiltTiles.push_back(tilePos);
+    }
+    releaseWorkspace(workspace);
+
+    refreshObstacles(obstacles, rebuiltTiles);
+    Godot::print(String("DTNavMesh: rebuilt {0} tiles for changed geometry").format(Array::make((int)rebuiltTiles.size())));
+}
+
+void
+DetourNavigationMesh::rebuildAreaVolumes(const std::vector<float>& changedBounds, const std::vector<Ref<DetourObstacle> >& obstacles)
+{
+    std::set<std::pair<int, int> > changedTiles;
+    collectTileColumns(changedBounds, changedTiles);
+    if (changedTiles.empty())
+    {
+        return;
+    }
+
+    int numRebuiltLayers = 0;
+    std::vector<std::pair<int, int> > rebuiltTiles;
+    std::vector<unsigned char> source;
+    TileBuildWorkspace* workspace = acquireWorkspace();
+    for (auto const& tilePos : changedTiles)
+    {
+        const int x = tilePos.first;
+        const int z = tilePos.second;
+
+        dtCompressedTileRef tileRefs[128];
+        int numLayers = _tileCache->getTilesAt(x, z, tileRefs, 128);
+        for (int i = 0; i < numLayers; ++i)
+        {
+            const dtCompressedTile* tile = _tileCache->getTileByRef(tileRefs[i]);
+            if (!tile || !tile->header)
+            {
+                continue;
+            }
+            const int layerIndex = tile->header->tlayer;
+
+            // Start from the layer without any areas marked, if a volume touched it before
+            bool wasMarked = false;
+            _unmarkedLayersMutex->lock();
+            auto unmarked = _unmarkedLayers.find(std::make_tuple(x, z, layerIndex));
+            if (unmarked != _unmarkedLayers.end())
+            {
+                source = unmarked->second;
+                wasMarked = true;
+            }
+            else
+            {
+                source.assign(tile->data, tile->data + tile->dataSize);
+            }
+            _unmarkedLayersMutex->unlock();
+
+            workspace->allocator.reset();
+            dtTileCacheLayer* layer = 0;
+            dtStatus status = dtDecompressTileCacheLayer(&workspace->allocator, workspace->compressor, source.data(), (int)source.size(), &layer);
+            if (dtStatusFailed(status))
+            {
+                ERR_PRINT(String("DTNavMesh: rebuildAreaVolumes: Unable to decompress layer {0} at {1} {2}: {3}").format(Array::make(layerIndex, x, z, status)));
+                continue;
+            }
+
+            // Nothing to do if no volume touches the layer, neither now nor before
+            bool marked = markAreaVolumes(*layer);
+            if (!marked && !wasMarked)
+            {
+                dtFreeTileCacheLayer(&workspace->allocator, layer);
+                continue;
+            }
+
+            // Compress the marked layer, or go back to the unmarked one if no volume touches it anymore
+            unsigned char* data = 0;
+            int dataSize = 0;
+            if (marked)
+            {
+                dtTileCacheLayerHeader header = *layer->header;
+                status = dtBuildTileCacheLayer(workspace->compressor, &header, layer->heights, layer->areas, layer->cons, &data, &dataSize);
+            }
+            else
+            {
+                data = (unsigned char*)dtAlloc(source.size(), DT_ALLOC_PERM);
+                dataSize = (int)source.size();
+                status = data ? DT_SUCCESS : DT_FAILURE | DT_OUT_OF_MEMORY;
+                if (data)
+                {
+                    memcpy(data, source.data(), dataSize);
+                }
+            }
+            dtFreeTileCacheLayer(&workspace->allocator, layer);
+            if (dtStatusFailed(status))
+            {
+                ERR_PRINT(String("DTNavMesh: rebuildAreaVolumes: Unable to build layer {0} at {1} {2}: {3}").format(Array::make(layerIndex, x, z, status)));
+                continue;
+            }
+            if (marked && !wasMarked)
+            {
+                storeUnmarkedLayer(x, z, layerIndex, source.data(), (int)source.size());
+            }
+            else if (!marked)
+            {
+                storeUnmarkedLayer(x, z, layerIndex, nullptr, 0);
+            }
+
+            // Swap the layer
+            if (_layerCache)
+            {
+                _layerCache->invalidate(tileRefs[i]);
+            }
+            _tileCache->removeTile(tileRefs[i], 0, 0);
+            status = _tileCache->addTile(data, dataSize, DT_COMPRESSEDTILE_FREE_DATA, 0);
+            if (dtStatusFailed(status))
+            {
+                ERR_PRINT(String("DTNavMesh: rebuildAreaVolumes: Unable to add tile: {0}").format(Array::make(status)));
+                dtFree(data);
+            }
+            numRebuiltLayers++;
+        }
+
+        // Also picks up off-mesh connections added to or removed from this column
+        dtStatus status = _tileCache->buildNavMeshTilesAt(x, z, _navMesh);
+        if (dtStatusFailed(status))
+        {
+            ERR_PRINT(String("DTNavMesh: rebuildAreaVolumes: Could not build nav mesh tiles at {0} {1}: {2}").format(Array::make(x, z, status)));
+        }
+        rebuiltTiles.push_back(tilePos);
+        _unsavedTiles.insert(tilePos);
+    }
+    releaseWorkspace(workspace);
+
+    refreshObstacles(obstacles, rebuiltTiles);
+    Godot::print(String("DTNavMesh: re-marked {0} layers in {1} tiles for changed areas").format(Array::make(numRebuiltLayers, (int)rebuiltTiles.size())));
+}
+
+void
+DetourNavigationMesh::enableAreaVolumes()
+{
+    _areaVolumes = true;
+}
+
+bool
+DetourNavigationMesh::markAreaVolumes(dtTileCacheLayer& layer)
+{
+    bool changed = false;
+    ConvexVolume* vols = _inputGeom->getConvexVolumes();
+    for (int i = 0; i < _inputGeom->getConvexVolumeCount(); ++i)
+    {
+        changed |= markConvexLayerArea(layer, _rcConfig->cs, _rcConfig->ch, vols[i].verts, vols[i].nverts,
+                                       vols[i].hmin, vols[i].hmax, (unsigned char)vols[i].area);
+    }
+    return changed;
+}
+
+void
+DetourNavigationMesh::storeUnmarkedLayer(int tileX, int tileZ, int layer, const unsigned char* data, int dataSize)
+{
+    std::lock_guard<std::mutex> lock(*_unmarkedLayersMutex);
+    if (!data)
+    {
+        _unmarkedLayers.erase(std::make_tuple(tileX, tileZ, layer));
+        return;
+    }
+    _unmarkedLayers[std::make_tuple(tileX, tileZ, layer)].assign(data, data + dataSize);
+}
+
+void
+DetourNavigationMesh::clearUnmarkedLayers(int tileX, int tileZ)
+{
+    std::lock_guard<std::mutex> lock(*_unmarkedLayersMutex);
+    auto it = _unmarkedLayers.lower_bound(std::make_tuple(tileX, tileZ, INT_MIN));
+    while (it != _unmarkedLayers.end() && std::get<0>(it->first) == tileX && std::get<1>(it->first) == tileZ)
+    {
+        it = _unmarkedLayers.erase(it);
+    }
+}
+
+void
+DetourNavigationMesh::removeTileColumn(int tileX, int tileZ)
+{
+    dtCompressedTileRef tileRefs[128];
+    int numLayers = _tileCache->getTilesAt(tileX, tileZ, tileRefs, 128);
+    for (int i = 0; i < numLayers; ++i)
+    {
+        if (_layerCache)
+        {
+            _layerCache->invalidate(tileRefs[i]);
+        }
+        _tileCache->removeTile(tileRefs[i], 0, 0);
+    }
+    const dtMeshTile* meshTiles[128];
+    dtTileRef meshTileRefs[128];
+    int numMeshTiles = _navMesh->getTilesAt(tileX, tileZ, meshTiles, 128);
+    for (int i = 0; i < numMeshTiles; ++i)
+    {
+        meshTileRefs[i] = _navMesh->getTileRef(meshTiles[i]);
+    }
+    for (int i = 0; i < numMeshTiles; ++i)
+    {
+        _navMesh->removeTile(meshTileRefs[i], 0, 0);
+    }
+}
+
+void
+DetourNavigationMesh::cancelLazyBuild()
+{
+    _lazyBuildCancelled = true;
+}
+
+const rcConfig*
+DetourNavigationMesh::getRecastConfig() const
+{
+    return _rcConfig;
+}
+
+size_t
+DetourNavigationMesh::getAreaCacheSize()
+{
+    return _areaCache ? _areaCache->getSize() : 0;
+}
+
+std::vector<CompressionBenchmark>
+DetourNavigationMesh::benchmarkCompression()
+{
+    std::vector<CompressionBenchmark> results;
+    if (!_tileCache)
+    {
+        return results;
+    }
+
+    // Decompress the layers of all tiles once, they are what every compression gets to work on
+    std::vector<std::vector<unsigned char> > layers;
+    for (int i = 0; i < _tileCache->getTileCount(); ++i)
+    {
+        const dtCompressedTile* tile = _tileCache->getTile(i);
+        if (!tile || !tile->header || !tile->compressed)
+        {
+            continue;
+        }
+
+        std::vector<unsigned char> layer(tile->header->width * tile->header->height * 3);
+        int layerSize = 0;
+        dtStatus status = _compressor->decompress(tile->compressed, tile->compressedSize, layer.data(), layer.size(), &layerSize);
+        if (dtStatusFailed(status) || layerSize != layer.size())
+        {
+            ERR_PRINT(String("DTNavMesh::benchmarkCompression: Unable to decompress tile {0}").format(Array::make(i)));
+            continue;
+        }
+        layers.push_back(std::move(layer));
+    }
+
+    // Time all tiles at once, single layers are too small to time
+    std::vector<std::vector<unsigned char> > compressed(layers.size());
+    std::vector<unsigned char> decompressed;
+    for (int i = 0; i < NUM_TILE_COMPRESSIONS; ++i)
+    {
+        dtTileCacheCompressor* compressor = createTileCompressor(i);
+        CompressionBenchmark result(i);
+        bool failed = false;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < layers.size() && !failed; ++j)
+        {
+            compressed[j].resize(compressor->maxCompressedSize(layers[j].size()));
+            int compressedSize = 0;
+            dtStatus status = compressor->compress(layers[j].data(), layers[j].size(), compressed[j].data(), compressed[j].size(), &compressedSize);
+            failed = dtStatusFailed(status);
+            compressed[j].resize(compressedSize);
+        }
+        auto compressedTime = std::chrono::steady_clock::now();
+        for (int j = 0; j < layers.size() && !failed; ++j)
+        {
+            decompressed.resize(layers[j].size());
+            int decompressedSize = 0;
+            dtStatus status = compressor->decompress(compressed[j].data(), compressed[j].size(), decompressed.data(), decompressed.size(), &decompressedSize);
+            failed = dtStatusFailed(status) || decompressedSize != layers[j].size();
+        }
+        auto decompressedTime = std::chrono::steady_clock::now();
+        delete compressor;
+
+        if (failed)
+        {
+            ERR_PRINT(String("DTNavMesh::benchmarkCompression: {0} failed").format(Array::make(getTileCompressionName(i))));
+            continue;
+        }
+        result.tiles = layers.size();
+        for (int j = 0; j < layers.size(); ++j)
+        {
+            result.rawBytes += layers[j].size();
+            result.compressedBytes += compressed[j].size();
+        }
+        result.compressUsec = std::chrono::duration_cast<std::chrono::microseconds>(compressedTime - start).count();
+        result.decompressUsec = std::chrono::duration_cast<std::chrono::microseconds>(decompressedTime - compressedTime).count();
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+void
+DetourNavigationMesh::getLayerCacheStats(size_t& size, int& hits, int& misses)
+{
+    size = 0;
+    hits = 0;
+    misses = 0;
+    if (_layerCache)
+    {
+        size = _layerCache->getSize();
+        _layerCache->getHitsAndMisses(hits, misses);
+    }
+}
+
+AllocatorStats
+DetourNavigationMesh::getAllocatorStats()
+{
+    // Workspaces in use are written to by their tasks, so only the free ones can be read
+    AllocatorStats stats = _allocator->stats;
+    std::lock_guard<std::mutex> lock(*_workspaceMutex);
+    for (int i = 0; i < _freeWorkspaces.size(); ++i)
+    {
+        stats.add(_freeWorkspaces[i]->allocator.stats);
+    }
+    return stats;
+}
+
+void
+DetourNavigationMesh::collectBuildProfile(RecastContext& target)
+{
+    std::lock_guard<std::mutex> lock(*_workspaceMutex);
+    for (int i = 0; i < _freeWorkspaces.size(); ++i)
+    {
+        target.mergeProfile(_freeWorkspaces[i]->context);
+    }
+}
+
+void
+DetourNavigationMesh::resetBuildProfile()
+{
+    // Workspaces in use are reset by whoever releases them
+    std::lock_guard<std::mutex> lock(*_workspaceMutex);
+    for (int i = 0; i < _workspaces.size(); ++i)
+    {
+        _workspaces[i]->resetProfileOnRelease = true;
+    }
+    for (int i = 0; i < _freeWorkspaces.size(); ++i)
+    {
+        _freeWorkspaces[i]->context.resetProfile();
+        _freeWorkspaces[i]->resetProfileOnRelease = false;
+    }
+}
+
+TileBuildWorkspace*
+DetourNavigationMesh::acquireWorkspace()
+{
+    std::lock_guard<std::mutex> lock(*_workspaceMutex);
+    if (_freeWorkspaces.empty())
+    {
+        TileBuildWorkspace* workspace = new TileBuildWorkspace(_maxLayers * 1000, _maxLayers, _compressor);
+        _workspaces.push_back(workspace);
+        return workspace;
+    }
+
+    TileBuildWorkspace* workspace = _freeWorkspaces.back();
+    _freeWorkspaces.pop_back();
+    return workspace;
+}
+
+void
+DetourNavigationMesh::releaseWorkspace(TileBuildWorkspace* workspace)
+{
+    std::lock_guard<std::mutex> lock(*_workspaceMutex);
+    if (workspace->resetProfileOnRelease)
+    {
+        workspace->context.resetProfile();
+        workspace->resetProfileOnRelease = false;
+    }
+    _freeWorkspaces.push_back(workspace);
+}
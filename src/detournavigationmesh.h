@@ -4,6 +4,10 @@
 #include <Godot.hpp>
 #include <Vector2.hpp>
 #include <vector>
+#include <map>
+#include <set>
+#include <tuple>
+#include <atomic>
 #include "detourcrowdagent.h"
 
 class DetourInputGeometry;
@@ -17,8 +21,29 @@ class GodotDetourDebugDraw;
 struct MeshProcess;
 struct rcConfig;
 struct LinearAllocator;
-struct FastLZCompressor;
+struct AllocatorStats;
+struct dtTileCacheCompressor;
+struct CompressionBenchmark;
 struct TileCacheData;
+struct TileBuildWorkspace;
+struct RasterizationContext;
+struct LazyTile;
+struct SavedRegion;
+class SaveBuffer;
+class MappedFile;
+struct BuildProgress;
+class ThreadPool;
+class HeightfieldCache;
+class CompactHeightfieldCache;
+class DecompressedLayerCache;
+struct rcHeightfield;
+struct dtTileCacheLayer;
+typedef unsigned int dtCompressedTileRef;
+
+namespace std
+{
+    class mutex;
+}
 
 namespace godot
 {
@@ -61,6 +86,10 @@ namespace godot
         int         layersPerTile;          // How many vertical layers a single tile is expected to have. Should be less for "flat" levels, more for something like tall, multi-floored buildings.
         float       detailSampleDistance;   // The sampling distance to use when generating the detail mesh. [wu]
         float       detailSampleMaxError;   // The maximum allowed distance the detail mesh should deviate from the source data. [wu]
+        int         areaCacheSize;          // Bytes of compressed compact heightfields to keep, so marking areas does not need to rasterize the tiles again. 0 disables the cache.
+        int         tileCompression;        // How the tile cache layers are compressed: 0 = none (fastest rebuilds), 1 = FastLZ level 1, 2 = FastLZ level 2 (least memory), 3 = LZ4 (fastest decompression).
+        int         layerCacheSize;         // Bytes of decompressed tile cache layers to keep, so tiles rebuilt for obstacles again and again skip decompression. 0 disables the cache.
+        bool        saveNavMeshTiles;       // Whether saving stores the built navmesh tiles as well, so loading does not need to build them again. Larger files, much faster loading.
     };
 
     // Helper struct to store convex volume data
@@ -116,23 +145,189 @@ namespace godot
          * @param inputGeom     The input geometry.
          * @param params        The parameters for setting up this navigation mesh + crowd.
          * @param maxObstacles  The maximum amount of obstacles supported.
+         * @param threadPool    The pool to spread the rasterization and building of the tiles over.
+         * @param queueDepth    How many tiles may be in the build pipeline at once. <= 0 means four per thread of the pool.
+         * @param progress      Where to report each built tile to. Can be nullptr.
          * @return True if everything was successful. False otherwise.
          */
-        bool initialize(DetourInputGeometry* inputGeom, Ref<DetourNavigationMeshParameters> params, int maxObstacles, RecastContext* recastContext, int index);
+        bool initialize(DetourInputGeometry* inputGeom, Ref<DetourNavigationMeshParameters> params, int maxObstacles, RecastContext* recastContext, int index, ThreadPool* threadPool, int queueDepth, BuildProgress* progress);
+
+        /**
+         * @brief Lets this navmesh share its rasterized heightfields with other navmeshes using the same voxel settings.
+         *          Has to be called before initialize.
+         * @param cache                 The cache shared by all those navmeshes.
+         * @param borderSize            The border size all of those navmeshes use. [vx]
+         * @param rasterizationClimb    The walkable climb used for rasterizing the shared heightfields, the smallest of those navmeshes. [vx]
+         */
+        void setHeightfieldCache(HeightfieldCache* cache, int borderSize, int rasterizationClimb);
+
+        /**
+         * @brief Returns the combined statistics of the tile cache's allocator and those of all build workspaces not in use right now.
+         */
+        AllocatorStats getAllocatorStats();
+
+        /**
+         * @brief Returns how many bytes the cached compact heightfields currently use.
+         */
+        size_t getAreaCacheSize();
+
+        /**
+         * @brief Returns how many bytes the cached decompressed layers currently use and how often the cache was hit and missed.
+         */
+        void getLayerCacheStats(size_t& size, int& hits, int& misses);
+
+        /**
+         * @brief Compresses and decompresses the layers of all tiles with every supported tile compression.
+         *          Expects the navigation to be locked.
+         * @return One result per TileCompression.
+         */
+        std::vector<CompressionBenchmark> benchmarkCompression();
+
+        /**
+         * @brief Adds the timings and log messages of all tiles built by this navmesh to the target context.
+         *          Workspaces still building a tile are skipped.
+         */
+        void collectBuildProfile(RecastContext& target);
+
+        /**
+         * @brief Clears the timings and log messages of all tiles built by this navmesh.
+         */
+        void resetBuildProfile();
+
+        /**
+         * @brief Rebuilds all tile columns touched by geometry that was added or removed.
+         *          With lazy building, only tiles already built are rebuilt, the others pick up the new geometry once they are built.
+         * @param changedBounds The bounds of the changed geometry, 6 floats (min xyz, max xyz) per change.
+         * @param obstacles     The obstacles to re-add to the rebuilt tiles.
+         */
+        void rebuildGeometryTiles(const std::vector<float>& changedBounds, const std::vector<Ref<DetourObstacle> >& obstacles);
+
+        /**
+         * @brief Applies the marked convex areas to the layers of the tile columns touched by the passed bounds instead of
+         *          rasterizing those tiles again. Only used with area volumes, see enableAreaVolumes().
+         *          Also rebuilds the navmesh tiles of those columns, so off-mesh connections within the bounds are picked up.
+         * @param changedBounds The bounds of the added and removed areas and connections, 6 floats (min xyz, max xyz) per change.
+         * @param obstacles     The obstacles to re-add to the rebuilt tiles.
+         */
+        void rebuildAreaVolumes(const std::vector<float>& changedBounds, const std::vector<Ref<DetourObstacle> >& obstacles);
+
+        /**
+         * @brief Marks convex areas on the compressed tile cache layers instead of the compact heightfield, like obstacles.
+         *          Marking or removing an area then only costs rebuilding the affected layers, see rebuildAreaVolumes().
+         *          Has to be called before initialize. Loading restores whatever the saved navmesh used.
+         */
+        void enableAreaVolumes();
+
+        /**
+         * @brief Returns true if convex areas are marked on the tile cache layers.
+         */
+        bool hasAreaVolumes() const;
+
+        /**
+         * @brief Stops sharing heightfields, e.g. because tiles will be built independently from the other navmeshes from now on.
+         *          Keeps the border size and climb, so new tiles still match the existing ones.
+         */
+        void detachHeightfieldCache();
+
+        /**
+         * @brief Only builds the tiles within the radius of the passed positions in initialize, the others are built
+         *          on demand via requestTilesAround(). Has to be called before initialize (or after load).
+         * @param radius            The radius around agents and activity anchors within which tiles are built.
+         * @param initialPositions  The positions to build the tiles around in initialize.
+         */
+        void enableLazyBuild(float radius, const std::vector<Vector3>& initialPositions);
+
+        /**
+         * @brief Returns true if tiles are built on demand.
+         */
+        bool isLazyBuild() const;
+
+        /**
+         * @brief Marks all tiles within the lazy build radius of the position that aren't built yet as queued and adds them to tilesToBuild.
+         *          Expects the navigation to be locked.
+         */
+        void requestTilesAround(const Vector3& position, std::vector<std::pair<int, int> >& tilesToBuild);
+
+        /**
+         * @brief Rasterizes the layers of a tile requested via requestTilesAround(). Called from a build worker.
+         *          The result is only added to the navmesh in addLazyTiles().
+         */
+        void rasterizeLazyTile(int tileX, int tileZ);
+
+        /**
+         * @brief Adds all tiles rasterized since the last call to the tile cache and builds their navmesh tiles.
+         *          Obstacles overlapping the new tiles are re-added, so they affect those tiles as well.
+         *          Expects the navigation to be locked.
+         * @return The number of tiles added.
+         */
+        int addLazyTiles(const std::vector<Ref<DetourObstacle> >& obstacles);
+
+        /**
+         * @brief Makes all lazy tile rasterizations still queued return right away.
+         */
+        void cancelLazyBuild();
+
+        /**
+         * @brief Returns the recast config this navmesh was built with.
+         */
+        const rcConfig* getRecastConfig() const;
 
         /**
          * @brief Will save this navmesh's current state to the passed file.
          * @param targetFile The file to append data to.
          * @return True if everything worked out, false otherwise.
          */
-        bool save(Ref<godot::File> targetFile);
+        bool save(SaveBuffer* targetFile);
 
         /**
          * @brief Loads and initializes the navmesh from the file.
          * @param sourceFile The file to read data from.
+         * @param progress   Where to report each loaded tile to. Can be nullptr.
+         * @param mappedFile The source file mapped into memory. If not nullptr, tiles point right into it instead of being copied,
+         *                   so it has to outlive this navmesh. Can be nullptr.
+         * @param useSavedNavMeshTiles  If false, saved navmesh tiles are skipped and built from the layers instead.
+         * @param threadPool The pool to build the navmesh tiles with, in parallel once all tiles are read. Can be nullptr.
+         * @param loadRegionsLazily If true, no tiles are loaded yet. Each tile column is read from the file once it is requested
+         *                          via requestTilesAround() instead, see enableLazyBuild(). Needs an uncompressed file on disk.
+         *                          Files saved before the region index existed are loaded completely.
+         * @return True if everything worked out, false otherwise.
+         */
+        bool load(DetourInputGeometry* inputGeom, RecastContext* recastContext, Ref<godot::File> sourceFile, BuildProgress* progress,
+                  const MappedFile* mappedFile, bool useSavedNavMeshTiles, ThreadPool* threadPool, bool loadRegionsLazily);
+
+        /**
+         * @brief Reads the tile columns still in the save file into memory, so save() can copy them
+         *          without reading from the file while the navigation is locked.
+         */
+        void readSavedRegions();
+
+        /**
+         * @brief Forgets the saved tile columns touched by the passed bounds, so they are rasterized with the changed geometry
+         *          or areas once they are needed instead of being read from the file.
+         * @param bounds The bounds of the changes, 6 floats (min xyz, max xyz) per change.
+         */
+        void forgetSavedRegions(const std::vector<float>& bounds);
+
+        /**
+         * @brief Queues all saved tile columns not loaded yet, e.g. before the file they are read from is replaced.
+         *          Forgets those that will never be read. Expects the navigation to be locked and no lazy tiles to be pending.
+         * @param tilesToBuild  Receives the columns to read with rasterizeLazyTile().
+         */
+        void requestRemainingRegions(std::vector<std::pair<int, int> >& tilesToBuild);
+
+        /**
+         * @brief Saves the layers of all tile columns rebuilt since the last save() or saveChangedTiles(), for incremental saves.
+         * @param targetFile The file to append data to.
+         * @return True if everything worked out, false otherwise.
+         */
+        bool saveChangedTiles(SaveBuffer* targetFile);
+
+        /**
+         * @brief Replaces the tile columns saved by saveChangedTiles() and builds their navmesh tiles.
+         * @param sourceFile The file to read data from.
          * @return True if everything worked out, false otherwise.
          */
-        bool load(DetourInputGeometry* inputGeom, RecastContext* recastContext, Ref<godot::File> sourceFile);
+        bool loadChangedTiles(Ref<godot::File> sourceFile);
 
         /**
          * @brief Rebuilds all tiles that have changed (by marking areas).
@@ -187,8 +382,90 @@ namespace godot
 
         /**
          * @brief Rasterize all layers of this tile, preparing them to be in the tile cache.
+         *          Only uses the passed workspace, so it can be called from multiple threads at once.
          */
-        int rasterizeTileLayers(const int tileX, const int tileZ, const rcConfig& cfg, TileCacheData* tiles, const int maxTiles);
+        int rasterizeTileLayers(const int tileX, const int tileZ, const rcConfig& cfg, TileCacheData* tiles, const int maxTiles, TileBuildWorkspace* workspace);
+
+        /**
+         * @brief Rasterizes and filters the input geometry of the tile into the compact heightfield of the rasterization context
+         *          and erodes it by the agent radius. Everything up to marking the areas.
+         */
+        bool buildErodedHeightfield(const int tileX, const int tileZ, const rcConfig& tcfg, RecastContext* context, RasterizationContext& rc);
+
+        /**
+         * @brief Creates the solid heightfield for the tile and rasterizes the input geometry into it.
+         * @return False if there was nothing to rasterize or an error occurred.
+         */
+        bool rasterizeTileHeightfield(const rcConfig& tcfg, RecastContext* context, rcHeightfield& solid);
+
+        /**
+         * @brief Marks all convex areas on the layer.
+         * @return True if the area of any cell changed.
+         */
+        bool markAreaVolumes(dtTileCacheLayer& layer);
+
+        /**
+         * @brief Remembers the compressed layer as it was before marking the convex areas, so the areas can be marked again
+         *          later on without rasterizing the tile. Passing no data forgets the layer, e.g. because no area touches it.
+         */
+        void storeUnmarkedLayer(int tileX, int tileZ, int layer, const unsigned char* data, int dataSize);
+
+        /**
+         * @brief Forgets the unmarked layers of the tile column, e.g. because it is rasterized again.
+         */
+        void clearUnmarkedLayers(int tileX, int tileZ);
+
+        /**
+         * @brief Builds the navmesh tiles of the loaded tile cache layers (by compressed tile ref) across the thread pool and adds them in order.
+         */
+        bool buildLoadedTiles(const std::vector<dtCompressedTileRef>& refs, ThreadPool* threadPool, BuildProgress* progress);
+
+        /**
+         * @brief Reads the layers of the saved tile column from the file and forgets about it.
+         * @return False if the column is not in the file (anymore) or could not be read.
+         */
+        bool loadSavedRegion(int tileX, int tileZ, std::vector<TileCacheData>& layers);
+
+        /**
+         * @brief Removes all layers and navmesh tiles of the tile column.
+         */
+        void removeTileColumn(int tileX, int tileZ);
+
+        /**
+         * @brief Collects the tile columns touched by the passed bounds, including the border rasterized around each tile.
+         *          With lazy building, tiles not built yet are skipped.
+         */
+        void collectTileColumns(const std::vector<float>& bounds, std::set<std::pair<int, int> >& tiles) const;
+
+        /**
+         * @brief Returns a workspace not currently used by any other thread, creating one if necessary.
+         */
+        TileBuildWorkspace* acquireWorkspace();
+
+        /**
+         * @brief Gives the workspace back for other threads to use.
+         */
+        void releaseWorkspace(TileBuildWorkspace* workspace);
+
+        /**
+         * @brief Returns the range of tile columns within the lazy build radius of the position. False if it is outside of the navmesh.
+         */
+        bool getTilesAround(const Vector3& position, int& minX, int& minZ, int& maxX, int& maxZ) const;
+
+        /**
+         * @brief Returns true if the XZ bounds overlap the tile column.
+         */
+        bool overlapsTile(const float* bmin, const float* bmax, int tileX, int tileZ) const;
+
+        /**
+         * @brief Re-adds the obstacles overlapping the passed tile columns, as obstacles only affect the tiles present when they were added.
+         */
+        void refreshObstacles(const std::vector<Ref<DetourObstacle> >& obstacles, const std::vector<std::pair<int, int> >& tiles);
+
+        /**
+         * @brief Updates the tile cache until all obstacle requests are processed and all touched tiles are rebuilt.
+         */
+        void updateTileCache();
 
         /**
          * @brief Draws the tiles using the passed debug drawer.
@@ -208,7 +485,7 @@ namespace godot
         dtNavMeshQuery*         _navQuery;
         dtCrowd*                _crowd;
         LinearAllocator*        _allocator;
-        FastLZCompressor*       _compressor;
+        dtTileCacheCompressor*  _compressor;
         MeshProcess*            _meshProcess;
         DetourInputGeometry*    _inputGeom;
 
@@ -230,10 +507,56 @@ namespace godot
 
         std::map<int, ChangedTileLayers> _affectedTilesByVolume;
         std::map<int, ChangedTileLayers> _affectedTilesByConnection;
+
+        std::vector<TileBuildWorkspace*>    _workspaces;
+        std::vector<TileBuildWorkspace*>    _freeWorkspaces;
+        std::mutex*                         _workspaceMutex;
+
+        HeightfieldCache*   _heightfieldCache;
+        int                 _sharedBorderSize;
+        int                 _rasterizationClimb;
+
+        int                         _areaCacheSize;
+        CompactHeightfieldCache*    _areaCache;
+
+        int                         _tileCompression;
+        int                         _layerCacheSize;
+        DecompressedLayerCache*     _layerCache;
+        bool                        _saveNavMeshTiles;
+
+        bool                        _areaVolumes;
+        std::map<std::tuple<int, int, int>, std::vector<unsigned char> > _unmarkedLayers;    // Compressed layers before marking areas, by tile x, z & layer
+        std::mutex*                 _unmarkedLayersMutex;
+
+        int                         _tilesX;
+        int                         _tilesZ;
+        std::vector<unsigned char>  _tileStates;
+        std::set<std::pair<int, int> >  _unsavedTiles;  // Tile columns rebuilt since the last save, by tile x & z
+        float                       _lazyBuildRadius;
+        std::vector<Vector3>        _lazyInitialPositions;
+        std::vector<LazyTile*>      _lazyTiles;
+        std::mutex*                 _lazyTileMutex;
+        std::atomic_bool            _lazyBuildCancelled;
+
+        std::map<std::pair<int, int>, SavedRegion*> _savedRegions;  // Tile columns not loaded from the file yet, by tile x & z
+        Ref<godot::File>            _regionFile;
+        std::mutex*                 _regionFileMutex;
     };
 
 
     // INLINES
+    inline bool
+    DetourNavigationMesh::isLazyBuild() const
+    {
+        return _lazyBuildRadius > 0.0f;
+    }
+
+    inline bool
+    DetourNavigationMesh::hasAreaVolumes() const
+    {
+        return _areaVolumes;
+    }
+
     inline dtCrowd*
     DetourNavigationMesh::getCrowd()
     {
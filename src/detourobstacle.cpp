@@ -3,6 +3,7 @@
 #include <QuadMesh.hpp>
 #include <File.hpp>
 #include <DetourTileCache.h>
+#include "util/savebuffer.h"
 
 using namespace godot;
 
@@ -45,7 +46,7 @@ DetourObstacle::initialize(DetourObstacleType type, const Vector3& position, con
 }
 
 bool
-DetourObstacle::save(Ref<File> targetFile)
+DetourObstacle::save(SaveBuffer* targetFile)
 {
     // Version
     targetFile->store_16(OBSTACLE_SAVE_VERSION);
@@ -137,6 +138,30 @@ DetourObstacle::addReference(unsigned int ref, dtTileCache* cache)
     _references[cache] = ref;
 }
 
+unsigned int
+DetourObstacle::getReference(dtTileCache* cache) const
+{
+    auto it = _references.find(cache);
+    if (it == _references.end())
+    {
+        return 0;
+    }
+    return it->second;
+}
+
+void
+DetourObstacle::recreate(dtTileCache* cache)
+{
+    auto it = _references.find(cache);
+    if (it == _references.end() || _destroyed)
+    {
+        return;
+    }
+
+    cache->removeObstacle(it->second);
+    createDetourObstacle(cache);
+}
+
 void
 DetourObstacle::move(Vector3 position)
 {
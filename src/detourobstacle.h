@@ -6,6 +6,7 @@
 #include <vector>
 
 class dtTileCache;
+class SaveBuffer;
 
 // Obstacle types
 enum DetourObstacleType
@@ -60,7 +61,7 @@ namespace godot
          * @param targetFile The file to append data to.
          * @return True if everything worked out, false otherwise.
          */
-        bool save(Ref<File> targetFile);
+        bool save(SaveBuffer* targetFile);
 
         /**
          * @brief Loads the obstacle from the file.
@@ -79,6 +80,16 @@ namespace godot
          */
         void addReference(unsigned int ref, dtTileCache* cache);
 
+        /**
+         * @brief Returns the reference of the obstacle in the passed tile cache. 0 if it wasn't added to it.
+         */
+        unsigned int getReference(dtTileCache* cache) const;
+
+        /**
+         * @brief Removes the obstacle from the passed tile cache and adds it again, e.g. to affect tiles added to the cache since.
+         */
+        void recreate(dtTileCache* cache);
+
         /**
          * @brief Move this obstacle to a new position.
          */
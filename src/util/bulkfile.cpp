@@ -0,0 +1,69 @@
+#include "bulkfile.h"
+#include <PoolArrays.hpp>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+using namespace godot;
+
+static bool
+isBigEndian()
+{
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one == 0;
+}
+
+static void
+swapWords(uint8_t* data, size_t bytes, size_t wordSize)
+{
+    if (wordSize < 2 || !isBigEndian())
+    {
+        return;
+    }
+    for (size_t i = 0; i + wordSize <= bytes; i += wordSize)
+    {
+        std::reverse(data + i, data + i + wordSize);
+    }
+}
+
+void storeBlock(SaveBuffer* file, const void* data, size_t bytes, size_t wordSize)
+{
+    if (bytes == 0)
+    {
+        return;
+    }
+
+    uint8_t* pos = file->append(bytes);
+    memcpy(pos, data, bytes);
+    swapWords(pos, bytes, wordSize);
+}
+
+bool loadBlock(Ref<File> file, void* data, size_t bytes, size_t wordSize)
+{
+    if (bytes == 0)
+    {
+        return true;
+    }
+
+    PoolByteArray array = file->get_buffer(bytes);
+    if (array.size() != bytes)
+    {
+        ERR_PRINT(String("Unexpected end of file, expected {0} more bytes but got {1}.").format(Array::make((int)bytes, array.size())));
+        return false;
+    }
+    memcpy(data, array.read().ptr(), bytes);
+    swapWords((uint8_t*)data, bytes, wordSize);
+    return true;
+}
+
+uint32_t computeChecksum(const void* data, size_t bytes)
+{
+    const uint8_t* pos = (const uint8_t*)data;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < bytes; ++i)
+    {
+        hash ^= pos[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,61 @@
+#ifndef BULKFILE_H
+#define BULKFILE_H
+
+#include <Godot.hpp>
+#include <File.hpp>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "savebuffer.h"
+
+// Helpers to save and load whole arrays as one block each, instead of one call per element.
+// Numbers in blocks are stored little-endian, like everything else File writes by default.
+// Blocks with a word size of 1 (e.g. tile cache layers and navmesh tiles) are written as they are in memory,
+// so the recast and detour structures inside them keep the machine's byte order.
+
+/**
+ * @brief Writes the data as one block. Every wordSize bytes are one number, swapped on big-endian machines.
+ */
+void storeBlock(SaveBuffer* file, const void* data, size_t bytes, size_t wordSize);
+
+/**
+ * @brief Reads a block written by storeBlock() into data.
+ * @return False if the file ended before the block did.
+ */
+bool loadBlock(godot::Ref<godot::File> file, void* data, size_t bytes, size_t wordSize);
+
+/**
+ * @brief Returns the FNV-1a hash of the data, to detect blocks damaged on disk.
+ */
+uint32_t computeChecksum(const void* data, size_t bytes);
+
+/**
+ * @brief Writes the number of elements followed by all elements as one block.
+ */
+template<typename T>
+void storeArray(SaveBuffer* file, const std::vector<T>& data)
+{
+    file->store_32(data.size());
+    storeBlock(file, data.data(), data.size() * sizeof(T), sizeof(T));
+}
+
+/**
+ * @brief Reads an array written by storeArray(), replacing the content of data.
+ * @return False if the file ended before the array did.
+ */
+template<typename T>
+bool loadArray(godot::Ref<godot::File> file, std::vector<T>& data)
+{
+    // Don't trust a damaged count with the allocation, the array can't be larger than the rest of the file
+    const int64_t count = file->get_32();
+    const int64_t remainingBytes = file->get_len() - file->get_position();
+    if (count > remainingBytes / (int64_t)sizeof(T))
+    {
+        ERR_PRINT(godot::String("Unexpected end of file, array of {0} elements does not fit the remaining {1} bytes.").format(godot::Array::make(count, remainingBytes)));
+        return false;
+    }
+    data.resize(count);
+    return loadBlock(file, data.data(), data.size() * sizeof(T), sizeof(T));
+}
+
+#endif // BULKFILE_H
@@ -0,0 +1,164 @@
+#include "compactheightfieldcache.h"
+#include <Recast.h>
+#include <DetourTileCache.h>
+#include <cstring>
+#include <cfloat>
+#include "navigationmeshhelpers.h"
+
+// Everything of rcCompactHeightfield needed to mark areas and build layers, followed by the cells, spans and areas
+struct CachedHeightfieldHeader
+{
+    int     width;
+    int     height;
+    int     spanCount;
+    int     walkableHeight;
+    int     walkableClimb;
+    int     borderSize;
+    float   bmin[3];
+    float   bmax[3];
+    float   cs;
+    float   ch;
+};
+
+CompactHeightfieldCache::CompactHeightfieldCache(size_t budget)
+    : _compressor(new FastLZCompressor(1))
+    , _entries(budget)
+{
+}
+
+CompactHeightfieldCache::~CompactHeightfieldCache()
+{
+    delete _compressor;
+}
+
+void
+CompactHeightfieldCache::store(int tileX, int tileZ, float minY, float maxY, const rcCompactHeightfield& chf)
+{
+    // Serialize
+    CachedHeightfieldHeader header;
+    header.width = chf.width;
+    header.height = chf.height;
+    header.spanCount = chf.spanCount;
+    header.walkableHeight = chf.walkableHeight;
+    header.walkableClimb = chf.walkableClimb;
+    header.borderSize = chf.borderSize;
+    rcVcopy(header.bmin, chf.bmin);
+    rcVcopy(header.bmax, chf.bmax);
+    header.cs = chf.cs;
+    header.ch = chf.ch;
+
+    const size_t cellsSize = sizeof(rcCompactCell) * chf.width * chf.height;
+    const size_t spansSize = sizeof(rcCompactSpan) * chf.spanCount;
+    const size_t areasSize = sizeof(unsigned char) * chf.spanCount;
+    std::vector<unsigned char> raw(sizeof(header) + cellsSize + spansSize + areasSize);
+    unsigned char* pos = raw.data();
+    memcpy(pos, &header, sizeof(header));
+    pos += sizeof(header);
+    memcpy(pos, chf.cells, cellsSize);
+    pos += cellsSize;
+    memcpy(pos, chf.spans, spansSize);
+    pos += spansSize;
+    memcpy(pos, chf.areas, areasSize);
+
+    // Compress outside of the lock
+    CompressedHeightfield compressed;
+    compressed.rawSize = (int)raw.size();
+    compressed.data.resize(_compressor->maxCompressedSize((int)raw.size()));
+    int compressedSize = 0;
+    dtStatus status = _compressor->compress(raw.data(), (int)raw.size(), compressed.data.data(), (int)compressed.data.size(), &compressedSize);
+    std::tuple<int, int, float, float> key = std::make_tuple(tileX, tileZ, minY, maxY);
+    if (dtStatusFailed(status))
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _entries.remove(key);
+        return;
+    }
+    compressed.data.resize(compressedSize);
+    compressed.data.shrink_to_fit();
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.put(key, std::move(compressed), (size_t)compressedSize);
+}
+
+bool
+CompactHeightfieldCache::restore(rcContext* context, int tileX, int tileZ, float minY, float maxY, RasterizationContext& rc)
+{
+    std::tuple<int, int, float, float> key = std::make_tuple(tileX, tileZ, minY, maxY);
+    std::unique_lock<std::mutex> lock(_mutex);
+    const CompressedHeightfield* cached = _entries.get(key);
+    if (!cached)
+    {
+        return false;
+    }
+
+    // Decompress without holding the lock
+    std::vector<unsigned char> compressed = cached->data;
+    int rawSize = cached->rawSize;
+    lock.unlock();
+
+    std::vector<unsigned char> raw(rawSize);
+    int decompressedSize = 0;
+    dtStatus status = _compressor->decompress(compressed.data(), (int)compressed.size(), raw.data(), rawSize, &decompressedSize);
+    if (dtStatusFailed(status) || decompressedSize != rawSize)
+    {
+        context->log(RC_LOG_ERROR, "CompactHeightfieldCache: Unable to decompress tile %d, %d.", tileX, tileZ);
+        lock.lock();
+        _entries.remove(key);
+        return false;
+    }
+
+    // Deserialize
+    CachedHeightfieldHeader header;
+    const unsigned char* pos = raw.data();
+    memcpy(&header, pos, sizeof(header));
+    pos += sizeof(header);
+    if (!rc.reserveCompactHeightfield(header.width * header.height, header.spanCount))
+    {
+        context->log(RC_LOG_ERROR, "CompactHeightfieldCache: Out of memory.");
+        return false;
+    }
+
+    rcCompactHeightfield& chf = *rc.chf;
+    chf.width = header.width;
+    chf.height = header.height;
+    chf.spanCount = header.spanCount;
+    chf.walkableHeight = header.walkableHeight;
+    chf.walkableClimb = header.walkableClimb;
+    chf.borderSize = header.borderSize;
+    chf.maxDistance = 0;
+    chf.maxRegions = 0;
+    rcVcopy(chf.bmin, header.bmin);
+    rcVcopy(chf.bmax, header.bmax);
+    chf.cs = header.cs;
+    chf.ch = header.ch;
+
+    const size_t cellsSize = sizeof(rcCompactCell) * header.width * header.height;
+    const size_t spansSize = sizeof(rcCompactSpan) * header.spanCount;
+    memcpy(chf.cells, pos, cellsSize);
+    pos += cellsSize;
+    memcpy(chf.spans, pos, spansSize);
+    pos += spansSize;
+    memcpy(chf.areas, pos, header.spanCount);
+    return true;
+}
+
+void
+CompactHeightfieldCache::invalidate(int tileX, int tileZ)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.removeRange(std::make_tuple(tileX, tileZ, -FLT_MAX, -FLT_MAX), std::make_tuple(tileX, tileZ, FLT_MAX, FLT_MAX));
+}
+
+void
+CompactHeightfieldCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _entries.clear();
+}
+
+size_t
+CompactHeightfieldCache::getSize()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.getSize();
+}
@@ -0,0 +1,76 @@
+#ifndef COMPACTHEIGHTFIELDCACHE_H
+#define COMPACTHEIGHTFIELDCACHE_H
+
+#include <vector>
+#include <tuple>
+#include <mutex>
+#include <cstddef>
+#include "lrubytecache.h"
+
+class rcContext;
+struct rcCompactHeightfield;
+struct RasterizationContext;
+struct dtTileCacheCompressor;
+
+/**
+ * @brief Keeps the eroded compact heightfields of a navigation mesh's tiles (before any areas are marked) compressed in memory.
+ *          Rebuilding a tile because a marked area changed can then start from the area marking instead of rasterizing
+ *          and filtering the input geometry again. The least recently used tiles are dropped once the budget is exceeded.
+ *          Tiles are kept per height range, as rebuilding only some layers rasterizes just the height range of those.
+ *          Always compressed with FastLZ, independent of the tile compression, as the heightfields are far larger than the layers.
+ *          Thread-safe.
+ */
+class CompactHeightfieldCache
+{
+public:
+    /**
+     * @brief Constructor.
+     * @param budget        How many bytes of compressed heightfields may be kept.
+     */
+    CompactHeightfieldCache(size_t budget);
+
+    /**
+     * @brief Destructor.
+     */
+    ~CompactHeightfieldCache();
+
+    /**
+     * @brief Stores a compressed copy of the compact heightfield of the tile's height range, replacing the previous one.
+     */
+    void store(int tileX, int tileZ, float minY, float maxY, const rcCompactHeightfield& chf);
+
+    /**
+     * @brief Decompresses the compact heightfield of the tile's height range into the compact heightfield of the rasterization context.
+     * @return False if the tile is not cached for that height range.
+     */
+    bool restore(rcContext* context, int tileX, int tileZ, float minY, float maxY, RasterizationContext& rc);
+
+    /**
+     * @brief Drops all height ranges of the tile, e.g. because its input geometry changed.
+     */
+    void invalidate(int tileX, int tileZ);
+
+    /**
+     * @brief Drops all tiles.
+     */
+    void clear();
+
+    /**
+     * @brief Returns how many bytes are currently used.
+     */
+    size_t getSize();
+
+private:
+    struct CompressedHeightfield
+    {
+        int                         rawSize;
+        std::vector<unsigned char>  data;
+    };
+
+private:
+    dtTileCacheCompressor*  _compressor;
+    LruByteCache<std::tuple<int, int, float, float>, CompressedHeightfield> _entries;
+    std::mutex              _mutex;
+};
+
+#endif // COMPACTHEIGHTFIELDCACHE_H
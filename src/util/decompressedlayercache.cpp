@@ -0,0 +1,121 @@
+#include "decompressedlayercache.h"
+#include <cstring>
+
+DecompressedLayerCache::DecompressedLayerCache(size_t budget, dtTileCacheCompressor* compressor)
+    : _hits(0)
+    , _misses(0)
+    , _compressor(compressor)
+    , _tileCache(nullptr)
+    , _layers(budget)
+{
+}
+
+void
+DecompressedLayerCache::setTileCache(dtTileCache* tileCache)
+{
+    _tileCache = tileCache;
+    clear();
+}
+
+int
+DecompressedLayerCache::maxCompressedSize(const int bufferSize)
+{
+    return _compressor->maxCompressedSize(bufferSize);
+}
+
+dtStatus
+DecompressedLayerCache::compress(const unsigned char* buffer, const int bufferSize,
+                                 unsigned char* compressed, const int maxCompressedSize, int* compressedSize)
+{
+    return _compressor->compress(buffer, bufferSize, compressed, maxCompressedSize, compressedSize);
+}
+
+dtStatus
+DecompressedLayerCache::decompress(const unsigned char* compressed, const int compressedSize,
+                                   unsigned char* buffer, const int maxBufferSize, int* bufferSize)
+{
+    dtCompressedTileRef ref = findTile(compressed, compressedSize);
+    if (!ref)
+    {
+        return _compressor->decompress(compressed, compressedSize, buffer, maxBufferSize, bufferSize);
+    }
+
+    // Copy the cached layer, marking it as most recently used
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const std::vector<unsigned char>* layer = _layers.get(ref);
+        if (layer && (int)layer->size() <= maxBufferSize)
+        {
+            memcpy(buffer, layer->data(), layer->size());
+            *bufferSize = (int)layer->size();
+            _hits++;
+            return DT_SUCCESS;
+        }
+        _misses++;
+    }
+
+    dtStatus status = _compressor->decompress(compressed, compressedSize, buffer, maxBufferSize, bufferSize);
+    if (dtStatusFailed(status))
+    {
+        return status;
+    }
+
+    std::vector<unsigned char> layer(buffer, buffer + *bufferSize);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _layers.put(ref, std::move(layer), (size_t)*bufferSize);
+    return status;
+}
+
+void
+DecompressedLayerCache::invalidate(dtCompressedTileRef ref)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _layers.remove(ref);
+}
+
+void
+DecompressedLayerCache::clear()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _layers.clear();
+}
+
+size_t
+DecompressedLayerCache::getSize()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _layers.getSize();
+}
+
+void
+DecompressedLayerCache::getHitsAndMisses(int& hits, int& misses)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    hits = _hits;
+    misses = _misses;
+}
+
+dtCompressedTileRef
+DecompressedLayerCache::findTile(const unsigned char* compressed, const int compressedSize)
+{
+    if (!_tileCache)
+    {
+        return 0;
+    }
+
+    // The tile cache only ever decompresses its tiles' data, which is preceded by the layer header
+    const int headerSize = dtAlign4(sizeof(dtTileCacheLayerHeader));
+    const dtTileCacheLayerHeader* header = (const dtTileCacheLayerHeader*)(compressed - headerSize);
+    if (header->magic != DT_TILECACHE_MAGIC || header->version != DT_TILECACHE_VERSION)
+    {
+        return 0;
+    }
+
+    // Make sure it really is the data of that tile
+    const dtCompressedTile* tile = _tileCache->getTileAt(header->tx, header->ty, header->tlayer);
+    if (!tile || tile->compressed != compressed || tile->compressedSize != compressedSize)
+    {
+        return 0;
+    }
+    return _tileCache->getTileRef(tile);
+}
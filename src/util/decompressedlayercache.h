@@ -0,0 +1,74 @@
+#ifndef DECOMPRESSEDLAYERCACHE_H
+#define DECOMPRESSEDLAYERCACHE_H
+
+#include <DetourTileCache.h>
+#include <DetourTileCacheBuilder.h>
+#include <vector>
+#include <mutex>
+#include <cstddef>
+#include "lrubytecache.h"
+
+/**
+ * @brief Keeps the decompressed grids of the tile cache's most recently rebuilt layers, keyed by their compressed tile reference.
+ *          Obstacles added, moved or removed again and again (doors, vehicles) keep rebuilding the same tiles, which can then
+ *          skip decompressing their layers. The least recently used layers are dropped once the budget is exceeded.
+ *          dtTileCache decompresses the layers itself, so this is handed to it as its compressor and forwards everything
+ *          else to the actual one. Thread-safe.
+ */
+class DecompressedLayerCache : public dtTileCacheCompressor
+{
+public:
+    /**
+     * @brief Constructor.
+     * @param budget        How many bytes of decompressed layers may be kept.
+     * @param compressor    The compressor of the tile cache. Not owned, must outlive the cache.
+     */
+    DecompressedLayerCache(size_t budget, dtTileCacheCompressor* compressor);
+
+    /**
+     * @brief Sets the tile cache whose layers are decompressed. Buffers not belonging to its tiles are never cached.
+     */
+    void setTileCache(dtTileCache* tileCache);
+
+    virtual int maxCompressedSize(const int bufferSize);
+    virtual dtStatus compress(const unsigned char* buffer, const int bufferSize,
+                              unsigned char* compressed, const int maxCompressedSize, int* compressedSize);
+    virtual dtStatus decompress(const unsigned char* compressed, const int compressedSize,
+                                unsigned char* buffer, const int maxBufferSize, int* bufferSize);
+
+    /**
+     * @brief Drops the layer, e.g. because the tile is removed.
+     */
+    void invalidate(dtCompressedTileRef ref);
+
+    /**
+     * @brief Drops all layers.
+     */
+    void clear();
+
+    /**
+     * @brief Returns how many bytes are currently used.
+     */
+    size_t getSize();
+
+    /**
+     * @brief Returns how many decompressions were served from the cache and how many were not.
+     */
+    void getHitsAndMisses(int& hits, int& misses);
+
+private:
+    /**
+     * @brief Returns the reference of the tile the compressed data belongs to, 0 if it does not belong to any tile.
+     */
+    dtCompressedTileRef findTile(const unsigned char* compressed, const int compressedSize);
+
+private:
+    int                     _hits;
+    int                     _misses;
+    dtTileCacheCompressor*  _compressor;
+    dtTileCache*            _tileCache;
+    LruByteCache<dtCompressedTileRef, std::vector<unsigned char>> _layers;
+    std::mutex              _mutex;
+};
+
+#endif // DECOMPRESSEDLAYERCACHE_H
@@ -34,6 +34,7 @@
 #include "detourinputgeometry.h"
 #include "chunkytrimesh.h"
 #include "meshdataaccumulator.h"
+#include "bulkfile.h"
 #include "DebugDraw.h"
 #include "RecastDebugDraw.h"
 #include "DetourNavMesh.h"
@@ -41,7 +42,12 @@
 
 using namespace godot;
 
-#define GEOM_SAVE_DATA_VERSION 1
+#define GEOM_SAVE_DATA_VERSION 4
+
+// The bulk save format writes these as blocks of 4 byte numbers and single bytes
+static_assert(sizeof(rcChunkyTriMeshNode) == 6 * 4, "Chunky mesh nodes are expected to consist of 4 byte numbers only");
+static_assert(sizeof(bool) == 1, "Bools are expected to be stored as single bytes");
+#define CHUNKY_MESH_TRIS_PER_CHUNK 256
 
 static bool
 intersectSegmentTriangle(const float* sp, const float* sq,
@@ -124,29 +130,43 @@ parseRow(char* buf, char* bufEnd, char* row, int len)
 DetourInputGeometry::DetourInputGeometry() :
     m_chunkyMesh(0),
     m_mesh(0),
+    m_frozen(false),
     m_offMeshConCount(0),
-    m_volumeCount(0)
+    m_volumeCount(0),
+    m_nextPieceId(0)
 {
 }
 
 DetourInputGeometry::~DetourInputGeometry()
 {
-    if (m_chunkyMesh) delete m_chunkyMesh;
-    if (m_mesh) delete m_mesh;
+    clearData();
 }
 
 bool
 DetourInputGeometry::loadMesh(rcContext* ctx, godot::MeshInstance* inputMesh)
 {
-    if (m_mesh)
+    clearData();
+    m_mesh = new MeshDataAccumulator(inputMesh);
+    return initLoadedMesh();
+}
+
+bool
+DetourInputGeometry::loadScene(rcContext* ctx, godot::Node* root, int parsedGeometryType, int numThreads)
+{
+    clearData();
+    m_mesh = new MeshDataAccumulator();
+    m_mesh->appendScene(root, parsedGeometryType, numThreads);
+    if (m_mesh->getTriCount() == 0)
     {
-        delete m_chunkyMesh;
-        m_chunkyMesh = 0;
-        delete m_mesh;
-        m_mesh = 0;
+        ERR_PRINT("No geometry found in the passed node.");
+        return false;
     }
-    m_mesh = new MeshDataAccumulator(inputMesh);
+    return initLoadedMesh();
+}
 
+bool
+DetourInputGeometry::initLoadedMesh()
+{
     rcCalcBounds(m_mesh->getVerts(), m_mesh->getVertCount(), m_meshBMin, m_meshBMax);
 
     m_chunkyMesh = new rcChunkyTriMesh;
@@ -155,7 +175,7 @@ DetourInputGeometry::loadMesh(rcContext* ctx, godot::MeshInstance* inputMesh)
         ERR_PRINT("Out of memory 'm_chunkyMesh'.");
         return false;
     }
-    if (!rcCreateChunkyTriMesh(m_mesh->getVerts(), m_mesh->getTris(), m_mesh->getTriCount(), 256, m_chunkyMesh))
+    if (!rcCreateChunkyTriMesh(m_mesh->getVerts(), m_mesh->getTris(), m_mesh->getTriCount(), CHUNKY_MESH_TRIS_PER_CHUNK, m_chunkyMesh))
     {
         ERR_PRINT("Failed to build chunky mesh.");
         return false;
@@ -167,6 +187,15 @@ DetourInputGeometry::loadMesh(rcContext* ctx, godot::MeshInstance* inputMesh)
 void
 DetourInputGeometry::clearData()
 {
+    clearWalkableAreas(nullptr);
+
+    for (int i = 0; i < m_pieces.size(); ++i)
+    {
+        delete m_pieces[i].chunkyMesh;
+    }
+    m_pieces.clear();
+    m_nextPieceId = 0;
+
     if (m_mesh)
     {
         delete m_chunkyMesh;
@@ -174,12 +203,150 @@ DetourInputGeometry::clearData()
         delete m_mesh;
         m_mesh = 0;
     }
+    m_frozen = false;
+}
+
+void
+DetourInputGeometry::freeze()
+{
+    clearWalkableAreas(nullptr);
+
+    for (int i = 0; i < m_pieces.size(); ++i)
+    {
+        delete m_pieces[i].chunkyMesh;
+    }
+    m_pieces.clear();
+
+    delete m_chunkyMesh;
+    m_chunkyMesh = 0;
+    delete m_mesh;
+    m_mesh = 0;
+    m_frozen = true;
+}
+
+int
+DetourInputGeometry::addGeometry(godot::MeshInstance* inputMesh, float* bmin, float* bmax)
+{
+    if (!m_mesh)
+    {
+        ERR_PRINT("DetourInputGeometry: Unable to add geometry without an initial mesh.");
+        return -1;
+    }
+
+    GeometryPiece piece;
+    piece.id = m_nextPieceId;
+    piece.firstVert = m_mesh->getVertCount();
+    piece.firstTri = m_mesh->getTriCount();
+    m_mesh->append(inputMesh);
+    piece.nverts = m_mesh->getVertCount() - piece.firstVert;
+    piece.ntris = m_mesh->getTriCount() - piece.firstTri;
+    if (piece.ntris == 0)
+    {
+        ERR_PRINT("DetourInputGeometry: Added geometry has no triangles.");
+        m_mesh->remove(piece.firstVert, piece.nverts, piece.firstTri, 0);
+        return -1;
+    }
+
+    // Only the new triangles go into the chunky mesh, the existing ones are left alone
+    piece.chunkyMesh = new rcChunkyTriMesh;
+    if (!rcCreateChunkyTriMesh(m_mesh->getVerts(), &m_mesh->getTris()[piece.firstTri * 3], piece.ntris, CHUNKY_MESH_TRIS_PER_CHUNK, piece.chunkyMesh))
+    {
+        ERR_PRINT("DetourInputGeometry: Failed to build chunky mesh for added geometry.");
+        delete piece.chunkyMesh;
+        m_mesh->remove(piece.firstVert, piece.nverts, piece.firstTri, piece.ntris);
+        return -1;
+    }
+    rcCalcBounds(&m_mesh->getVerts()[piece.firstVert * 3], piece.nverts, piece.bmin, piece.bmax);
+    rcVcopy(bmin, piece.bmin);
+    rcVcopy(bmax, piece.bmax);
+
+    m_pieces.push_back(piece);
+    m_nextPieceId++;
+    return piece.id;
+}
+
+bool
+DetourInputGeometry::removeGeometry(int id, float* bmin, float* bmax)
+{
+    int index = -1;
+    for (int i = 0; i < m_pieces.size(); ++i)
+    {
+        if (m_pieces[i].id == id)
+        {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0)
+    {
+        return false;
+    }
+
+    GeometryPiece piece = m_pieces[index];
+    rcVcopy(bmin, piece.bmin);
+    rcVcopy(bmax, piece.bmax);
+    m_mesh->remove(piece.firstVert, piece.nverts, piece.firstTri, piece.ntris);
+    clearWalkableAreas(piece.chunkyMesh);
+    delete piece.chunkyMesh;
+    m_pieces.erase(m_pieces.begin() + index);
+
+    // The pieces behind the removed one moved forward
+    for (int i = index; i < m_pieces.size(); ++i)
+    {
+        GeometryPiece& moved = m_pieces[i];
+        moved.firstVert -= piece.nverts;
+        moved.firstTri -= piece.ntris;
+        for (int j = 0; j < moved.chunkyMesh->ntris * 3; ++j)
+        {
+            moved.chunkyMesh->tris[j] -= piece.nverts;
+        }
+    }
+
+    return true;
+}
+
+const unsigned char*
+DetourInputGeometry::getWalkableAreas(rcContext* ctx, int chunkyMeshIndex, float walkableSlopeAngle)
+{
+    const rcChunkyTriMesh* chunkyMesh = getChunkyMesh(chunkyMeshIndex);
+
+    std::lock_guard<std::mutex> lock(m_walkableAreasMutex);
+    std::vector<unsigned char>& areas = m_walkableAreas[std::make_pair(chunkyMesh, walkableSlopeAngle)];
+    if (areas.empty() && chunkyMesh->ntris > 0)
+    {
+        areas.resize(chunkyMesh->ntris, RC_NULL_AREA);
+        rcMarkWalkableTriangles(ctx, walkableSlopeAngle, m_mesh->getVerts(), m_mesh->getVertCount(), chunkyMesh->tris, chunkyMesh->ntris, areas.data());
+    }
+    return areas.data();
+}
+
+void
+DetourInputGeometry::clearWalkableAreas(const rcChunkyTriMesh* chunkyMesh)
+{
+    std::lock_guard<std::mutex> lock(m_walkableAreasMutex);
+    if (chunkyMesh == nullptr)
+    {
+        m_walkableAreas.clear();
+        return;
+    }
+
+    for (auto it = m_walkableAreas.begin(); it != m_walkableAreas.end();)
+    {
+        if (it->first.first == chunkyMesh)
+        {
+            it = m_walkableAreas.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
 }
 
 bool
-DetourInputGeometry::save(Ref<File> targetFile)
+DetourInputGeometry::save(SaveBuffer* targetFile)
 {
-    if (m_chunkyMesh == nullptr || m_mesh == nullptr)
+    if (!m_frozen && (m_chunkyMesh == nullptr || m_mesh == nullptr))
     {
         ERR_PRINT("DetourInputGeometry: Unable to save. No mesh or chunky mesh.");
         return false;
@@ -195,86 +362,45 @@ DetourInputGeometry::save(Ref<File> targetFile)
     targetFile->store_float(m_meshBMax[0]);
     targetFile->store_float(m_meshBMax[1]);
     targetFile->store_float(m_meshBMax[2]);
+    targetFile->store_8(m_frozen);
 
     // Store off-mesh connections
+    saveOffMeshConnections(targetFile);
+
+    // Frozen geometry has nothing else but the volumes
+    if (m_frozen)
     {
-        targetFile->store_32(m_offMeshConCount);
-        for (int i = 0; i < m_offMeshConCount; ++i)
-        {
-            targetFile->store_float(m_offMeshConRads[i]);
-            targetFile->store_8(m_offMeshConDirs[i]);
-            targetFile->store_8(m_offMeshConAreas[i]);
-            targetFile->store_16(m_offMeshConFlags[i]);
-            targetFile->store_32(m_offMeshConId[i]);
-            targetFile->store_8(m_offMeshConNew[i]);
-
-            targetFile->store_float(m_offMeshConVerts[i * 3 + 0]);
-            targetFile->store_float(m_offMeshConVerts[i * 3 + 1]);
-            targetFile->store_float(m_offMeshConVerts[i * 3 + 2]);
-            targetFile->store_float(m_offMeshConVerts[i * 3 + 3]);
-            targetFile->store_float(m_offMeshConVerts[i * 3 + 4]);
-            targetFile->store_float(m_offMeshConVerts[i * 3 + 5]);
-        }
+        saveVolumes(targetFile);
+        return true;
     }
 
     // Store chunky mesh
     {
-        // Properties
         targetFile->store_32(m_chunkyMesh->maxTrisPerChunk);
-
-        // Nodes
         targetFile->store_32(m_chunkyMesh->nnodes);
-        for (int i = 0; i < m_chunkyMesh->nnodes; ++i)
-        {
-            rcChunkyTriMeshNode& node = m_chunkyMesh->nodes[i];
-            targetFile->store_float(node.bmin[0]);
-            targetFile->store_float(node.bmin[1]);
-            targetFile->store_float(node.bmin[2]);
-            targetFile->store_float(node.bmax[0]);
-            targetFile->store_float(node.bmax[1]);
-            targetFile->store_float(node.bmax[2]);
-            targetFile->store_32(node.i);
-            targetFile->store_32(node.n);
-        }
-
-        // Triangles
+        storeBlock(targetFile, m_chunkyMesh->nodes, m_chunkyMesh->nnodes * sizeof(rcChunkyTriMeshNode), 4);
         targetFile->store_32(m_chunkyMesh->ntris);
-        for (int i = 0; i < m_chunkyMesh->ntris; ++i)
-        {
-            targetFile->store_32(m_chunkyMesh->tris[i * 3 + 0]);
-            targetFile->store_32(m_chunkyMesh->tris[i * 3 + 1]);
-            targetFile->store_32(m_chunkyMesh->tris[i * 3 + 2]);
-        }
+        storeBlock(targetFile, m_chunkyMesh->tris, m_chunkyMesh->ntris * 3 * sizeof(int), sizeof(int));
     }
 
     // Store mesh
     m_mesh->save(targetFile);
 
     // Store volumes
+    saveVolumes(targetFile);
+
+    // Store added geometry (its chunky meshes are rebuilt on load)
     {
-        targetFile->store_32(m_volumeCount);
-        for (int i = 0; i < m_volumeCount; ++i)
+        targetFile->store_32(m_nextPieceId);
+        targetFile->store_32(m_pieces.size());
+        for (int i = 0; i < m_pieces.size(); ++i)
         {
-            ConvexVolume& vol = m_volumes[i];
-
-            // Properties
-            targetFile->store_32(vol.area);
-            targetFile->store_float(vol.front);
-            targetFile->store_float(vol.right);
-            targetFile->store_float(vol.back);
-            targetFile->store_float(vol.left);
-            targetFile->store_float(vol.hmin);
-            targetFile->store_float(vol.hmax);
-            targetFile->store_8(vol.isNew);
-
-            // Vertices
-            targetFile->store_32(vol.nverts);
-            for (int j = 0; j < vol.nverts; ++j)
-            {
-                targetFile->store_float(vol.verts[j * 3 + 0]);
-                targetFile->store_float(vol.verts[j * 3 + 1]);
-                targetFile->store_float(vol.verts[j * 3 + 2]);
-            }
+            GeometryPiece& piece = m_pieces[i];
+            targetFile->store_32(piece.id);
+            targetFile->store_32(piece.firstVert);
+            targetFile->store_32(piece.nverts);
+            targetFile->store_32(piece.firstTri);
+            targetFile->store_32(piece.ntris);
         }
     }
 
@@ -287,17 +413,10 @@ DetourInputGeometry::load(Ref<File> sourceFile)
     // Load version
     int version = sourceFile->get_16();
 
-    if (version == GEOM_SAVE_DATA_VERSION)
+    // Version 1 did not have added geometry, versions before 3 stored each value separately, versions before 4 could not be frozen
+    if (version >= 1 && version <= GEOM_SAVE_DATA_VERSION)
     {
-        if (m_mesh)
-        {
-            delete m_chunkyMesh;
-            m_chunkyMesh = 0;
-            delete m_mesh;
-            m_mesh = 0;
-        }
-        m_mesh = new MeshDataAccumulator();
-        m_chunkyMesh = new rcChunkyTriMesh;
+        clearData();
 
         // Properties
         m_meshBMin[0] = sourceFile->get_float();
@@ -307,56 +426,96 @@ DetourInputGeometry::load(Ref<File> sourceFile)
         m_meshBMax[1] = sourceFile->get_float();
         m_meshBMax[2] = sourceFile->get_float();
 
-        // Off-mesh connections
+        // Frozen geometry only has the off-mesh connections and volumes
+        if (version >= 4 && sourceFile->get_8())
         {
-            m_offMeshConCount = sourceFile->get_32();
-            for (int i = 0; i < m_offMeshConCount; ++i)
+            m_frozen = true;
+            if (!loadOffMeshConnections(sourceFile))
             {
-                m_offMeshConRads[i] = sourceFile->get_float();
-                m_offMeshConDirs[i] = sourceFile->get_8();
-                m_offMeshConAreas[i] = sourceFile->get_8();
-                m_offMeshConFlags[i] = sourceFile->get_16();
-                m_offMeshConId[i] = sourceFile->get_32();
-                m_offMeshConNew[i] = sourceFile->get_8();
-
-                m_offMeshConVerts[i * 3 + 0] = sourceFile->get_float();
-                m_offMeshConVerts[i * 3 + 1] = sourceFile->get_float();
-                m_offMeshConVerts[i * 3 + 2] = sourceFile->get_float();
-                m_offMeshConVerts[i * 3 + 3] = sourceFile->get_float();
-                m_offMeshConVerts[i * 3 + 4] = sourceFile->get_float();
-                m_offMeshConVerts[i * 3 + 5] = sourceFile->get_float();
+                ERR_PRINT("DetourInputGeometry: Unable to load off-mesh connections.");
+                return false;
             }
+            return loadVolumes(sourceFile, version);
         }
+        m_mesh = new MeshDataAccumulator();
+        m_chunkyMesh = new rcChunkyTriMesh;
 
-        // Chunky mesh
+        if (version >= 3)
         {
-            // Properties
-            m_chunkyMesh->maxTrisPerChunk = sourceFile->get_32();
+            // Off-mesh connections
+            if (!loadOffMeshConnections(sourceFile))
+            {
+                ERR_PRINT("DetourInputGeometry: Unable to load off-mesh connections.");
+                return false;
+            }
 
-            // Nodes
+            // Chunky mesh
+            m_chunkyMesh->maxTrisPerChunk = sourceFile->get_32();
             m_chunkyMesh->nnodes = sourceFile->get_32();
             m_chunkyMesh->nodes = new rcChunkyTriMeshNode[m_chunkyMesh->nnodes];
-            for (int i = 0; i < m_chunkyMesh->nnodes; ++i)
+            bool loaded = loadBlock(sourceFile, m_chunkyMesh->nodes, m_chunkyMesh->nnodes * sizeof(rcChunkyTriMeshNode), 4);
+            m_chunkyMesh->ntris = sourceFile->get_32();
+            m_chunkyMesh->tris = new int[m_chunkyMesh->ntris * 3];
+            loaded = loaded && loadBlock(sourceFile, m_chunkyMesh->tris, m_chunkyMesh->ntris * 3 * sizeof(int), sizeof(int));
+            if (!loaded)
+            {
+                ERR_PRINT("DetourInputGeometry: Unable to load chunky mesh.");
+                return false;
+            }
+        }
+        else
+        {
+            // Off-mesh connections
             {
-                rcChunkyTriMeshNode& node = m_chunkyMesh->nodes[i];
-                node.bmin[0] = sourceFile->get_float();
-                node.bmin[1] = sourceFile->get_float();
-                node.bmin[2] = sourceFile->get_float();
-                node.bmax[0] = sourceFile->get_float();
-                node.bmax[1] = sourceFile->get_float();
-                node.bmax[2] = sourceFile->get_float();
-                node.i = sourceFile->get_32();
-                node.n = sourceFile->get_32();
+                m_offMeshConCount = sourceFile->get_32();
+                for (int i = 0; i < m_offMeshConCount; ++i)
+                {
+                    m_offMeshConRads[i] = sourceFile->get_float();
+                    m_offMeshConDirs[i] = sourceFile->get_8();
+                    m_offMeshConAreas[i] = sourceFile->get_8();
+                    m_offMeshConFlags[i] = sourceFile->get_16();
+                    m_offMeshConId[i] = sourceFile->get_32();
+                    m_offMeshConNew[i] = sourceFile->get_8();
+
+                    m_offMeshConVerts[i * 3 + 0] = sourceFile->get_float();
+                    m_offMeshConVerts[i * 3 + 1] = sourceFile->get_float();
+                    m_offMeshConVerts[i * 3 + 2] = sourceFile->get_float();
+                    m_offMeshConVerts[i * 3 + 3] = sourceFile->get_float();
+                    m_offMeshConVerts[i * 3 + 4] = sourceFile->get_float();
+                    m_offMeshConVerts[i * 3 + 5] = sourceFile->get_float();
+                }
             }
 
-            // Triangles
-            m_chunkyMesh->ntris = sourceFile->get_32();
-            m_chunkyMesh->tris = new int[m_chunkyMesh->ntris * 3];
-            for (int i = 0; i < m_chunkyMesh->ntris; ++i)
+            // Chunky mesh
             {
-                m_chunkyMesh->tris[i * 3 + 0] = sourceFile->get_32();
-                m_chunkyMesh->tris[i * 3 + 1] = sourceFile->get_32();
-                m_chunkyMesh->tris[i * 3 + 2] = sourceFile->get_32();
+                // Properties
+                m_chunkyMesh->maxTrisPerChunk = sourceFile->get_32();
+
+                // Nodes
+                m_chunkyMesh->nnodes = sourceFile->get_32();
+                m_chunkyMesh->nodes = new rcChunkyTriMeshNode[m_chunkyMesh->nnodes];
+                for (int i = 0; i < m_chunkyMesh->nnodes; ++i)
+                {
+                    rcChunkyTriMeshNode& node = m_chunkyMesh->nodes[i];
+                    node.bmin[0] = sourceFile->get_float();
+                    node.bmin[1] = sourceFile->get_float();
+                    node.bmin[2] = sourceFile->get_float();
+                    node.bmax[0] = sourceFile->get_float();
+                    node.bmax[1] = sourceFile->get_float();
+                    node.bmax[2] = sourceFile->get_float();
+                    node.i = sourceFile->get_32();
+                    node.n = sourceFile->get_32();
+                }
+
+                // Triangles
+                m_chunkyMesh->ntris = sourceFile->get_32();
+                m_chunkyMesh->tris = new int[m_chunkyMesh->ntris * 3];
+                for (int i = 0; i < m_chunkyMesh->ntris; ++i)
+                {
+                    m_chunkyMesh->tris[i * 3 + 0] = sourceFile->get_32();
+                    m_chunkyMesh->tris[i * 3 + 1] = sourceFile->get_32();
+                    m_chunkyMesh->tris[i * 3 + 2] = sourceFile->get_32();
+                }
             }
         }
 
@@ -368,30 +527,33 @@ DetourInputGeometry::load(Ref<File> sourceFile)
         }
 
         // Volumes
+        if (!loadVolumes(sourceFile, version))
         {
-            m_volumeCount = sourceFile->get_32();
-            for (int i = 0; i < m_volumeCount; ++i)
-            {
-                ConvexVolume& vol = m_volumes[i];
+            return false;
+        }
 
-                // Properties
-                vol.area = sourceFile->get_32();
-                vol.front = sourceFile->get_float();
-                vol.right = sourceFile->get_float();
-                vol.back = sourceFile->get_float();
-                vol.left = sourceFile->get_float();
-                vol.hmin = sourceFile->get_float();
-                vol.hmax = sourceFile->get_float();
-                vol.isNew = sourceFile->get_8();
-
-                // Vertices
-                vol.nverts = sourceFile->get_32();
-                for (int j = 0; j < vol.nverts; ++j)
+        // Added geometry
+        if (version >= 2)
+        {
+            m_nextPieceId = sourceFile->get_32();
+            int numPieces = sourceFile->get_32();
+            for (int i = 0; i < numPieces; ++i)
+            {
+                GeometryPiece piece;
+                piece.id = sourceFile->get_32();
+                piece.firstVert = sourceFile->get_32();
+                piece.nverts = sourceFile->get_32();
+                piece.firstTri = sourceFile->get_32();
+                piece.ntris = sourceFile->get_32();
+                piece.chunkyMesh = new rcChunkyTriMesh;
+                if (!rcCreateChunkyTriMesh(m_mesh->getVerts(), &m_mesh->getTris()[piece.firstTri * 3], piece.ntris, CHUNKY_MESH_TRIS_PER_CHUNK, piece.chunkyMesh))
                 {
-                    vol.verts[j * 3 + 0] = sourceFile->get_float();
-                    vol.verts[j * 3 + 1] = sourceFile->get_float();
-                    vol.verts[j * 3 + 2] = sourceFile->get_float();
+                    ERR_PRINT("DetourInputGeometry: Failed to build chunky mesh for added geometry.");
+                    delete piece.chunkyMesh;
+                    return false;
                 }
+                rcCalcBounds(&m_mesh->getVerts()[piece.firstVert * 3], piece.nverts, piece.bmin, piece.bmax);
+                m_pieces.push_back(piece);
             }
         }
     }
@@ -403,6 +565,132 @@ DetourInputGeometry::load(Ref<File> sourceFile)
     return true;
 }
 
+bool
+DetourInputGeometry::saveAreas(SaveBuffer* targetFile)
+{
+    saveOffMeshConnections(targetFile);
+    saveVolumes(targetFile);
+    return true;
+}
+
+bool
+DetourInputGeometry::loadAreas(Ref<File> sourceFile)
+{
+    if (!loadOffMeshConnections(sourceFile))
+    {
+        ERR_PRINT("DetourInputGeometry: Unable to load off-mesh connections.");
+        return false;
+    }
+    return loadVolumes(sourceFile, GEOM_SAVE_DATA_VERSION);
+}
+
+void
+DetourInputGeometry::saveOffMeshConnections(SaveBuffer* targetFile)
+{
+    // One block per property
+    const int count = m_offMeshConCount;
+    targetFile->store_32(count);
+    storeBlock(targetFile, m_offMeshConVerts, count * 6 * sizeof(float), sizeof(float));
+    storeBlock(targetFile, m_offMeshConRads, count * sizeof(float), sizeof(float));
+    storeBlock(targetFile, m_offMeshConDirs, count, 1);
+    storeBlock(targetFile, m_offMeshConAreas, count, 1);
+    storeBlock(targetFile, m_offMeshConFlags, count * sizeof(unsigned short), sizeof(unsigned short));
+    storeBlock(targetFile, m_offMeshConId, count * sizeof(unsigned int), sizeof(unsigned int));
+    storeBlock(targetFile, m_offMeshConNew, count * sizeof(bool), 1);
+}
+
+bool
+DetourInputGeometry::loadOffMeshConnections(Ref<File> sourceFile)
+{
+    m_offMeshConCount = sourceFile->get_32();
+    if (m_offMeshConCount < 0 || m_offMeshConCount > MAX_OFFMESH_CONNECTIONS)
+    {
+        ERR_PRINT(String("DetourInputGeometry: Invalid number of off-mesh connections: {0}").format(Array::make(m_offMeshConCount)));
+        m_offMeshConCount = 0;
+        return false;
+    }
+    const int count = m_offMeshConCount;
+    return loadBlock(sourceFile, m_offMeshConVerts, count * 6 * sizeof(float), sizeof(float))
+        && loadBlock(sourceFile, m_offMeshConRads, count * sizeof(float), sizeof(float))
+        && loadBlock(sourceFile, m_offMeshConDirs, count, 1)
+        && loadBlock(sourceFile, m_offMeshConAreas, count, 1)
+        && loadBlock(sourceFile, m_offMeshConFlags, count * sizeof(unsigned short), sizeof(unsigned short))
+        && loadBlock(sourceFile, m_offMeshConId, count * sizeof(unsigned int), sizeof(unsigned int))
+        && loadBlock(sourceFile, m_offMeshConNew, count * sizeof(bool), 1);
+}
+
+void
+DetourInputGeometry::saveVolumes(SaveBuffer* targetFile)
+{
+    targetFile->store_32(m_volumeCount);
+    for (int i = 0; i < m_volumeCount; ++i)
+    {
+        ConvexVolume& vol = m_volumes[i];
+
+        // Properties
+        targetFile->store_32(vol.area);
+        targetFile->store_float(vol.front);
+        targetFile->store_float(vol.right);
+        targetFile->store_float(vol.back);
+        targetFile->store_float(vol.left);
+        targetFile->store_float(vol.hmin);
+        targetFile->store_float(vol.hmax);
+        targetFile->store_8(vol.isNew);
+
+        // Vertices
+        targetFile->store_32(vol.nverts);
+        storeBlock(targetFile, vol.verts, vol.nverts * 3 * sizeof(float), sizeof(float));
+    }
+}
+
+bool
+DetourInputGeometry::loadVolumes(Ref<File> sourceFile, int version)
+{
+    m_volumeCount = sourceFile->get_32();
+    if (m_volumeCount < 0 || m_volumeCount > MAX_VOLUMES)
+    {
+        ERR_PRINT(String("DetourInputGeometry: Invalid number of convex volumes: {0}").format(Array::make(m_volumeCount)));
+        m_volumeCount = 0;
+        return false;
+    }
+    for (int i = 0; i < m_volumeCount; ++i)
+    {
+        ConvexVolume& vol = m_volumes[i];
+
+        // Properties
+        vol.area = sourceFile->get_32();
+        vol.front = sourceFile->get_float();
+        vol.right = sourceFile->get_float();
+        vol.back = sourceFile->get_float();
+        vol.left = sourceFile->get_float();
+        vol.hmin = sourceFile->get_float();
+        vol.hmax = sourceFile->get_float();
+        vol.isNew = sourceFile->get_8();
+
+        // Vertices
+        vol.nverts = sourceFile->get_32();
+        if (version >= 3)
+        {
+            if (vol.nverts < 0 || vol.nverts > MAX_CONVEXVOL_PTS
+                || !loadBlock(sourceFile, vol.verts, vol.nverts * 3 * sizeof(float), sizeof(float)))
+            {
+                ERR_PRINT("DetourInputGeometry: Unable to load convex volume.");
+                return false;
+            }
+        }
+        else
+        {
+            for (int j = 0; j < vol.nverts; ++j)
+            {
+                vol.verts[j * 3 + 0] = sourceFile->get_float();
+                vol.verts[j * 3 + 1] = sourceFile->get_float();
+                vol.verts[j * 3 + 2] = sourceFile->get_float();
+            }
+        }
+    }
+    return true;
+}
+
 static bool
 isectSegAABB(const float* sp, const float* sq,
                          const float* amin, const float* amax,
@@ -456,32 +744,34 @@ DetourInputGeometry::raycastMesh(float* src, float* dst, float& tmin)
     q[0] = src[0] + (dst[0]-src[0])*btmax;
     q[1] = src[2] + (dst[2]-src[2])*btmax;
 
-    int cid[512];
-    const int ncid = rcGetChunksOverlappingSegment(m_chunkyMesh, p, q, cid, 512);
-    if (!ncid)
-        return false;
-
     tmin = 1.0f;
     bool hit = false;
     const float* verts = m_mesh->getVerts();
 
-    for (int i = 0; i < ncid; ++i)
+    for (int c = 0; c < getChunkyMeshCount(); ++c)
     {
-        const rcChunkyTriMeshNode& node = m_chunkyMesh->nodes[cid[i]];
-        const int* tris = &m_chunkyMesh->tris[node.i*3];
-        const int ntris = node.n;
+        const rcChunkyTriMesh* chunkyMesh = getChunkyMesh(c);
+        int cid[512];
+        const int ncid = rcGetChunksOverlappingSegment(chunkyMesh, p, q, cid, 512);
 
-        for (int j = 0; j < ntris*3; j += 3)
+        for (int i = 0; i < ncid; ++i)
         {
-            float t = 1;
-            if (intersectSegmentTriangle(src, dst,
-                                         &verts[tris[j]*3],
-                                         &verts[tris[j+1]*3],
-                                         &verts[tris[j+2]*3], t))
+            const rcChunkyTriMeshNode& node = chunkyMesh->nodes[cid[i]];
+            const int* tris = &chunkyMesh->tris[node.i*3];
+            const int ntris = node.n;
+
+            for (int j = 0; j < ntris*3; j += 3)
             {
-                if (t < tmin)
-                    tmin = t;
-                hit = true;
+                float t = 1;
+                if (intersectSegmentTriangle(src, dst,
+                                             &verts[tris[j]*3],
+                                             &verts[tris[j+1]*3],
+                                             &verts[tris[j+2]*3], t))
+                {
+                    if (t < tmin)
+                        tmin = t;
+                    hit = true;
+                }
             }
         }
     }
@@ -26,10 +26,14 @@
 #include <MeshInstance.hpp>
 #include <Godot.hpp>
 #include <File.hpp>
+#include <vector>
+#include <map>
+#include <mutex>
 #include "chunkytrimesh.h"
 
 using namespace godot;
 class MeshDataAccumulator;
+class SaveBuffer;
 
 static const int MAX_CONVEXVOL_PTS = 12;
 struct ConvexVolume
@@ -48,6 +52,18 @@ struct ConvexVolume
     bool isNew = false;
 };
 
+// Geometry added after the initial mesh, with its own chunky mesh so it can be added and removed independently
+struct GeometryPiece
+{
+    int id;
+    int firstVert;
+    int nverts;
+    int firstTri;
+    int ntris;
+    float bmin[3], bmax[3];
+    rcChunkyTriMesh* chunkyMesh;
+};
+
 class DetourInputGeometry
 {
 public:
@@ -58,6 +74,7 @@ private:
     rcChunkyTriMesh* m_chunkyMesh;
     MeshDataAccumulator* m_mesh;
     float m_meshBMin[3], m_meshBMax[3];
+    bool m_frozen;
 
     /// @name Off-Mesh connections.
     ///@{
@@ -77,24 +94,54 @@ private:
     int m_volumeCount;
     ///@}
 
+    /// @name Added geometry.
+    ///@{
+    std::vector<GeometryPiece> m_pieces;
+    int m_nextPieceId;
+    ///@}
+
+    /// @name Walkable triangles.
+    ///@{
+    /// Area of each triangle of a chunky mesh (in the chunky mesh's order), per walkable slope angle.
+    std::map<std::pair<const rcChunkyTriMesh*, float>, std::vector<unsigned char>> m_walkableAreas;
+    std::mutex m_walkableAreasMutex;
+    ///@}
+
 public:
 
     DetourInputGeometry();
     ~DetourInputGeometry();
 
     bool loadMesh(class rcContext* ctx, godot::MeshInstance* inputMesh);
+    /// Loads the geometry of the node and all its children, see GodotGeometryParser::getSceneVerticesAndIndices.
+    bool loadScene(class rcContext* ctx, godot::Node* root, int parsedGeometryType, int numThreads);
     void clearData();
 
+    /// Releases the mesh and all chunky meshes, e.g. once no tile will be rasterized anymore.
+    /// Only the bounds, off-mesh connections and convex volumes are kept, which is also all that is saved from then on.
+    void freeze();
+    bool isFrozen() const { return m_frozen; }
+
     /**
      * @brief Save the input geometry data to the file.
      */
-    bool save(Ref<File> targetFile);
+    bool save(SaveBuffer* targetFile);
 
     /**
      * @brief Load the input geometry data from the byte array.
      */
     bool load(Ref<File> sourceFile);
 
+    /**
+     * @brief Save only the off-mesh connections and convex volumes to the file, e.g. for incremental saves.
+     */
+    bool saveAreas(SaveBuffer* targetFile);
+
+    /**
+     * @brief Load the off-mesh connections and convex volumes saved by saveAreas().
+     */
+    bool loadAreas(Ref<File> sourceFile);
+
     /// Method to return static mesh data.
     const MeshDataAccumulator* getMesh() const { return m_mesh; }
     const float* getMeshBoundsMin() const { return m_meshBMin; }
@@ -104,6 +151,27 @@ public:
     const rcChunkyTriMesh* getChunkyMesh() const { return m_chunkyMesh; }
     bool raycastMesh(float* src, float* dst, float& tmin);
 
+    /// @name Added geometry.
+    ///@{
+    /// Appends the geometry of the mesh instance. Returns its ID (-1 on error) and its bounds.
+    int addGeometry(godot::MeshInstance* inputMesh, float* bmin, float* bmax);
+    /// Removes the geometry with the passed ID. Returns false if unknown, its bounds otherwise.
+    bool removeGeometry(int id, float* bmin, float* bmax);
+    /// The chunky meshes of the initial mesh (index 0) and of all added geometry.
+    int getChunkyMeshCount() const { return 1 + (int)m_pieces.size(); }
+    const rcChunkyTriMesh* getChunkyMesh(int i) const { return i == 0 ? m_chunkyMesh : m_pieces[i - 1].chunkyMesh; }
+    /// The bounds of the geometry in the chunky mesh.
+    const float* getChunkyMeshBoundsMin(int i) const { return i == 0 ? m_meshBMin : m_pieces[i - 1].bmin; }
+    const float* getChunkyMeshBoundsMax(int i) const { return i == 0 ? m_meshBMax : m_pieces[i - 1].bmax; }
+    ///@}
+
+    /// @name Walkable triangles.
+    ///@{
+    /// Returns RC_WALKABLE_AREA or RC_NULL_AREA for each triangle of the chunky mesh (in the chunky mesh's order) depending on its slope.
+    /// Classified only once per chunky mesh and slope angle, then shared by all tiles and navmeshes. Can be called from multiple threads.
+    const unsigned char* getWalkableAreas(class rcContext* ctx, int chunkyMeshIndex, float walkableSlopeAngle);
+    ///@}
+
     /// @name Off-Mesh connections.
     ///@{
     int getOffMeshConnectionCount() const { return m_offMeshConCount; }
@@ -131,6 +199,18 @@ public:
     ///@}
 
 private:
+    /// Calculates the bounds and builds the chunky mesh of the freshly loaded mesh.
+    bool initLoadedMesh();
+
+    /// Forgets the walkable areas of the chunky mesh, or of all chunky meshes if nullptr.
+    void clearWalkableAreas(const rcChunkyTriMesh* chunkyMesh);
+
+    /// Store and load the off-mesh connections and convex volumes, shared by the full and area saves.
+    void saveOffMeshConnections(SaveBuffer* targetFile);
+    bool loadOffMeshConnections(Ref<File> sourceFile);
+    void saveVolumes(SaveBuffer* targetFile);
+    bool loadVolumes(Ref<File> sourceFile, int version);
+
     // Explicitly disabled copy constructor and copy assignment operator.
     DetourInputGeometry(const DetourInputGeometry&);
     DetourInputGeometry& operator=(const DetourInputGeometry&);
@@ -20,9 +20,52 @@
 #include <GridMap.hpp>
 #include <ConcavePolygonShape.hpp>
 #include <ConvexPolygonShape.hpp>
+#include "threadpool.h"
+#include <cstring>
 
 using namespace godot;
 
+static_assert(sizeof(Vector3) == 3 * sizeof(float), "Vertices are read directly as floats.");
+
+/**
+ * @brief Transforms count vertices (3 floats each) from source into target.
+ */
+static void
+transformVertices(const Transform& transform, const float* source, int count, float* target)
+{
+    const Vector3* rows = transform.basis.elements;
+    int i = 0;
+
+#ifdef GEOMETRY_SSE
+    // Each vertex is column0 * x + column1 * y + column2 * z + origin, four vertices per batch.
+    // Each store writes one float too many, which the next vertex overwrites. So the last vertex is left to the scalar loop.
+    const __m128 column0 = _mm_setr_ps(rows[0].x, rows[1].x, rows[2].x, 0.0f);
+    const __m128 column1 = _mm_setr_ps(rows[0].y, rows[1].y, rows[2].y, 0.0f);
+    const __m128 column2 = _mm_setr_ps(rows[0].z, rows[1].z, rows[2].z, 0.0f);
+    const __m128 origin = _mm_setr_ps(transform.origin.x, transform.origin.y, transform.origin.z, 0.0f);
+    for (; i + 4 < count; i += 4)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            const float* v = &source[(i + j) * 3];
+            __m128 result = _mm_add_ps(origin, _mm_mul_ps(column0, _mm_set1_ps(v[0])));
+            result = _mm_add_ps(result, _mm_mul_ps(column1, _mm_set1_ps(v[1])));
+            result = _mm_add_ps(result, _mm_mul_ps(column2, _mm_set1_ps(v[2])));
+            _mm_storeu_ps(&target[(i + j) * 3], result);
+        }
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        const float* v = &source[i * 3];
+        float* t = &target[i * 3];
+        t[0] = rows[0].x * v[0] + rows[0].y * v[1] + rows[0].z * v[2] + transform.origin.x;
+        t[1] = rows[1].x * v[0] + rows[1].y * v[1] + rows[1].z * v[2] + transform.origin.y;
+        t[2] = rows[2].x * v[0] + rows[2].y * v[1] + rows[2].z * v[2] + transform.origin.z;
+    }
+}
+
 GodotGeometryParser::GodotGeometryParser()
 {
 
@@ -39,100 +82,255 @@ GodotGeometryParser::getNodeVerticesAndIndices(godot::MeshInstance* meshInstance
 }
 
 void
-GodotGeometryParser::addMesh(const Ref<ArrayMesh>& p_mesh, const Transform& p_xform, std::vector<float>& p_vertices, std::vector<int>& p_indices)
+GodotGeometryParser::getSceneVerticesAndIndices(Node* root, int parsedGeometryType, int numThreads, std::vector<float>& outVertices, std::vector<int>& outIndices)
+{
+    // Walk the tree on this thread, Godot objects are not to be touched from the workers
+    std::vector<ParsedSurface> surfaces;
+    collectSurfaces(root, Transform(), parsedGeometryType, surfaces);
+    if (surfaces.empty())
+    {
+        return;
+    }
+
+    // Size the output once, then transform the surfaces in parallel directly into their part of it.
+    // The result does not depend on the scheduling, as each surface has a fixed place.
+    layoutSurfaces(surfaces, outVertices, outIndices);
+    float* vertices = outVertices.data();
+    int* indices = outIndices.data();
+    ThreadPool pool(numThreads);
+    TaskGroup group;
+    for (int i = 0; i < surfaces.size(); ++i)
+    {
+        const ParsedSurface* surface = &surfaces[i];
+        pool.submit(group, [this, surface, vertices, indices]() {
+            transformSurface(*surface, vertices, indices);
+        });
+    }
+    pool.wait(group);
+}
+
+void
+GodotGeometryParser::addMesh(const Ref<Mesh>& p_mesh, const Transform& p_xform, std::vector<float>& p_vertices, std::vector<int>& p_indices)
+{
+    std::vector<ParsedSurface> surfaces;
+    collectMesh(p_mesh, p_xform, surfaces);
+    layoutSurfaces(surfaces, p_vertices, p_indices);
+    for (int i = 0; i < surfaces.size(); ++i)
+    {
+        transformSurface(surfaces[i], p_vertices.data(), p_indices.data());
+    }
+}
+
+void
+GodotGeometryParser::collectSurfaces(Node* node, const Transform& parentTransform, int parsedGeometryType, std::vector<ParsedSurface>& surfaces)
 {
-    int current_vertex_count = 0;
+    // Like in Godot, only Spatials inherit their parent's transform, any other node starts a new chain
+    Transform transform;
+    Spatial* spatial = Object::cast_to<Spatial>(node);
+    if (spatial)
+    {
+        transform = Object::cast_to<Spatial>(node->get_parent()) ? parentTransform * spatial->get_transform() : spatial->get_transform();
+    }
 
-    // Reserve indices & vertices to avoid dynamic allocation
-    size_t vertexCount = 0;
-    size_t faceCount = 0;
-    for (int i = 0; i < p_mesh->get_surface_count(); i++) {
-        if (p_mesh->surface_get_primitive_type(i) != Mesh::PRIMITIVE_TRIANGLES)
+    if (parsedGeometryType == PARSED_GEOMETRY_MESH_INSTANCES || parsedGeometryType == PARSED_GEOMETRY_BOTH)
+    {
+        MeshInstance* meshInstance = Object::cast_to<MeshInstance>(node);
+        CSGShape* csgShape = Object::cast_to<CSGShape>(node);
+        GridMap* gridMap = Object::cast_to<GridMap>(node);
+        if (meshInstance)
         {
-            WARN_PRINT(String("Surface {0} not of type PRIMITIVE_TRIANGLES. Ignored.").format(Array::make(i)));
-            continue;
+            collectMesh(meshInstance->get_mesh(), transform, surfaces);
         }
-
-        int index_count = 0;
-        if (p_mesh->surface_get_format(i) & Mesh::ARRAY_FORMAT_INDEX)
+        else if (csgShape && csgShape->is_root_shape())
         {
-            index_count = p_mesh->surface_get_array_index_len(i);
+            // Only the root shape holds the combined mesh of all its child shapes
+            Array meshes = csgShape->get_meshes();
+            if (meshes.size() == 2)
+            {
+                Transform meshTransform = meshes[0];
+                Ref<Mesh> mesh = meshes[1];
+                collectMesh(mesh, transform * meshTransform, surfaces);
+            }
         }
-        else {
-            index_count = p_mesh->surface_get_array_len(i);
+        else if (gridMap)
+        {
+            // Pairs of transform (relative to the grid map) and mesh
+            Array meshes = gridMap->get_meshes();
+            for (int i = 0; i + 1 < meshes.size(); i += 2)
+            {
+                Transform meshTransform = meshes[i];
+                Ref<Mesh> mesh = meshes[i + 1];
+                collectMesh(mesh, transform * meshTransform, surfaces);
+            }
         }
+    }
 
-        ERR_CONTINUE((index_count == 0 || (index_count % 3) != 0));
-
-        int face_count = index_count / 3;
-
-        Array a = p_mesh->surface_get_arrays(i);
+    if (parsedGeometryType == PARSED_GEOMETRY_STATIC_COLLIDERS || parsedGeometryType == PARSED_GEOMETRY_BOTH)
+    {
+        StaticBody* staticBody = Object::cast_to<StaticBody>(node);
+        if (staticBody)
+        {
+            for (int i = 0; i < staticBody->get_child_count(); ++i)
+            {
+                CollisionShape* collisionShape = Object::cast_to<CollisionShape>(staticBody->get_child(i));
+                if (collisionShape && !collisionShape->is_disabled())
+                {
+                    collectShape(collisionShape->get_shape(), transform * collisionShape->get_transform(), surfaces);
+                }
+            }
+        }
+    }
 
-        PoolVector3Array mesh_vertices = a[Mesh::ARRAY_VERTEX];
-        vertexCount += mesh_vertices.size();
-        faceCount += face_count;
+    for (int i = 0; i < node->get_child_count(); ++i)
+    {
+        collectSurfaces(node->get_child(i), transform, parsedGeometryType, surfaces);
     }
-    p_vertices.reserve(vertexCount * 3);
-    p_indices.reserve(faceCount * 3);
+}
 
-    for (int i = 0; i < p_mesh->get_surface_count(); i++) {
-        current_vertex_count = p_vertices.size() / 3;
+void
+GodotGeometryParser::collectMesh(const Ref<Mesh>& mesh, const Transform& transform, std::vector<ParsedSurface>& surfaces)
+{
+    if (!mesh.is_valid())
+    {
+        return;
+    }
 
-        if (p_mesh->surface_get_primitive_type(i) != Mesh::PRIMITIVE_TRIANGLES)
+    for (int i = 0; i < mesh->get_surface_count(); i++) {
+        if (mesh->surface_get_primitive_type(i) != Mesh::PRIMITIVE_TRIANGLES)
         {
             WARN_PRINT(String("Surface {0} not of type PRIMITIVE_TRIANGLES. Ignored.").format(Array::make(i)));
             continue;
         }
 
-        int index_count = 0;
-        if (p_mesh->surface_get_format(i) & Mesh::ARRAY_FORMAT_INDEX)
-        {
-            index_count = p_mesh->surface_get_array_index_len(i);
-        }
-        else {
-            index_count = p_mesh->surface_get_array_len(i);
-        }
-
+        bool indexed = mesh->surface_get_format(i) & Mesh::ARRAY_FORMAT_INDEX;
+        int index_count = indexed ? mesh->surface_get_array_index_len(i) : mesh->surface_get_array_len(i);
         ERR_CONTINUE((index_count == 0 || (index_count % 3) != 0));
 
-        int face_count = index_count / 3;
-
-        Array a = p_mesh->surface_get_arrays(i);
+        Array a = mesh->surface_get_arrays(i);
 
-        PoolVector3Array mesh_vertices = a[Mesh::ARRAY_VERTEX];
-        PoolVector3Array::Read vr = mesh_vertices.read();
-
-        if (p_mesh->surface_get_format(i) & Mesh::ARRAY_FORMAT_INDEX)
+        ParsedSurface surface;
+        surface.transform = transform;
+        surface.vertices = a[Mesh::ARRAY_VERTEX];
+        if (indexed)
         {
+            surface.indices = a[Mesh::ARRAY_INDEX];
+        }
+        surfaces.push_back(surface);
+    }
+}
 
-            PoolIntArray mesh_indices = a[Mesh::ARRAY_INDEX];
-            PoolIntArray::Read ir = mesh_indices.read();
+void
+GodotGeometryParser::collectShape(const Ref<Shape>& shape, const Transform& transform, std::vector<ParsedSurface>& surfaces)
+{
+    if (!shape.is_valid())
+    {
+        return;
+    }
 
-            for (int j = 0; j < mesh_vertices.size(); j++)
-            {
-                addVertex(p_xform.xform(vr[j]), p_vertices);
-            }
+    // Simple shapes are turned into the matching primitive mesh
+    Ref<BoxShape> box = shape;
+    Ref<CapsuleShape> capsule = shape;
+    Ref<CylinderShape> cylinder = shape;
+    Ref<SphereShape> sphere = shape;
+    Ref<ConcavePolygonShape> concave = shape;
+    Ref<ConvexPolygonShape> convex = shape;
+    if (box.is_valid())
+    {
+        Ref<CubeMesh> cubeMesh = CubeMesh::_new();
+        cubeMesh->set_size(box->get_extents() * 2.0f);
+        collectMesh(cubeMesh, transform, surfaces);
+    }
+    else if (capsule.is_valid())
+    {
+        Ref<CapsuleMesh> capsuleMesh = CapsuleMesh::_new();
+        capsuleMesh->set_radius(capsule->get_radius());
+        capsuleMesh->set_mid_height(capsule->get_height() / 2.0f);
+        collectMesh(capsuleMesh, transform, surfaces);
+    }
+    else if (cylinder.is_valid())
+    {
+        Ref<CylinderMesh> cylinderMesh = CylinderMesh::_new();
+        cylinderMesh->set_top_radius(cylinder->get_radius());
+        cylinderMesh->set_bottom_radius(cylinder->get_radius());
+        cylinderMesh->set_height(cylinder->get_height());
+        collectMesh(cylinderMesh, transform, surfaces);
+    }
+    else if (sphere.is_valid())
+    {
+        Ref<SphereMesh> sphereMesh = SphereMesh::_new();
+        sphereMesh->set_radius(sphere->get_radius());
+        sphereMesh->set_height(sphere->get_radius() * 2.0f);
+        collectMesh(sphereMesh, transform, surfaces);
+    }
+    else if (concave.is_valid())
+    {
+        // Faces are already a plain triangle list
+        ParsedSurface surface;
+        surface.transform = transform;
+        surface.vertices = concave->get_faces();
+        ERR_FAIL_COND((surface.vertices.size() % 3) != 0);
+        surfaces.push_back(surface);
+    }
+    else if (convex.is_valid())
+    {
+        WARN_PRINT("ConvexPolygonShape is not supported as navigation geometry. Ignored.");
+    }
+}
 
-            for (int j = 0; j < face_count; j++)
-            {
-                // CCW
-                p_indices.push_back(current_vertex_count + (ir[j * 3 + 0]));
-                p_indices.push_back(current_vertex_count + (ir[j * 3 + 2]));
-                p_indices.push_back(current_vertex_count + (ir[j * 3 + 1]));
-            }
+void
+GodotGeometryParser::layoutSurfaces(std::vector<ParsedSurface>& surfaces, std::vector<float>& p_vertices, std::vector<int>& p_indices)
+{
+    size_t vertexCount = p_vertices.size() / 3;
+    size_t indexCount = p_indices.size();
+    for (int i = 0; i < surfaces.size(); ++i)
+    {
+        ParsedSurface& surface = surfaces[i];
+        if (surface.indices.size() > 0)
+        {
+            surface.vertexCount = surface.vertices.size();
+            surface.indexCount = surface.indices.size();
         }
         else {
-            face_count = mesh_vertices.size() / 3;
-            for (int j = 0; j < face_count; j++)
-            {
-                addVertex(p_xform.xform(vr[j * 3 + 0]), p_vertices);
-                addVertex(p_xform.xform(vr[j * 3 + 2]), p_vertices);
-                addVertex(p_xform.xform(vr[j * 3 + 1]), p_vertices);
+            // Every three vertices form a face
+            surface.vertexCount = (surface.vertices.size() / 3) * 3;
+            surface.indexCount = surface.vertexCount;
+        }
+        surface.firstVertex = vertexCount;
+        surface.firstIndex = indexCount;
+        vertexCount += surface.vertexCount;
+        indexCount += surface.indexCount;
+    }
+    p_vertices.resize(vertexCount * 3);
+    p_indices.resize(indexCount);
+}
 
-                p_indices.push_back(current_vertex_count + (j * 3 + 0));
-                p_indices.push_back(current_vertex_count + (j * 3 + 1));
-                p_indices.push_back(current_vertex_count + (j * 3 + 2));
-            }
+void
+GodotGeometryParser::transformSurface(const ParsedSurface& surface, float* p_vertices, int* p_indices)
+{
+    // Read the pool memory directly instead of going through the Vector3s one by one
+    PoolVector3Array::Read vr = surface.vertices.read();
+    transformVertices(surface.transform, reinterpret_cast<const float*>(vr.ptr()), surface.vertexCount, &p_vertices[surface.firstVertex * 3]);
+
+    // CCW
+    int* out = &p_indices[surface.firstIndex];
+    int offset = surface.firstVertex;
+    if (surface.indices.size() > 0)
+    {
+        PoolIntArray::Read ir = surface.indices.read();
+        const int* in = ir.ptr();
+        for (int j = 0; j < surface.indexCount; j += 3)
+        {
+            out[j + 0] = offset + in[j + 0];
+            out[j + 1] = offset + in[j + 2];
+            out[j + 2] = offset + in[j + 1];
+        }
+    }
+    else {
+        for (int j = 0; j < surface.indexCount; j += 3)
+        {
+            out[j + 0] = offset + j + 0;
+            out[j + 1] = offset + j + 2;
+            out[j + 2] = offset + j + 1;
         }
     }
 }
@@ -140,22 +338,13 @@ GodotGeometryParser::addMesh(const Ref<ArrayMesh>& p_mesh, const Transform& p_xf
 void
 GodotGeometryParser::parseGeometry(godot::MeshInstance* meshInstance, std::vector<float> &p_vertices, std::vector<int> &p_indices)
 {
-    Ref<ArrayMesh> mesh = meshInstance->get_mesh();
+    // Primitive meshes provide their surface arrays just like array meshes, so no conversion is needed
+    Ref<Mesh> mesh = meshInstance->get_mesh();
     if (mesh.is_valid())
     {
         addMesh(mesh, meshInstance->get_transform(), p_vertices, p_indices);
     }
     else {
-        // Not an array mesh, check if we have a primitive mesh to convert
-        Ref<PrimitiveMesh> primitive_mesh = meshInstance->get_mesh();
-        if (primitive_mesh.is_valid())
-        {
-            Ref<ArrayMesh> arr_mesh = ArrayMesh::_new();
-            arr_mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, primitive_mesh->get_mesh_arrays());
-            addMesh(arr_mesh, meshInstance->get_transform(), p_vertices, p_indices);
-        }
-        else {
-            ERR_PRINT(String("Mesh not an ArrayMesh or PrimitiveMesh"));
-        }
+        ERR_PRINT(String("MeshInstance has no mesh"));
     }
 }
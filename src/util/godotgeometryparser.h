@@ -6,11 +6,25 @@
 #include <Vector2.hpp>
 #include <MeshInstance.hpp>
 #include <ArrayMesh.hpp>
+#include <Mesh.hpp>
+#include <Shape.hpp>
+#include <Node.hpp>
 #include <PoolArrays.hpp>
 #include <vector>
 
+// Vertex transforms and normals are computed with SSE where available
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define GEOMETRY_SSE
+#endif
+
+// Which geometry of a scene tree will be parsed
+#define PARSED_GEOMETRY_MESH_INSTANCES 0
+#define PARSED_GEOMETRY_STATIC_COLLIDERS 1
+#define PARSED_GEOMETRY_BOTH 2
+
 /**
- * @brief Will parse a passed MeshInstance
+ * @brief Will parse a passed MeshInstance or a whole scene tree.
  */
 class GodotGeometryParser {
     public:
@@ -19,17 +33,59 @@ class GodotGeometryParser {
 
     void getNodeVerticesAndIndices(godot::MeshInstance* meshInstance, std::vector<float>& outVertices, std::vector<int>& outIndices);
 
+    /**
+     * @brief Parses the node and all its children for geometry (MeshInstance, CSGShape, GridMap and the collision shapes of StaticBody).
+     *          The tree is walked on the calling thread, the triangles of all surfaces found are transformed on numThreads threads
+     *          and then appended to the output in the order they were found.
+     * @param parsedGeometryType    One of the PARSED_GEOMETRY_* defines.
+     * @param numThreads            Number of threads to use, <= 0 for the hardware concurrency.
+     */
+    void getSceneVerticesAndIndices(godot::Node* root, int parsedGeometryType, int numThreads, std::vector<float>& outVertices, std::vector<int>& outIndices);
+
 private:
-    void addVertex(const godot::Vector3& p_vec3, std::vector<float>& _verticies);
-    void addMesh(const godot::Ref<godot::ArrayMesh>& p_mesh, const godot::Transform& p_xform, std::vector<float>& p_vertices, std::vector<int>& p_indices);
+    /**
+     * @brief A single triangle surface found while parsing and where its transformed triangles go in the output.
+     */
+    struct ParsedSurface
+    {
+        godot::Transform        transform;
+        godot::PoolVector3Array vertices;
+        godot::PoolIntArray     indices;    // Empty if the surface is not indexed
+
+        int                     vertexCount;
+        int                     indexCount;
+        size_t                  firstVertex;
+        size_t                  firstIndex;
+    };
+
+    void addMesh(const godot::Ref<godot::Mesh>& p_mesh, const godot::Transform& p_xform, std::vector<float>& p_vertices, std::vector<int>& p_indices);
     void parseGeometry(godot::MeshInstance* meshInstance, std::vector<float>& p_vertices, std::vector<int>& p_indices);
-};
 
-inline void
-GodotGeometryParser::addVertex(const godot::Vector3& p_vec3, std::vector<float>& p_vertices)
-{
-    p_vertices.emplace_back(p_vec3.x);
-    p_vertices.emplace_back(p_vec3.y);
-    p_vertices.emplace_back(p_vec3.z);
-}
+    /**
+     * @brief Recursively gathers the surfaces of the node and its children.
+     *          The transform is the parent's accumulated transform and is only applied if the parent is a Spatial.
+     */
+    void collectSurfaces(godot::Node* node, const godot::Transform& parentTransform, int parsedGeometryType, std::vector<ParsedSurface>& surfaces);
+
+    /**
+     * @brief Gathers the triangle surfaces of the mesh.
+     */
+    void collectMesh(const godot::Ref<godot::Mesh>& mesh, const godot::Transform& transform, std::vector<ParsedSurface>& surfaces);
+
+    /**
+     * @brief Gathers the triangles of the collision shape.
+     */
+    void collectShape(const godot::Ref<godot::Shape>& shape, const godot::Transform& transform, std::vector<ParsedSurface>& surfaces);
+
+    /**
+     * @brief Grows the output by the size of all surfaces and assigns each surface its range in it.
+     */
+    void layoutSurfaces(std::vector<ParsedSurface>& surfaces, std::vector<float>& p_vertices, std::vector<int>& p_indices);
+
+    /**
+     * @brief Transforms the triangles of the surface into its range of the output. Only reads the surface's pool arrays
+     *          and writes to its own range, no scene objects are touched, so surfaces can be transformed on multiple threads at once.
+     */
+    void transformSurface(const ParsedSurface& surface, float* p_vertices, int* p_indices);
+};
 #endif // GDGEOMETRYPARSER_H
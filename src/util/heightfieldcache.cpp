@@ -0,0 +1,167 @@
+#include "heightfieldcache.h"
+#include <Recast.h>
+#include <utility>
+#include "navigationmeshhelpers.h"
+
+/**
+ * @brief Moves all data of the source heightfield into the (not yet created) target heightfield.
+ */
+static void
+moveHeightfield(rcHeightfield& source, rcHeightfield& target)
+{
+    std::swap(source.width, target.width);
+    std::swap(source.height, target.height);
+    std::swap(source.bmin, target.bmin);
+    std::swap(source.bmax, target.bmax);
+    std::swap(source.cs, target.cs);
+    std::swap(source.ch, target.ch);
+    std::swap(source.spans, target.spans);
+    std::swap(source.pools, target.pools);
+    std::swap(source.freelist, target.freelist);
+}
+
+HeightfieldCache::HeightfieldCache(int numUsers, int maxEntries)
+    : _numUsers(numUsers)
+    , _maxEntries(maxEntries)
+    , _nextAge(0)
+{
+}
+
+HeightfieldCache::~HeightfieldCache()
+{
+    clear();
+}
+
+bool
+HeightfieldCache::getHeightfield(rcContext* context, int tileX, int tileZ, float minY, float maxY, rcHeightfield& target, std::function<bool(rcHeightfield&)> rasterize)
+{
+    std::tuple<int, int, float, float> key = std::make_tuple(tileX, tileZ, minY, maxY);
+    std::unique_lock<std::mutex> lock(_mutex);
+    auto it = _entries.find(key);
+    if (it == _entries.end() && (int)_entries.size() >= _maxEntries && !evictOldestEntry())
+    {
+        // Cache is full of heightfields in use, so don't share this one
+        lock.unlock();
+        return rasterize(target);
+    }
+    if (it != _entries.end())
+    {
+        it->second.activeRequests++;
+    }
+    else
+    {
+        // First one to request this tile, so rasterize it
+        Entry& newEntry = _entries[key];
+        newEntry.solid = rcAllocHeightfield();
+        newEntry.remainingUsers = _numUsers;
+        newEntry.activeCopies = 0;
+        newEntry.activeRequests = 1;
+        newEntry.age = _nextAge++;
+        newEntry.done = false;
+        newEntry.valid = false;
+        lock.unlock();
+
+        bool valid = newEntry.solid && rasterize(*newEntry.solid);
+
+        lock.lock();
+        newEntry.done = true;
+        newEntry.valid = valid;
+        _entryChanged.notify_all();
+        it = _entries.find(key);
+    }
+
+    // Wait for whoever rasterizes this tile
+    Entry& entry = it->second;
+    _entryChanged.wait(lock, [&entry] { return entry.done; });
+
+    // The last user can simply take the heightfield (once nobody is copying it anymore), all others need a copy
+    entry.remainingUsers--;
+    bool isLastUser = entry.remainingUsers <= 0;
+    bool success = entry.valid;
+    if (success)
+    {
+        if (isLastUser)
+        {
+            _entryChanged.wait(lock, [&entry] { return entry.activeCopies == 0; });
+            moveHeightfield(*entry.solid, target);
+        }
+        else
+        {
+            entry.activeCopies++;
+            lock.unlock();
+            success = copyHeightfield(context, *entry.solid, target);
+            lock.lock();
+            entry.activeCopies--;
+            _entryChanged.notify_all();
+        }
+    }
+
+    entry.activeRequests--;
+    if (isLastUser)
+    {
+        rcFreeHeightField(entry.solid);
+        _entries.erase(key);
+    }
+    return success;
+}
+
+bool
+HeightfieldCache::evictOldestEntry()
+{
+    // Entries whose users did not all come by (e.g. because one of them rasterized the tile while the cache was full)
+    // would otherwise stay forever, so make room by dropping the oldest one nobody is using right now
+    auto oldest = _entries.end();
+    for (auto it = _entries.begin(); it != _entries.end(); ++it)
+    {
+        const Entry& entry = it->second;
+        if (entry.done && entry.activeRequests == 0 && (oldest == _entries.end() || entry.age < oldest->second.age))
+        {
+            oldest = it;
+        }
+    }
+    if (oldest == _entries.end())
+    {
+        return false;
+    }
+
+    rcFreeHeightField(oldest->second.solid);
+    _entries.erase(oldest);
+    return true;
+}
+
+void
+HeightfieldCache::clear()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (auto& entry : _entries)
+    {
+        rcFreeHeightField(entry.second.solid);
+    }
+    _entries.clear();
+}
+
+bool
+HeightfieldCache::copyHeightfield(rcContext* context, const rcHeightfield& source, rcHeightfield& target)
+{
+    if (!resetHeightfield(context, target, source.width, source.height, source.bmin, source.bmax, source.cs, source.ch))
+    {
+        return false;
+    }
+
+    // Spans in a column never touch, so adding them again in order recreates the exact same column
+    for (int y = 0; y < source.height; ++y)
+    {
+        for (int x = 0; x < source.width; ++x)
+        {
+            for (const rcSpan* span = source.spans[x + y * source.width]; span; span = span->next)
+            {
+                if (!rcAddSpan(context, target, x, y, span->smin, span->smax, span->area, 0))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef HEIGHTFIELDCACHE_H
+#define HEIGHTFIELDCACHE_H
+
+#include <map>
+#include <tuple>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+
+class rcContext;
+struct rcHeightfield;
+
+/**
+ * @brief Shares the rasterized (but not yet filtered) solid heightfields of tiles between navigation meshes using the same voxel settings.
+ *          The first navigation mesh to request a tile rasterizes it, all others get a copy of the result.
+ *          Once every user got its copy, the cached heightfield is freed.
+ */
+class HeightfieldCache
+{
+public:
+    /**
+     * @brief Constructor.
+     * @param numUsers      How many navigation meshes share this cache, so how often each heightfield will be requested.
+     * @param maxEntries    How many heightfields may be cached at once. Beyond that, the oldest heightfield not in use is dropped,
+     *                      or, if all are in use, heightfields are rasterized without sharing them.
+     *                      This limits memory usage if one navigation mesh is built way ahead of the others (e.g. if built on a single thread).
+     */
+    HeightfieldCache(int numUsers, int maxEntries);
+
+    /**
+     * @brief Destructor.
+     */
+    ~HeightfieldCache();
+
+    /**
+     * @brief Copies the rasterized heightfield of the tile into target. Can be called from multiple threads at once.
+     * @param rasterize The function rasterizing the heightfield, if no other user did so before. Must return false if there is nothing to rasterize or on error.
+     * @return False if the rasterization failed, true otherwise.
+     */
+    bool getHeightfield(rcContext* context, int tileX, int tileZ, float minY, float maxY, rcHeightfield& target, std::function<bool(rcHeightfield&)> rasterize);
+
+    /**
+     * @brief Frees all heightfields that have not been requested by all users (e.g. when only some navigation meshes rebuilt a tile).
+     */
+    void clear();
+
+    /**
+     * @brief Returns how many users share this cache.
+     */
+    int getNumUsers() const;
+
+private:
+    struct Entry
+    {
+        rcHeightfield*  solid;
+        int             remainingUsers;
+        int             activeCopies;
+        int             activeRequests;     // Users currently waiting for or reading this entry
+        unsigned long long age;
+        bool            done;
+        bool            valid;
+    };
+
+    /**
+     * @brief Copies all spans of the source heightfield into the target heightfield, replacing its previous content.
+     */
+    bool copyHeightfield(rcContext* context, const rcHeightfield& source, rcHeightfield& target);
+
+    /**
+     * @brief Frees the oldest entry that is not in use. Expects the mutex to be locked.
+     * @return False if all entries are in use.
+     */
+    bool evictOldestEntry();
+
+private:
+    int                     _numUsers;
+    int                     _maxEntries;
+    unsigned long long      _nextAge;
+    std::map<std::tuple<int, int, float, float>, Entry> _entries;
+    std::mutex              _mutex;
+    std::condition_variable _entryChanged;
+};
+
+// INLINES
+inline int
+HeightfieldCache::getNumUsers() const
+{
+    return _numUsers;
+}
+
+#endif // HEIGHTFIELDCACHE_H
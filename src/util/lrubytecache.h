@@ -0,0 +1,166 @@
+#ifndef LRUBYTECACHE_H
+#define LRUBYTECACHE_H
+
+#include <map>
+#include <list>
+#include <utility>
+#include <cstddef>
+
+/**
+ * @brief Keeps values by key as long as their combined size in bytes fits the budget.
+ *          Once it is exceeded, the least recently used values are dropped.
+ *          Not thread-safe, the owner has to lock it.
+ */
+template <typename Key, typename Value>
+class LruByteCache
+{
+public:
+    /**
+     * @brief Constructor.
+     * @param budget    How many bytes the values may use.
+     */
+    explicit LruByteCache(size_t budget);
+
+    /**
+     * @brief Stores the value as the most recently used one, replacing the previous value of the key.
+     *          Then drops the least recently used values until the budget fits again.
+     * @param size  How many bytes the value uses.
+     * @return False if the value alone exceeds the budget. The key is dropped then.
+     */
+    bool put(const Key& key, Value&& value, size_t size);
+
+    /**
+     * @brief Returns the value of the key and marks it as most recently used.
+     * @return Null if the key is not cached. Only valid until the cache is changed.
+     */
+    const Value* get(const Key& key);
+
+    /**
+     * @brief Drops the value of the key, if there is one.
+     */
+    void remove(const Key& key);
+
+    /**
+     * @brief Drops the values of all keys in [first, last].
+     */
+    void removeRange(const Key& first, const Key& last);
+
+    /**
+     * @brief Drops all values.
+     */
+    void clear();
+
+    /**
+     * @brief Returns how many bytes are currently used.
+     */
+    size_t getSize() const;
+
+private:
+    struct Entry
+    {
+        Key     key;
+        Value   value;
+        size_t  size;
+    };
+
+private:
+    size_t              _budget;
+    size_t              _size;
+    std::list<Entry>    _entries;   // Most recently used first
+    std::map<Key, typename std::list<Entry>::iterator> _entriesByKey;
+};
+
+// INLINES
+template <typename Key, typename Value>
+inline
+LruByteCache<Key, Value>::LruByteCache(size_t budget)
+    : _budget(budget)
+    , _size(0)
+{
+}
+
+template <typename Key, typename Value>
+inline bool
+LruByteCache<Key, Value>::put(const Key& key, Value&& value, size_t size)
+{
+    remove(key);
+    if (size > _budget)
+    {
+        return false;
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.value = std::move(value);
+    entry.size = size;
+    _size += size;
+    _entries.push_front(std::move(entry));
+    _entriesByKey[key] = _entries.begin();
+
+    // Evict the least recently used values
+    while (_size > _budget)
+    {
+        remove(_entries.back().key);
+    }
+    return true;
+}
+
+template <typename Key, typename Value>
+inline const Value*
+LruByteCache<Key, Value>::get(const Key& key)
+{
+    auto it = _entriesByKey.find(key);
+    if (it == _entriesByKey.end())
+    {
+        return nullptr;
+    }
+
+    _entries.splice(_entries.begin(), _entries, it->second);
+    return &it->second->value;
+}
+
+template <typename Key, typename Value>
+inline void
+LruByteCache<Key, Value>::remove(const Key& key)
+{
+    auto it = _entriesByKey.find(key);
+    if (it == _entriesByKey.end())
+    {
+        return;
+    }
+
+    _size -= it->second->size;
+    _entries.erase(it->second);
+    _entriesByKey.erase(it);
+}
+
+template <typename Key, typename Value>
+inline void
+LruByteCache<Key, Value>::removeRange(const Key& first, const Key& last)
+{
+    auto it = _entriesByKey.lower_bound(first);
+    while (it != _entriesByKey.end() && !(last < it->first))
+    {
+        _size -= it->second->size;
+        _entries.erase(it->second);
+        it = _entriesByKey.erase(it);
+    }
+}
+
+template <typename Key, typename Value>
+inline void
+LruByteCache<Key, Value>::clear()
+{
+    _entries.clear();
+    _entriesByKey.clear();
+    _size = 0;
+}
+
+template <typename Key, typename Value>
+inline size_t
+LruByteCache<Key, Value>::getSize() const
+{
+    return _size;
+}
+
+#endif // LRUBYTECACHE_H
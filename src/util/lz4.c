@@ -0,0 +1,304 @@
+/*
+  LZ4 block format compression
+
+  A compact implementation of the LZ4 block format as specified in
+  https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+  See lz4.h.
+
+  Part of godotdetour, under the same MIT license.
+*/
+
+#include "lz4.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/* A match is at least 4 bytes long */
+#define LZ4_MIN_MATCH 4
+
+/* The last 5 bytes of a block are always literals */
+#define LZ4_LAST_LITERALS 5
+
+/* The last match must start at least 12 bytes before the end of the block */
+#define LZ4_MF_LIMIT 12
+
+/* Matches are referenced by a 16 bit offset */
+#define LZ4_MAX_DISTANCE 65535
+
+/* Positions of 4 byte sequences seen so far, 2^12 entries */
+#define LZ4_HASH_LOG 12
+
+#define LZ4_RUN_MASK 15
+
+static uint32_t
+lz4_read32(const uint8_t* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t
+lz4_hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+/* Writes the extra bytes of a length of 15 or more, after the 15 stored in the token */
+static uint8_t*
+lz4_write_length(uint8_t* op, size_t length)
+{
+    length -= LZ4_RUN_MASK;
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+/* Reads the extra bytes of a length stored as 15 in the token. Returns 0 if the input ends before the length does */
+static int
+lz4_read_length(const uint8_t** ip, const uint8_t* iend, size_t* length)
+{
+    uint8_t s;
+    do
+    {
+        if (*ip >= iend)
+        {
+            return 0;
+        }
+        s = *(*ip)++;
+        *length += s;
+    } while (s == 255);
+    return 1;
+}
+
+/* Upper bound of the bytes needed for the token and extra bytes of a length */
+static size_t
+lz4_length_bytes(size_t length)
+{
+    return length >= LZ4_RUN_MASK ? 1 + (length - LZ4_RUN_MASK) / 255 : 0;
+}
+
+int
+LZ4_compressBound(int inputSize)
+{
+    if (inputSize < 0 || inputSize > LZ4_MAX_INPUT_SIZE)
+    {
+        return 0;
+    }
+    return inputSize + inputSize / 255 + 16;
+}
+
+int
+LZ4_compress_default(const char* src, char* dst, int srcSize, int dstCapacity)
+{
+    const uint8_t* const base = (const uint8_t*)src;
+    const uint8_t* const iend = base + srcSize;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* const oend = op + dstCapacity;
+    uint32_t table[1 << LZ4_HASH_LOG];
+    size_t literalLength;
+
+    if (srcSize < 0 || srcSize > LZ4_MAX_INPUT_SIZE || dstCapacity <= 0)
+    {
+        return 0;
+    }
+
+    /* Blocks too small for a match are stored as literals only */
+    if (srcSize > LZ4_MF_LIMIT)
+    {
+        const uint8_t* const mfLimit = iend - LZ4_MF_LIMIT;
+        const uint8_t* const matchLimit = iend - LZ4_LAST_LITERALS;
+        memset(table, 0, sizeof(table));
+
+        /* The first byte can't be matched by anything */
+        ip++;
+        while (ip <= mfLimit)
+        {
+            const uint32_t sequence = lz4_read32(ip);
+            const uint32_t hash = lz4_hash(sequence);
+            const uint8_t* ref = base + table[hash];
+            const uint8_t* matchEnd;
+            size_t matchLength;
+            size_t offset;
+            uint8_t* token;
+
+            table[hash] = (uint32_t)(ip - base);
+            if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE || lz4_read32(ref) != sequence)
+            {
+                ip++;
+                continue;
+            }
+
+            /* Extend the match backwards into the pending literals, then forwards */
+            while (ip > anchor && ref > base && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+            offset = (size_t)(ip - ref);
+            matchEnd = ip + LZ4_MIN_MATCH;
+            ref += LZ4_MIN_MATCH;
+            while (matchEnd < matchLimit && *matchEnd == *ref)
+            {
+                matchEnd++;
+                ref++;
+            }
+
+            literalLength = (size_t)(ip - anchor);
+            matchLength = (size_t)(matchEnd - ip) - LZ4_MIN_MATCH;
+            if ((size_t)(oend - op) < 1 + lz4_length_bytes(literalLength) + literalLength + 2 + lz4_length_bytes(matchLength))
+            {
+                return 0;
+            }
+
+            /* Token, literals, offset and match length */
+            token = op++;
+            if (literalLength >= LZ4_RUN_MASK)
+            {
+                *token = LZ4_RUN_MASK << 4;
+                op = lz4_write_length(op, literalLength);
+            }
+            else
+            {
+                *token = (uint8_t)(literalLength << 4);
+            }
+            memcpy(op, anchor, literalLength);
+            op += literalLength;
+
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+
+            if (matchLength >= LZ4_RUN_MASK)
+            {
+                *token |= LZ4_RUN_MASK;
+                op = lz4_write_length(op, matchLength);
+            }
+            else
+            {
+                *token |= (uint8_t)matchLength;
+            }
+
+            ip = matchEnd;
+            anchor = ip;
+
+            /* Remember a position inside the match as well, repeated data is found sooner that way */
+            if (ip <= mfLimit)
+            {
+                table[lz4_hash(lz4_read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+            }
+        }
+    }
+
+    /* The last sequence only has literals */
+    literalLength = (size_t)(iend - anchor);
+    if ((size_t)(oend - op) < 1 + lz4_length_bytes(literalLength) + literalLength)
+    {
+        return 0;
+    }
+    if (literalLength >= LZ4_RUN_MASK)
+    {
+        *op++ = LZ4_RUN_MASK << 4;
+        op = lz4_write_length(op, literalLength);
+    }
+    else
+    {
+        *op++ = (uint8_t)(literalLength << 4);
+    }
+    memcpy(op, anchor, literalLength);
+    op += literalLength;
+
+    return (int)(op - (uint8_t*)dst);
+}
+
+int
+LZ4_decompress_safe(const char* src, char* dst, int compressedSize, int dstCapacity)
+{
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* const iend = ip + compressedSize;
+    uint8_t* const obase = (uint8_t*)dst;
+    uint8_t* op = obase;
+    uint8_t* const oend = op + dstCapacity;
+
+    if (compressedSize <= 0 || dstCapacity < 0)
+    {
+        return -1;
+    }
+
+    for (;;)
+    {
+        const uint8_t token = *ip++;
+        const uint8_t* match;
+        size_t length;
+        size_t offset;
+
+        /* Literals */
+        length = token >> 4;
+        if (length == LZ4_RUN_MASK && !lz4_read_length(&ip, iend, &length))
+        {
+            return -1;
+        }
+        if ((size_t)(iend - ip) < length || (size_t)(oend - op) < length)
+        {
+            return -1;
+        }
+        memcpy(op, ip, length);
+        op += length;
+        ip += length;
+
+        /* The last sequence ends the block right after its literals */
+        if (ip == iend)
+        {
+            break;
+        }
+
+        /* Match */
+        if (iend - ip < 2)
+        {
+            return -1;
+        }
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - obase))
+        {
+            return -1;
+        }
+        length = token & LZ4_RUN_MASK;
+        if (length == LZ4_RUN_MASK && !lz4_read_length(&ip, iend, &length))
+        {
+            return -1;
+        }
+        length += LZ4_MIN_MATCH;
+        if ((size_t)(oend - op) < length)
+        {
+            return -1;
+        }
+
+        /* Matches closer than their length repeat the bytes they are copying */
+        match = op - offset;
+        if (offset >= length)
+        {
+            memcpy(op, match, length);
+            op += length;
+        }
+        else
+        {
+            while (length--)
+            {
+                *op++ = *match++;
+            }
+        }
+
+        if (ip >= iend)
+        {
+            return -1;
+        }
+    }
+
+    return (int)(op - obase);
+}
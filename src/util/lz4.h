@@ -0,0 +1,49 @@
+/*
+  LZ4 block format compression
+
+  A compact implementation of the LZ4 block format as specified in
+  https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+  Blocks are interchangeable with those of the reference library, and the
+  functions below mirror its block API, so upstream lz4.c/lz4.h can replace
+  these files without changes to the callers.
+
+  Part of godotdetour, under the same MIT license.
+*/
+
+#ifndef LZ4_H
+#define LZ4_H
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/**
+  Largest input size the block format supports.
+*/
+#define LZ4_MAX_INPUT_SIZE 0x7E000000
+
+/**
+  Returns how large the output of LZ4_compress_default() can get in the worst case
+  (incompressible input), or 0 if the input is too large.
+*/
+int LZ4_compressBound(int inputSize);
+
+/**
+  Compresses srcSize bytes of src into dst, which can hold dstCapacity bytes.
+  Returns the number of bytes written, or 0 if dst is too small or the input too large.
+  Compression never fails if dstCapacity >= LZ4_compressBound(srcSize).
+*/
+int LZ4_compress_default(const char* src, char* dst, int srcSize, int dstCapacity);
+
+/**
+  Decompresses the compressedSize bytes of the block in src into dst, which can hold dstCapacity bytes.
+  Never reads or writes outside of the buffers, even if the block is damaged.
+  Returns the number of bytes decompressed, or a negative value if the block is invalid or does not fit dst.
+*/
+int LZ4_decompress_safe(const char* src, char* dst, int compressedSize, int dstCapacity);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif /* LZ4_H */
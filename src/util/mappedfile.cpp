@@ -0,0 +1,133 @@
+#include "mappedfile.h"
+#include <Godot.hpp>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace godot;
+
+MappedFile::MappedFile()
+    : _data(nullptr)
+    , _size(0)
+#ifdef _WIN32
+    , _file(INVALID_HANDLE_VALUE)
+    , _mapping(nullptr)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+#ifdef _WIN32
+bool
+MappedFile::open(const String& path)
+{
+    close();
+
+    _file = CreateFileW(path.unicode_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (_file == INVALID_HANDLE_VALUE)
+    {
+        ERR_PRINT(String("MappedFile: Unable to open {0}").format(Array::make(path)));
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+    {
+        ERR_PRINT(String("MappedFile: Unable to get the size of {0}").format(Array::make(path)));
+        close();
+        return false;
+    }
+
+    _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!_mapping)
+    {
+        ERR_PRINT(String("MappedFile: Unable to map {0}").format(Array::make(path)));
+        close();
+        return false;
+    }
+    _data = (const unsigned char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!_data)
+    {
+        ERR_PRINT(String("MappedFile: Unable to map {0}").format(Array::make(path)));
+        close();
+        return false;
+    }
+    _size = (size_t)size.QuadPart;
+    return true;
+}
+
+void
+MappedFile::close()
+{
+    if (_data)
+    {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping)
+    {
+        CloseHandle(_mapping);
+    }
+    if (_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(_file);
+    }
+    _data = nullptr;
+    _size = 0;
+    _mapping = nullptr;
+    _file = INVALID_HANDLE_VALUE;
+}
+#else
+bool
+MappedFile::open(const String& path)
+{
+    close();
+
+    int fd = ::open(path.utf8().get_data(), O_RDONLY);
+    if (fd < 0)
+    {
+        ERR_PRINT(String("MappedFile: Unable to open {0}").format(Array::make(path)));
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ERR_PRINT(String("MappedFile: Unable to get the size of {0}").format(Array::make(path)));
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after closing the descriptor
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        ERR_PRINT(String("MappedFile: Unable to map {0}").format(Array::make(path)));
+        return false;
+    }
+    _data = (const unsigned char*)data;
+    _size = info.st_size;
+    return true;
+}
+
+void
+MappedFile::close()
+{
+    if (_data)
+    {
+        munmap((void*)_data, _size);
+    }
+    _data = nullptr;
+    _size = 0;
+}
+#endif
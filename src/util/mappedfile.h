@@ -0,0 +1,69 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <String.hpp>
+#include <cstddef>
+
+/**
+ * @brief A file mapped read-only into memory. Processes mapping the same file share its pages.
+ */
+class MappedFile
+{
+public:
+    /**
+     * @brief Constructor.
+     */
+    MappedFile();
+
+    /**
+     * @brief Destructor. Unmaps the file.
+     */
+    ~MappedFile();
+
+    /**
+     * @brief Maps the file at the passed absolute path (not res:// or user://).
+     * @return False if the file could not be opened or mapped.
+     */
+    bool open(const godot::String& path);
+
+    /**
+     * @brief Unmaps the file. All pointers into it become invalid.
+     */
+    void close();
+
+    /**
+     * @brief Returns the mapped content of the file.
+     */
+    const unsigned char* getData() const;
+
+    /**
+     * @brief Returns the size of the file in bytes.
+     */
+    size_t getSize() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char*    _data;
+    size_t                  _size;
+#ifdef _WIN32
+    void*                   _file;
+    void*                   _mapping;
+#endif
+};
+
+// INLINES
+inline const unsigned char*
+MappedFile::getData() const
+{
+    return _data;
+}
+
+inline size_t
+MappedFile::getSize() const
+{
+    return _size;
+}
+
+#endif // MAPPEDFILE_H
@@ -6,24 +6,354 @@
 #include <Material.hpp>
 #include <File.hpp>
 #include "godotgeometryparser.h"
+#include "bulkfile.h"
+#include <unordered_map>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cmath>
 
 using namespace godot;
 
-#define MDA_SAVE_VERSION 1
+#define MDA_SAVE_VERSION 2
+
+/**
+ * @brief Cell of the welding grid.
+ */
+struct WeldCell
+{
+    int64_t x, y, z;
+
+    bool operator==(const WeldCell& other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+struct WeldCellHash
+{
+    size_t operator()(const WeldCell& cell) const
+    {
+        return (size_t)(cell.x * 73856093) ^ (size_t)(cell.y * 19349663) ^ (size_t)(cell.z * 83492791);
+    }
+};
+
+/**
+ * @brief Spreads the lower 16 bits of the value to the even bits.
+ */
+static uint32_t
+spreadBits(uint32_t value)
+{
+    value &= 0x0000ffff;
+    value = (value | (value << 8)) & 0x00ff00ff;
+    value = (value | (value << 4)) & 0x0f0f0f0f;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+MeshPreprocessStats::MeshPreprocessStats()
+    : inputVertices(0)
+    , inputTriangles(0)
+    , outputVertices(0)
+    , outputTriangles(0)
+    , weldedVertices(0)
+    , unusedVertices(0)
+    , degenerateTriangles(0)
+    , invalidTriangles(0)
+    , inputBytes(0)
+    , outputBytes(0)
+    , timeUsec(0)
+{
+
+}
+
+void
+MeshPreprocessStats::add(const MeshPreprocessStats& other)
+{
+    inputVertices += other.inputVertices;
+    inputTriangles += other.inputTriangles;
+    outputVertices += other.outputVertices;
+    outputTriangles += other.outputTriangles;
+    weldedVertices += other.weldedVertices;
+    unusedVertices += other.unusedVertices;
+    degenerateTriangles += other.degenerateTriangles;
+    invalidTriangles += other.invalidTriangles;
+    inputBytes += other.inputBytes;
+    outputBytes += other.outputBytes;
+    timeUsec += other.timeUsec;
+}
 
 MeshDataAccumulator::MeshDataAccumulator(MeshInstance* meshInstance)
 {
+    append(meshInstance);
+}
+
+MeshDataAccumulator::MeshDataAccumulator()
+{
+
+}
+
+
+MeshDataAccumulator::~MeshDataAccumulator()
+{
+
+}
+
+void
+MeshDataAccumulator::append(MeshInstance* meshInstance)
+{
+    // The parser appends, offsetting the new indices by the vertices already present
+    int firstVert = getVertCount();
+    int firstTri = getTriCount();
     GodotGeometryParser parser;
     parser.getNodeVerticesAndIndices(meshInstance, _vertices, _triangles);
 
     Godot::print("Got vertices and triangles...");
 
+    preprocess(firstVert, firstTri);
+    Godot::print("Preprocessed geometry...");
+}
+
+void
+MeshDataAccumulator::appendScene(Node* root, int parsedGeometryType, int numThreads)
+{
+    int firstVert = getVertCount();
+    int firstTri = getTriCount();
+    GodotGeometryParser parser;
+    parser.getSceneVerticesAndIndices(root, parsedGeometryType, numThreads, _vertices, _triangles);
+
+    Godot::print("Got vertices and triangles...");
+
+    preprocess(firstVert, firstTri);
+    Godot::print("Preprocessed geometry...");
+}
+
+void
+MeshDataAccumulator::remove(int firstVert, int numVerts, int firstTri, int numTris)
+{
+    _vertices.erase(_vertices.begin() + firstVert * 3, _vertices.begin() + (firstVert + numVerts) * 3);
+    _triangles.erase(_triangles.begin() + firstTri * 3, _triangles.begin() + (firstTri + numTris) * 3);
+    _normals.erase(_normals.begin() + firstTri * 3, _normals.begin() + (firstTri + numTris) * 3);
+
+    for (int i = firstTri * 3; i < _triangles.size(); ++i)
+    {
+        if (_triangles[i] >= firstVert + numVerts)
+        {
+            _triangles[i] -= numVerts;
+        }
+    }
+}
+
+void
+MeshDataAccumulator::preprocess(int firstVert, int firstTri)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    MeshPreprocessStats stats;
+    int numVerts = getVertCount() - firstVert;
+    int numTris = getTriCount() - firstTri;
+    stats.inputVertices = numVerts;
+    stats.inputTriangles = numTris;
+    stats.inputBytes = numVerts * 3 * sizeof(float) + numTris * 3 * (sizeof(int) + sizeof(float));
+
+    // Weld vertices falling into the same grid cell, dropping non-finite ones
+    const float* verts = &_vertices[firstVert * 3];
+    std::vector<int> weldedIndex(numVerts, -1);
+    std::vector<float> weldedVerts;
+    weldedVerts.reserve(numVerts * 3);
+    std::unordered_map<WeldCell, int, WeldCellHash> cells;
+    cells.reserve(numVerts);
+    for (int i = 0; i < numVerts; ++i)
+    {
+        const float* v = &verts[i * 3];
+        if (!std::isfinite(v[0]) || !std::isfinite(v[1]) || !std::isfinite(v[2]))
+        {
+            continue;
+        }
+
+        WeldCell cell;
+        cell.x = (int64_t)std::floor(v[0] / MESH_WELD_TOLERANCE);
+        cell.y = (int64_t)std::floor(v[1] / MESH_WELD_TOLERANCE);
+        cell.z = (int64_t)std::floor(v[2] / MESH_WELD_TOLERANCE);
+        auto inserted = cells.emplace(cell, (int)(weldedVerts.size() / 3));
+        if (inserted.second)
+        {
+            weldedVerts.insert(weldedVerts.end(), v, v + 3);
+        }
+        else
+        {
+            stats.weldedVertices++;
+        }
+        weldedIndex[i] = inserted.first->second;
+    }
+    cells.clear();
+
+    // Drop invalid and degenerate triangles
+    const int* tris = &_triangles[firstTri * 3];
+    std::vector<int> keptTris;
+    keptTris.reserve(numTris * 3);
+    for (int i = 0; i < numTris; ++i)
+    {
+        int t[3];
+        bool valid = true;
+        for (int k = 0; k < 3; ++k)
+        {
+            int index = tris[i * 3 + k] - firstVert;
+            t[k] = (index >= 0 && index < numVerts) ? weldedIndex[index] : -1;
+            valid = valid && t[k] >= 0;
+        }
+        if (!valid)
+        {
+            stats.invalidTriangles++;
+            continue;
+        }
+        if (t[0] == t[1] || t[1] == t[2] || t[0] == t[2])
+        {
+            stats.degenerateTriangles++;
+            continue;
+        }
+
+        const float* v0 = &weldedVerts[t[0] * 3];
+        const float* v1 = &weldedVerts[t[1] * 3];
+        const float* v2 = &weldedVerts[t[2] * 3];
+        float e0[3], e1[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            e0[k] = v1[k] - v0[k];
+            e1[k] = v2[k] - v0[k];
+        }
+        float nx = e0[1]*e1[2] - e0[2]*e1[1];
+        float ny = e0[2]*e1[0] - e0[0]*e1[2];
+        float nz = e0[0]*e1[1] - e0[1]*e1[0];
+        if (nx*nx + ny*ny + nz*nz < MESH_DEGENERATE_AREA)
+        {
+            stats.degenerateTriangles++;
+            continue;
+        }
+
+        keptTris.insert(keptTris.end(), t, t + 3);
+    }
+    weldedIndex.clear();
+    weldedIndex.shrink_to_fit();
+
+    // Sort the triangles along a z-order curve of their centroids on the xz plane
+    int numKept = keptTris.size() / 3;
+    std::vector<uint32_t> codes(numKept);
+    std::vector<int> order(numKept);
+    std::iota(order.begin(), order.end(), 0);
+    if (numKept > 0)
+    {
+        float bmin[2] = { weldedVerts[0], weldedVerts[2] };
+        float bmax[2] = { weldedVerts[0], weldedVerts[2] };
+        for (int i = 1; i < weldedVerts.size() / 3; ++i)
+        {
+            bmin[0] = std::min(bmin[0], weldedVerts[i * 3 + 0]);
+            bmin[1] = std::min(bmin[1], weldedVerts[i * 3 + 2]);
+            bmax[0] = std::max(bmax[0], weldedVerts[i * 3 + 0]);
+            bmax[1] = std::max(bmax[1], weldedVerts[i * 3 + 2]);
+        }
+        float scaleX = 65535.0f / std::max(bmax[0] - bmin[0], 1e-6f);
+        float scaleZ = 65535.0f / std::max(bmax[1] - bmin[1], 1e-6f);
+        for (int i = 0; i < numKept; ++i)
+        {
+            const int* t = &keptTris[i * 3];
+            float cx = (weldedVerts[t[0] * 3 + 0] + weldedVerts[t[1] * 3 + 0] + weldedVerts[t[2] * 3 + 0]) / 3.0f;
+            float cz = (weldedVerts[t[0] * 3 + 2] + weldedVerts[t[1] * 3 + 2] + weldedVerts[t[2] * 3 + 2]) / 3.0f;
+            uint32_t qx = (uint32_t)((cx - bmin[0]) * scaleX);
+            uint32_t qz = (uint32_t)((cz - bmin[1]) * scaleZ);
+            codes[i] = spreadBits(qx) | (spreadBits(qz) << 1);
+        }
+        std::stable_sort(order.begin(), order.end(), [&codes](int a, int b) {
+            return codes[a] < codes[b];
+        });
+    }
+
+    // Write the vertices back in the order the sorted triangles first use them, leaving out unused ones
+    std::vector<int> newIndex(weldedVerts.size() / 3, -1);
+    _vertices.resize(firstVert * 3);
+    _triangles.resize(firstTri * 3);
+    _vertices.reserve(firstVert * 3 + weldedVerts.size());
+    _triangles.reserve((firstTri + numKept) * 3);
+    int nextVert = firstVert;
+    for (int i = 0; i < numKept; ++i)
+    {
+        const int* t = &keptTris[order[i] * 3];
+        for (int k = 0; k < 3; ++k)
+        {
+            if (newIndex[t[k]] < 0)
+            {
+                newIndex[t[k]] = nextVert++;
+                _vertices.insert(_vertices.end(), &weldedVerts[t[k] * 3], &weldedVerts[t[k] * 3] + 3);
+            }
+            _triangles.push_back(newIndex[t[k]]);
+        }
+    }
+    _vertices.shrink_to_fit();
+    _triangles.shrink_to_fit();
+
+    stats.outputVertices = nextVert - firstVert;
+    stats.outputTriangles = numKept;
+    stats.unusedVertices = weldedVerts.size() / 3 - stats.outputVertices;
+    stats.outputBytes = stats.outputVertices * 3 * sizeof(float) + numKept * 3 * (sizeof(int) + sizeof(float));
+
+    calcNormals(firstTri);
+
+    stats.timeUsec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+    _preprocessStats.add(stats);
+}
+
+void
+MeshDataAccumulator::calcNormals(int firstTri)
+{
     // Copy normals (we can't just copy them from the MeshDataTool since we operate on transformed values)
     // Code below mostly taken from recastnavigation sample
-    size_t indexCount = _triangles.size();
-    _normals.resize(indexCount);
-    for (int j = 0; j < indexCount; j += 3)
+    int triCount = getTriCount();
+    _normals.resize(triCount * 3);
+    int i = firstTri;
+
+#ifdef GEOMETRY_SSE
+    // Four triangles at once, one component of all four per register
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (; i + 4 <= triCount; i += 4)
     {
+        const int* t = &_triangles[i * 3];
+        __m128 v0[3], e0[3], e1[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            v0[k] = _mm_setr_ps(_vertices[t[0] * 3 + k], _vertices[t[3] * 3 + k], _vertices[t[6] * 3 + k], _vertices[t[9] * 3 + k]);
+            e0[k] = _mm_sub_ps(_mm_setr_ps(_vertices[t[1] * 3 + k], _vertices[t[4] * 3 + k], _vertices[t[7] * 3 + k], _vertices[t[10] * 3 + k]), v0[k]);
+            e1[k] = _mm_sub_ps(_mm_setr_ps(_vertices[t[2] * 3 + k], _vertices[t[5] * 3 + k], _vertices[t[8] * 3 + k], _vertices[t[11] * 3 + k]), v0[k]);
+        }
+        __m128 n[3];
+        n[0] = _mm_sub_ps(_mm_mul_ps(e0[1], e1[2]), _mm_mul_ps(e0[2], e1[1]));
+        n[1] = _mm_sub_ps(_mm_mul_ps(e0[2], e1[0]), _mm_mul_ps(e0[0], e1[2]));
+        n[2] = _mm_sub_ps(_mm_mul_ps(e0[0], e1[1]), _mm_mul_ps(e0[1], e1[0]));
+        __m128 d = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], n[0]), _mm_mul_ps(n[1], n[1])), _mm_mul_ps(n[2], n[2])));
+
+        // Zero length normals are left as they are
+        __m128 valid = _mm_cmpgt_ps(d, zero);
+        __m128 scale = _mm_or_ps(_mm_and_ps(valid, _mm_div_ps(one, d)), _mm_andnot_ps(valid, one));
+
+        float result[3][4];
+        for (int k = 0; k < 3; ++k)
+        {
+            _mm_storeu_ps(result[k], _mm_mul_ps(n[k], scale));
+        }
+        float* out = &_normals[i * 3];
+        for (int j = 0; j < 4; ++j)
+        {
+            out[j * 3 + 0] = result[0][j];
+            out[j * 3 + 1] = result[1][j];
+            out[j * 3 + 2] = result[2][j];
+        }
+    }
+#endif
+
+    for (; i < triCount; ++i)
+    {
+        int j = i * 3;
         const float* v0 = &_vertices[_triangles[j + 0] * 3];
         const float* v1 = &_vertices[_triangles[j + 1] * 3];
         const float* v2 = &_vertices[_triangles[j + 2] * 3];
@@ -46,46 +376,18 @@ MeshDataAccumulator::MeshDataAccumulator(MeshInstance* meshInstance)
             n[2] *= d;
         }
     }
-    Godot::print("Got normals...");
-}
-
-MeshDataAccumulator::MeshDataAccumulator()
-{
-
-}
-
-
-MeshDataAccumulator::~MeshDataAccumulator()
-{
-
 }
 
 void
-MeshDataAccumulator::save(Ref<File> targetFile)
+MeshDataAccumulator::save(SaveBuffer* targetFile)
 {
     // Store version
     targetFile->store_16(MDA_SAVE_VERSION);
 
-    // Store vertices
-    targetFile->store_32(_vertices.size());
-    for(int i = 0; i < _vertices.size(); ++i)
-    {
-        targetFile->store_float(_vertices[i]);
-    }
-
-    // Store triangles
-    targetFile->store_32(_triangles.size());
-    for(int i = 0; i < _triangles.size(); ++i)
-    {
-        targetFile->store_32(_triangles[i]);
-    }
-
-    // Store normals
-    targetFile->store_32(_normals.size());
-    for (int i = 0; i < _normals.size(); ++i)
-    {
-        targetFile->store_float(_normals[i]);
-    }
+    // Store vertices, triangles and normals
+    storeArray(targetFile, _vertices);
+    storeArray(targetFile, _triangles);
+    storeArray(targetFile, _normals);
 }
 
 bool
@@ -96,6 +398,15 @@ MeshDataAccumulator::load(Ref<File> sourceFile)
 
     // Newest version
     if (version == MDA_SAVE_VERSION)
+    {
+        if (!loadArray(sourceFile, _vertices) || !loadArray(sourceFile, _triangles) || !loadArray(sourceFile, _normals))
+        {
+            ERR_PRINT("MeshDataAccumulator: Unable to load mesh data.");
+            return false;
+        }
+    }
+    // Version 1 stored each value separately
+    else if (version == 1)
     {
         // Vertices
         int size = sourceFile->get_32();
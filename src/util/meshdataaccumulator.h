@@ -2,6 +2,7 @@
 #define MESHDATAACCUMULATOR_H
 
 #include <vector>
+#include <cstdint>
 #include <ArrayMesh.hpp>
 #include <Transform.hpp>
 #include <MeshInstance.hpp>
@@ -11,6 +12,34 @@ namespace godot
 {
     class File;
 }
+class SaveBuffer;
+
+// Vertices closer than this are welded into one (as long as they fall into the same cell of a grid this size)
+#define MESH_WELD_TOLERANCE 0.0001f
+// Triangles with a squared doubled area below this are dropped as degenerate
+#define MESH_DEGENERATE_AREA 1e-12f
+
+/**
+ * @brief What preprocessing the appended geometry did, summed up over all appends.
+ */
+struct MeshPreprocessStats
+{
+    int     inputVertices;
+    int     inputTriangles;
+    int     outputVertices;
+    int     outputTriangles;
+    int     weldedVertices;         // Merged into a coincident vertex
+    int     unusedVertices;         // Not referenced by any remaining triangle
+    int     degenerateTriangles;    // Collapsed to a line or point
+    int     invalidTriangles;       // Non-finite coordinates or indices outside the vertex range
+    size_t  inputBytes;             // Vertices, indices and normals before preprocessing
+    size_t  outputBytes;            // And after
+    int64_t timeUsec;
+
+    MeshPreprocessStats();
+
+    void add(const MeshPreprocessStats& other);
+};
 
 /**
  * @brief Gets all the vertices, faces, etc. from an ArrayMesh and combines it into a single set of data (vertices, indices, ...).
@@ -54,10 +83,35 @@ public:
      */
     const float* getNormals();
 
+    /**
+     * @brief Returns what the preprocessing of all appended geometry saved.
+     */
+    const MeshPreprocessStats& getPreprocessStats() const;
+
+    /**
+     * @brief Appends the geometry of the mesh instance to the existing data.
+     *          The new geometry is preprocessed: coincident vertices are welded, degenerate and invalid triangles dropped
+     *          and the triangles sorted along a space-filling curve, so nearby triangles and their vertices are close in memory.
+     */
+    void append(godot::MeshInstance* meshInstance);
+
+    /**
+     * @brief Appends the geometry of the node and all its children to the existing data. Preprocessed like append().
+     * @param parsedGeometryType    Which geometry to parse, one of the PARSED_GEOMETRY_* defines.
+     * @param numThreads            Number of threads to transform the geometry on, <= 0 for the hardware concurrency.
+     */
+    void appendScene(godot::Node* root, int parsedGeometryType, int numThreads);
+
+    /**
+     * @brief Removes the passed ranges of vertices and triangles. The triangles must only use the removed vertices.
+     *          Indices of the triangles behind them are adjusted to the vertices moving forward.
+     */
+    void remove(int firstVert, int numVerts, int firstTri, int numTris);
+
     /**
      * @brief Store the mesh to the target file.
      */
-    void save(godot::Ref<godot::File> targetFile);
+    void save(SaveBuffer* targetFile);
 
     /**
      * @brief Load the mesh from the source file.
@@ -65,10 +119,23 @@ public:
     bool load(godot::Ref<godot::File> sourceFile);
 
 
+private:
+    /**
+     * @brief Welds, filters and reorders the vertices and triangles starting at the passed ones, then calculates their normals.
+     *          The triangles must only use vertices starting at firstVert.
+     */
+    void preprocess(int firstVert, int firstTri);
+
+    /**
+     * @brief Calculates the normals of all triangles starting at the passed one.
+     */
+    void calcNormals(int firstTri);
+
 private:
     std::vector<float>  _vertices;
     std::vector<int>    _triangles;
     std::vector<float>  _normals;
+    MeshPreprocessStats _preprocessStats;
 };
 
 // ------------------------------------------------------------
@@ -103,4 +170,10 @@ MeshDataAccumulator::getNormals()
     return _normals.data();
 }
 
+inline const MeshPreprocessStats&
+MeshDataAccumulator::getPreprocessStats() const
+{
+    return _preprocessStats;
+}
+
 #endif // MESHDATAACCUMULATOR_H
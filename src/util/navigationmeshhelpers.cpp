@@ -5,65 +5,140 @@
 #include <cstring>
 #include "detourinputgeometry.h"
 
+AllocatorStats::AllocatorStats()
+    : capacity(0)
+    , live(0)
+    , peak(0)
+    , overflows(0)
+    , failures(0)
+{
+}
+
+void
+AllocatorStats::add(const AllocatorStats& other)
+{
+    capacity += other.capacity;
+    live += other.live;
+    peak += other.peak;
+    overflows += other.overflows;
+    failures += other.failures;
+}
+
 LinearAllocator::LinearAllocator(const size_t cap)
     : buffer(0)
     , capacity(0)
     , top(0)
-    , high(0)
+    , retiredCapacity(0)
 {
     resize(cap);
 }
 
 LinearAllocator::~LinearAllocator()
 {
+    freeRetiredChunks();
     dtFree(buffer);
 }
 
 void
 LinearAllocator::resize(const size_t cap)
 {
+    freeRetiredChunks();
     if (buffer) dtFree(buffer);
     buffer = (unsigned char*)dtAlloc(cap, DT_ALLOC_PERM);
-    capacity = cap;
+    capacity = buffer ? cap : 0;
+    top = 0;
+    stats.capacity = capacity;
+    stats.live = 0;
 }
 
 
 void
 LinearAllocator::reset()
 {
-    high = dtMax(high, top);
+    // The current chunk is the largest one, so it is the one to keep
+    freeRetiredChunks();
     top = 0;
+    stats.capacity = capacity;
+    stats.live = 0;
 }
 
 void*
 LinearAllocator::alloc(const size_t size)
 {
-    if (!buffer)
-        return 0;
-    if (top+size > capacity)
-        return 0;
+    if (!buffer || top+size > capacity)
+    {
+        if (!grow(size))
+        {
+            stats.failures++;
+            return 0;
+        }
+    }
     unsigned char* mem = &buffer[top];
     top += size;
+
+    stats.live += size;
+    stats.peak = dtMax(stats.peak, stats.live);
     return mem;
 }
 
+bool
+LinearAllocator::grow(const size_t size)
+{
+    size_t newCapacity = dtMax(capacity * 2, size);
+    unsigned char* newBuffer = (unsigned char*)dtAlloc(newCapacity, DT_ALLOC_PERM);
+    if (!newBuffer)
+    {
+        return false;
+    }
+
+    // Previous allocations stay valid until the next reset
+    if (buffer)
+    {
+        retiredChunks.push_back(buffer);
+        retiredCapacity += capacity;
+        stats.overflows++;
+    }
+    buffer = newBuffer;
+    capacity = newCapacity;
+    top = 0;
+    stats.capacity = capacity + retiredCapacity;
+    return true;
+}
+
+void
+LinearAllocator::freeRetiredChunks()
+{
+    for (int i = 0; i < retiredChunks.size(); ++i)
+    {
+        dtFree(retiredChunks[i]);
+    }
+    retiredChunks.clear();
+    retiredCapacity = 0;
+}
+
 void
 LinearAllocator::free(void* /*ptr*/)
 {
     // Empty
 }
 
+FastLZCompressor::FastLZCompressor(int compressionLevel)
+    : level(compressionLevel)
+{
+}
+
 int
 FastLZCompressor::maxCompressedSize(const int bufferSize)
 {
-    return (int)(bufferSize* 1.05f);
+    // FastLZ needs 5% more than the input in the worst case, but never less than 66 bytes
+    return dtMax((int)(bufferSize * 1.05f) + 1, 66);
 }
 
 dtStatus
 FastLZCompressor::compress(const unsigned char* buffer, const int bufferSize,
                           unsigned char* compressed, const int /*maxCompressedSize*/, int* compressedSize)
 {
-    *compressedSize = fastlz_compress((const void *const)buffer, bufferSize, compressed);
+    *compressedSize = fastlz_compress_level(level, (const void *const)buffer, bufferSize, compressed);
     return DT_SUCCESS;
 }
 
@@ -75,6 +150,80 @@ FastLZCompressor::decompress(const unsigned char* compressed, const int compress
     return *bufferSize < 0 ? DT_FAILURE : DT_SUCCESS;
 }
 
+int
+LZ4Compressor::maxCompressedSize(const int bufferSize)
+{
+    return LZ4_compressBound(bufferSize);
+}
+
+dtStatus
+LZ4Compressor::compress(const unsigned char* buffer, const int bufferSize,
+                        unsigned char* compressed, const int maxCompressedSize, int* compressedSize)
+{
+    *compressedSize = LZ4_compress_default((const char*)buffer, (char*)compressed, bufferSize, maxCompressedSize);
+    return *compressedSize > 0 ? DT_SUCCESS : DT_FAILURE | DT_BUFFER_TOO_SMALL;
+}
+
+dtStatus
+LZ4Compressor::decompress(const unsigned char* compressed, const int compressedSize,
+                          unsigned char* buffer, const int maxBufferSize, int* bufferSize)
+{
+    *bufferSize = LZ4_decompress_safe((const char*)compressed, (char*)buffer, compressedSize, maxBufferSize);
+    return *bufferSize < 0 ? DT_FAILURE : DT_SUCCESS;
+}
+
+int
+NoCompressor::maxCompressedSize(const int bufferSize)
+{
+    return bufferSize;
+}
+
+dtStatus
+NoCompressor::compress(const unsigned char* buffer, const int bufferSize,
+                       unsigned char* compressed, const int maxCompressedSize, int* compressedSize)
+{
+    if (bufferSize > maxCompressedSize)
+    {
+        return DT_FAILURE | DT_BUFFER_TOO_SMALL;
+    }
+    memcpy(compressed, buffer, bufferSize);
+    *compressedSize = bufferSize;
+    return DT_SUCCESS;
+}
+
+dtStatus
+NoCompressor::decompress(const unsigned char* compressed, const int compressedSize,
+                         unsigned char* buffer, const int maxBufferSize, int* bufferSize)
+{
+    if (compressedSize > maxBufferSize)
+    {
+        return DT_FAILURE | DT_BUFFER_TOO_SMALL;
+    }
+    memcpy(buffer, compressed, compressedSize);
+    *bufferSize = compressedSize;
+    return DT_SUCCESS;
+}
+
+CompressionBenchmark::CompressionBenchmark(int tileCompression)
+    : compression(tileCompression)
+    , tiles(0)
+    , rawBytes(0)
+    , compressedBytes(0)
+    , compressUsec(0)
+    , decompressUsec(0)
+{
+}
+
+void
+CompressionBenchmark::add(const CompressionBenchmark& other)
+{
+    tiles += other.tiles;
+    rawBytes += other.rawBytes;
+    compressedBytes += other.compressedBytes;
+    compressUsec += other.compressUsec;
+    decompressUsec += other.decompressUsec;
+}
+
 void
 MeshProcess::process(struct dtNavMeshCreateParams* params,
                      unsigned char* polyAreas, unsigned short* polyFlags)
@@ -118,12 +267,16 @@ MeshProcess::process(struct dtNavMeshCreateParams* params,
 
 RasterizationContext::RasterizationContext(int layerCount) :
     solid(0),
-    triareas(0),
     lset(0),
     chf(0),
+    chfCellCapacity(0),
+    chfSpanCapacity(0),
     ntiles(0),
     numLayers(layerCount)
 {
+    solid = rcAllocHeightfield();
+    lset = rcAllocHeightfieldLayerSet();
+    chf = rcAllocCompactHeightfield();
     tiles = new TileCacheData[numLayers];
     memset(tiles, 0, sizeof(TileCacheData) * numLayers);
 }
@@ -131,7 +284,6 @@ RasterizationContext::RasterizationContext(int layerCount) :
 RasterizationContext::~RasterizationContext()
 {
     rcFreeHeightField(solid);
-    delete [] triareas;
     rcFreeHeightfieldLayerSet(lset);
     rcFreeCompactHeightfield(chf);
     for (int i = 0; i < numLayers; ++i)
@@ -142,9 +294,539 @@ RasterizationContext::~RasterizationContext()
     delete [] tiles;
 }
 
+void
+RasterizationContext::reset()
+{
+    for (int i = 0; i < numLayers; ++i)
+    {
+        dtFree(tiles[i].data);
+        tiles[i].data = 0;
+        tiles[i].dataSize = 0;
+    }
+    ntiles = 0;
+
+    // rcBuildHeightfieldLayers does not free the layers it finds in the set
+    if (lset)
+    {
+        for (int i = 0; i < lset->nlayers; ++i)
+        {
+            rcFree(lset->layers[i].heights);
+            rcFree(lset->layers[i].areas);
+            rcFree(lset->layers[i].cons);
+        }
+        rcFree(lset->layers);
+        lset->layers = 0;
+        lset->nlayers = 0;
+    }
+}
+
+bool
+RasterizationContext::reserveCompactHeightfield(int cellCount, int spanCount)
+{
+    // Only grow the arrays, never shrink them
+    if (cellCount > chfCellCapacity)
+    {
+        rcFree(chf->cells);
+        chf->cells = (rcCompactCell*)rcAlloc(sizeof(rcCompactCell) * cellCount, RC_ALLOC_PERM);
+        chfCellCapacity = chf->cells ? cellCount : 0;
+    }
+    if (spanCount > chfSpanCapacity)
+    {
+        rcFree(chf->spans);
+        rcFree(chf->areas);
+        chf->spans = (rcCompactSpan*)rcAlloc(sizeof(rcCompactSpan) * spanCount, RC_ALLOC_PERM);
+        chf->areas = (unsigned char*)rcAlloc(sizeof(unsigned char) * spanCount, RC_ALLOC_PERM);
+        chfSpanCapacity = chf->spans && chf->areas ? spanCount : 0;
+    }
+    return chf->cells && (spanCount == 0 || chfSpanCapacity > 0);
+}
+
+bool
+RasterizationContext::buildCompactHeightfield(rcContext* context, const int walkableHeight, const int walkableClimb)
+{
+    rcScopedTimer timer(context, RC_TIMER_BUILD_COMPACTHEIGHTFIELD);
+
+    const int w = solid->width;
+    const int h = solid->height;
+    const int spanCount = rcGetHeightFieldSpanCount(context, *solid);
+
+    // Fill in header
+    chf->width = w;
+    chf->height = h;
+    chf->spanCount = spanCount;
+    chf->walkableHeight = walkableHeight;
+    chf->walkableClimb = walkableClimb;
+    chf->maxRegions = 0;
+    rcVcopy(chf->bmin, solid->bmin);
+    rcVcopy(chf->bmax, solid->bmax);
+    chf->bmax[1] += walkableHeight * solid->ch;
+    chf->cs = solid->cs;
+    chf->ch = solid->ch;
+
+    if (!reserveCompactHeightfield(w * h, spanCount))
+    {
+        context->log(RC_LOG_ERROR, "buildCompactHeightfield: Out of memory.");
+        return false;
+    }
+    memset(chf->cells, 0, sizeof(rcCompactCell) * w * h);
+    memset(chf->spans, 0, sizeof(rcCompactSpan) * spanCount);
+    memset(chf->areas, RC_NULL_AREA, sizeof(unsigned char) * spanCount);
+
+    const int MAX_HEIGHT = 0xffff;
+
+    // Fill in cells and spans
+    int idx = 0;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            const rcSpan* s = solid->spans[x + y * w];
+
+            // If there are no spans at this cell, just leave the data to index=0, count=0
+            if (!s)
+            {
+                continue;
+            }
+            rcCompactCell& c = chf->cells[x + y * w];
+            c.index = idx;
+            c.count = 0;
+            while (s)
+            {
+                if (s->area != RC_NULL_AREA)
+                {
+                    const int bot = (int)s->smax;
+                    const int top = s->next ? (int)s->next->smin : MAX_HEIGHT;
+                    chf->spans[idx].y = (unsigned short)rcClamp(bot, 0, 0xffff);
+                    chf->spans[idx].h = (unsigned char)rcClamp(top - bot, 0, 0xff);
+                    chf->areas[idx] = s->area;
+                    idx++;
+                    c.count++;
+                }
+                s = s->next;
+            }
+        }
+    }
+
+    // Find neighbour connections
+    const int MAX_LAYERS = RC_NOT_CONNECTED - 1;
+    int tooHighNeighbour = 0;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            const rcCompactCell& c = chf->cells[x + y * w];
+            for (int i = (int)c.index, ni = (int)(c.index + c.count); i < ni; ++i)
+            {
+                rcCompactSpan& s = chf->spans[i];
+                for (int dir = 0; dir < 4; ++dir)
+                {
+                    rcSetCon(s, dir, RC_NOT_CONNECTED);
+                    const int nx = x + rcGetDirOffsetX(dir);
+                    const int ny = y + rcGetDirOffsetY(dir);
+
+                    // First check that the neighbour cell is in bounds
+                    if (nx < 0 || ny < 0 || nx >= w || ny >= h)
+                    {
+                        continue;
+                    }
+
+                    // Iterate over all neighbour spans and check if any of them is accessible from the current cell
+                    const rcCompactCell& nc = chf->cells[nx + ny * w];
+                    for (int k = (int)nc.index, nk = (int)(nc.index + nc.count); k < nk; ++k)
+                    {
+                        const rcCompactSpan& ns = chf->spans[k];
+                        const int bot = rcMax(s.y, ns.y);
+                        const int top = rcMin(s.y + s.h, ns.y + ns.h);
+
+                        // Check that the gap between the spans is walkable, and that the climb height between the gaps is not too high
+                        if ((top - bot) >= walkableHeight && rcAbs((int)ns.y - (int)s.y) <= walkableClimb)
+                        {
+                            // Mark direction as walkable
+                            const int lidx = k - (int)nc.index;
+                            if (lidx < 0 || lidx > MAX_LAYERS)
+                            {
+                                tooHighNeighbour = rcMax(tooHighNeighbour, lidx);
+                                continue;
+                            }
+                            rcSetCon(s, dir, lidx);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (tooHighNeighbour > MAX_LAYERS)
+    {
+        context->log(RC_LOG_ERROR, "buildCompactHeightfield: Heightfield has too many layers %d (max: %d)", tooHighNeighbour, MAX_LAYERS);
+    }
+
+    return true;
+}
+
+bool
+resetHeightfield(rcContext* context, rcHeightfield& hf, int width, int height, const float* bmin, const float* bmax, float cs, float ch)
+{
+    // A different size needs new columns, otherwise the existing ones only need to be emptied
+    if (!hf.spans || hf.width != width || hf.height != height)
+    {
+        rcFree(hf.spans);
+        hf.spans = 0;
+        if (!rcCreateHeightfield(context, hf, width, height, bmin, bmax, cs, ch))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        rcVcopy(hf.bmin, bmin);
+        rcVcopy(hf.bmax, bmax);
+        hf.cs = cs;
+        hf.ch = ch;
+        memset(hf.spans, 0, sizeof(rcSpan*) * width * height);
+    }
+
+    // Put all spans of the pools back into the free list, the same way recast fills it when allocating a pool
+    hf.freelist = 0;
+    for (rcSpanPool* pool = hf.pools; pool; pool = pool->next)
+    {
+        for (int i = RC_SPANS_PER_POOL - 1; i >= 0; --i)
+        {
+            pool->items[i].next = hf.freelist;
+            hf.freelist = &pool->items[i];
+        }
+    }
+
+    return true;
+}
+
 int calcLayerBufferSize(const int gridWidth, const int gridHeight)
 {
     const int headerSize = dtAlign4(sizeof(dtTileCacheLayerHeader));
     const int gridSize = gridWidth * gridHeight;
     return headerSize + gridSize*4;
 }
+
+dtTileCacheCompressor* createTileCompressor(int compression)
+{
+    switch (compression)
+    {
+        case TILE_COMPRESSION_NONE:
+            return new NoCompressor();
+        case TILE_COMPRESSION_FASTLZ1:
+            return new FastLZCompressor(1);
+        case TILE_COMPRESSION_FASTLZ2:
+            return new FastLZCompressor(2);
+        case TILE_COMPRESSION_LZ4:
+            return new LZ4Compressor();
+        default:
+            return nullptr;
+    }
+}
+
+const char* getTileCompressionName(int compression)
+{
+    switch (compression)
+    {
+        case TILE_COMPRESSION_NONE:
+            return "none";
+        case TILE_COMPRESSION_FASTLZ1:
+            return "fastlz1";
+        case TILE_COMPRESSION_FASTLZ2:
+            return "fastlz2";
+        case TILE_COMPRESSION_LZ4:
+            return "lz4";
+        default:
+            return "unknown";
+    }
+}
+
+TileBuildWorkspace::TileBuildWorkspace(const size_t allocatorCapacity, int layerCount, dtTileCacheCompressor* tileCompressor)
+    : compressor(tileCompressor)
+    , allocator(allocatorCapacity)
+    , rasterization(layerCount)
+    , resetProfileOnRelease(false)
+{
+}
+
+BuildProgress::BuildProgress(std::function<void(int, int)> reportFunction, int reportIntervalMs)
+    : tilesDone(0)
+    , tilesTotal(0)
+    , _reportFunction(reportFunction)
+    , _reportInterval(reportIntervalMs)
+    , _lastReport(std::chrono::steady_clock::now())
+{
+}
+
+void
+BuildProgress::addTiles(int numTiles)
+{
+    tilesTotal += numTiles;
+}
+
+void
+BuildProgress::tileDone()
+{
+    tilesDone++;
+    report();
+}
+
+void
+BuildProgress::report(bool force)
+{
+    std::unique_lock<std::mutex> lock(_reportMutex, std::defer_lock);
+    if (force)
+    {
+        lock.lock();
+    }
+    else if (!lock.try_lock())
+    {
+        // Someone else is reporting right now, no need to do it twice
+        return;
+    }
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (!force && now - _lastReport < _reportInterval)
+    {
+        return;
+    }
+    _lastReport = now;
+    _reportFunction(tilesDone, tilesTotal);
+}
+
+// Frees the intermediate results of building a single navmesh tile
+struct NavMeshTileBuildContext
+{
+    inline NavMeshTileBuildContext(dtTileCacheAlloc* a) : layer(0), lcset(0), lmesh(0), alloc(a) {}
+    inline ~NavMeshTileBuildContext()
+    {
+        dtFreeTileCacheLayer(alloc, layer);
+        dtFreeTileCacheContourSet(alloc, lcset);
+        dtFreeTileCachePolyMesh(alloc, lmesh);
+    }
+
+    dtTileCacheLayer* layer;
+    dtTileCacheContourSet* lcset;
+    dtTileCachePolyMesh* lmesh;
+    dtTileCacheAlloc* alloc;
+};
+
+static bool
+containsTileRef(const dtCompressedTileRef* refs, const int numRefs, const dtCompressedTileRef ref)
+{
+    for (int i = 0; i < numRefs; ++i)
+    {
+        if (refs[i] == ref)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+dtStatus buildNavMeshTileData(const dtTileCache* tileCache, dtCompressedTileRef ref, dtTileCacheAlloc* alloc,
+                              dtTileCacheCompressor* compressor, dtTileCacheMeshProcess* meshProcess, NavMeshTileData* result)
+{
+    result->data = 0;
+    result->dataSize = 0;
+
+    const dtCompressedTile* tile = tileCache->getTileByRef(ref);
+    if (!tile || !tile->header)
+    {
+        return DT_FAILURE | DT_INVALID_PARAM;
+    }
+
+    const dtTileCacheParams* params = tileCache->getParams();
+    const int walkableClimbVx = (int)(params->walkableClimb / params->ch);
+
+    alloc->reset();
+    NavMeshTileBuildContext bc(alloc);
+
+    // Decompress tile layer data
+    dtStatus status = dtDecompressTileCacheLayer(alloc, compressor, tile->data, tile->dataSize, &bc.layer);
+    if (dtStatusFailed(status))
+    {
+        return status;
+    }
+
+    // Rasterize obstacles
+    for (int i = 0; i < tileCache->getObstacleCount(); ++i)
+    {
+        const dtTileCacheObstacle* ob = tileCache->getObstacle(i);
+        if (ob->state == DT_OBSTACLE_EMPTY || ob->state == DT_OBSTACLE_REMOVING)
+        {
+            continue;
+        }
+        if (!containsTileRef(ob->touched, ob->ntouched, ref))
+        {
+            continue;
+        }
+
+        if (ob->type == DT_OBSTACLE_CYLINDER)
+        {
+            dtMarkCylinderArea(*bc.layer, tile->header->bmin, params->cs, params->ch,
+                               ob->cylinder.pos, ob->cylinder.radius, ob->cylinder.height, 0);
+        }
+        else if (ob->type == DT_OBSTACLE_BOX)
+        {
+            dtMarkBoxArea(*bc.layer, tile->header->bmin, params->cs, params->ch,
+                          ob->box.bmin, ob->box.bmax, 0);
+        }
+        else if (ob->type == DT_OBSTACLE_ORIENTED_BOX)
+        {
+            dtMarkBoxArea(*bc.layer, tile->header->bmin, params->cs, params->ch,
+                          ob->orientedBox.center, ob->orientedBox.halfExtents, ob->orientedBox.rotAux, 0);
+        }
+    }
+
+    // Build regions, contours and the poly mesh
+    status = dtBuildTileCacheRegions(alloc, *bc.layer, walkableClimbVx);
+    if (dtStatusFailed(status))
+    {
+        return status;
+    }
+
+    bc.lcset = dtAllocTileCacheContourSet(alloc);
+    if (!bc.lcset)
+    {
+        return DT_FAILURE | DT_OUT_OF_MEMORY;
+    }
+    status = dtBuildTileCacheContours(alloc, *bc.layer, walkableClimbVx, params->maxSimplificationError, *bc.lcset);
+    if (dtStatusFailed(status))
+    {
+        return status;
+    }
+
+    bc.lmesh = dtAllocTileCachePolyMesh(alloc);
+    if (!bc.lmesh)
+    {
+        return DT_FAILURE | DT_OUT_OF_MEMORY;
+    }
+    status = dtBuildTileCachePolyMesh(alloc, *bc.lcset, *bc.lmesh);
+    if (dtStatusFailed(status))
+    {
+        return status;
+    }
+
+    // Nothing to build if the tile is empty
+    if (!bc.lmesh->npolys)
+    {
+        return DT_SUCCESS;
+    }
+
+    dtNavMeshCreateParams createParams;
+    memset(&createParams, 0, sizeof(createParams));
+    createParams.verts = bc.lmesh->verts;
+    createParams.vertCount = bc.lmesh->nverts;
+    createParams.polys = bc.lmesh->polys;
+    createParams.polyAreas = bc.lmesh->areas;
+    createParams.polyFlags = bc.lmesh->flags;
+    createParams.polyCount = bc.lmesh->npolys;
+    createParams.nvp = DT_VERTS_PER_POLYGON;
+    createParams.walkableHeight = params->walkableHeight;
+    createParams.walkableRadius = params->walkableRadius;
+    createParams.walkableClimb = params->walkableClimb;
+    createParams.tileX = tile->header->tx;
+    createParams.tileY = tile->header->ty;
+    createParams.tileLayer = tile->header->tlayer;
+    createParams.cs = params->cs;
+    createParams.ch = params->ch;
+    createParams.buildBvTree = false;
+    dtVcopy(createParams.bmin, tile->header->bmin);
+    dtVcopy(createParams.bmax, tile->header->bmax);
+
+    if (meshProcess)
+    {
+        meshProcess->process(&createParams, bc.lmesh->areas, bc.lmesh->flags);
+    }
+
+    if (!dtCreateNavMeshData(&createParams, &result->data, &result->dataSize))
+    {
+        return DT_FAILURE;
+    }
+
+    return DT_SUCCESS;
+}
+
+static bool
+pointInConvexArea(const float* verts, const int nverts, const float x, const float z)
+{
+    bool inside = false;
+    for (int i = 0, j = nverts - 1; i < nverts; j = i++)
+    {
+        const float* vi = &verts[i * 3];
+        const float* vj = &verts[j * 3];
+        if (((vi[2] > z) != (vj[2] > z)) &&
+            (x < (vj[0] - vi[0]) * (z - vi[2]) / (vj[2] - vi[2]) + vi[0]))
+        {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool markConvexLayerArea(dtTileCacheLayer& layer, const float cs, const float ch, const float* verts, const int nverts,
+                         const float hmin, const float hmax, const unsigned char areaId)
+{
+    const float* orig = layer.header->bmin;
+    const int w = (int)layer.header->width;
+    const int h = (int)layer.header->height;
+    const float ics = 1.0f / cs;
+    const float ich = 1.0f / ch;
+
+    float bmin[3], bmax[3];
+    dtVcopy(bmin, verts);
+    dtVcopy(bmax, verts);
+    for (int i = 1; i < nverts; ++i)
+    {
+        dtVmin(bmin, &verts[i * 3]);
+        dtVmax(bmax, &verts[i * 3]);
+    }
+
+    // Same rounding as dtMarkBoxArea, so volumes and obstacles cover the same cells
+    int minx = (int)floorf((bmin[0] - orig[0]) * ics);
+    int maxx = (int)floorf((bmax[0] - orig[0]) * ics);
+    int minz = (int)floorf((bmin[2] - orig[2]) * ics);
+    int maxz = (int)floorf((bmax[2] - orig[2]) * ics);
+    const int miny = (int)floorf((hmin - orig[1]) * ich);
+    const int maxy = (int)floorf((hmax - orig[1]) * ich);
+    if (maxx < 0 || minx >= w || maxz < 0 || minz >= h)
+    {
+        return false;
+    }
+    minx = dtMax(minx, 0);
+    maxx = dtMin(maxx, w - 1);
+    minz = dtMax(minz, 0);
+    maxz = dtMin(maxz, h - 1);
+
+    bool changed = false;
+    for (int z = minz; z <= maxz; ++z)
+    {
+        for (int x = minx; x <= maxx; ++x)
+        {
+            const int idx = x + z * w;
+
+            // Like rcMarkConvexPolyArea, only walkable cells get the new area
+            if (layer.heights[idx] == 0xff || layer.areas[idx] == DT_TILECACHE_NULL_AREA)
+            {
+                continue;
+            }
+            const int y = layer.heights[idx];
+            if (y < miny || y > maxy)
+            {
+                continue;
+            }
+            if (!pointInConvexArea(verts, nverts, orig[0] + (x + 0.5f) * cs, orig[2] + (z + 0.5f) * cs))
+            {
+                continue;
+            }
+            if (layer.areas[idx] != areaId)
+            {
+                layer.areas[idx] = areaId;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
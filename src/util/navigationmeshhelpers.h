@@ -4,20 +4,47 @@
 #include <DetourCommon.h>
 #include <DetourTileCache.h>
 #include <DetourTileCacheBuilder.h>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <vector>
+#include <cstdint>
 #include "fastlz.h"
+#include "lz4.h"
+#include "recastcontext.h"
 
 class DetourInputGeometry;
 struct rcHeightfield;
 struct rcHeightfieldLayerSet;
 struct rcCompactHeightfield;
 
+// Helper struct for allocator statistics
+struct AllocatorStats
+{
+    size_t capacity;    // Bytes currently reserved
+    size_t live;        // Bytes handed out since the last reset
+    size_t peak;        // Most bytes handed out between two resets
+    int overflows;      // Allocations that did not fit into the current chunk, so a larger one had to be added
+    int failures;       // Allocations that could not be served at all
+
+    AllocatorStats();
+
+    void add(const AllocatorStats& other);
+};
+
 // Helper struct for allocating
+// Hands out memory linearly from a chunk. If the chunk is exhausted, a chunk twice as large is added instead of failing.
+// On reset, only the largest chunk is kept, so the allocator settles on the size the most complex tiles need.
+// Not thread-safe, meant to be used by one thread at a time (e.g. as part of a TileBuildWorkspace).
 struct LinearAllocator : public dtTileCacheAlloc
 {
     unsigned char* buffer;
     size_t capacity;
     size_t top;
-    size_t high;
+    std::vector<unsigned char*> retiredChunks;  // Exhausted chunks, still holding allocations until the next reset
+    size_t retiredCapacity;
+    AllocatorStats stats;
 
     LinearAllocator(const size_t cap);
 
@@ -27,11 +54,36 @@ struct LinearAllocator : public dtTileCacheAlloc
     virtual void reset();
     virtual void* alloc(const size_t size);
     virtual void free(void* /*ptr*/);
+
+private:
+    /**
+     * @brief Retires the current chunk and replaces it with one that is large enough for the passed size.
+     */
+    bool grow(const size_t size);
+
+    /**
+     * @brief Frees all retired chunks.
+     */
+    void freeRetiredChunks();
+};
+
+// How the tile cache layers are compressed
+enum TileCompression
+{
+    TILE_COMPRESSION_NONE = 0,      // Fastest rebuilds, most memory
+    TILE_COMPRESSION_FASTLZ1,       // FastLZ level 1, fast
+    TILE_COMPRESSION_FASTLZ2,       // FastLZ level 2, slower compression, better ratio
+    TILE_COMPRESSION_LZ4,           // LZ4, fastest decompression of the compressed options
+    NUM_TILE_COMPRESSIONS
 };
 
 // Helper struct for compression
 struct FastLZCompressor : public dtTileCacheCompressor
 {
+    int level;
+
+    FastLZCompressor(int compressionLevel = 1);
+
     virtual int maxCompressedSize(const int bufferSize);
     virtual dtStatus compress(const unsigned char* buffer, const int bufferSize,
                               unsigned char* compressed, const int /*maxCompressedSize*/, int* compressedSize);
@@ -39,6 +91,41 @@ struct FastLZCompressor : public dtTileCacheCompressor
                                 unsigned char* buffer, const int maxBufferSize, int* bufferSize);
 };
 
+// Helper struct for LZ4 compression
+struct LZ4Compressor : public dtTileCacheCompressor
+{
+    virtual int maxCompressedSize(const int bufferSize);
+    virtual dtStatus compress(const unsigned char* buffer, const int bufferSize,
+                              unsigned char* compressed, const int maxCompressedSize, int* compressedSize);
+    virtual dtStatus decompress(const unsigned char* compressed, const int compressedSize,
+                                unsigned char* buffer, const int maxBufferSize, int* bufferSize);
+};
+
+// Helper struct to store tile cache layers uncompressed
+struct NoCompressor : public dtTileCacheCompressor
+{
+    virtual int maxCompressedSize(const int bufferSize);
+    virtual dtStatus compress(const unsigned char* buffer, const int bufferSize,
+                              unsigned char* compressed, const int maxCompressedSize, int* compressedSize);
+    virtual dtStatus decompress(const unsigned char* compressed, const int compressedSize,
+                                unsigned char* buffer, const int maxBufferSize, int* bufferSize);
+};
+
+// Helper struct for the results of benchmarking a tile compression on the tiles of a navmesh
+struct CompressionBenchmark
+{
+    int compression;
+    int tiles;
+    size_t rawBytes;
+    size_t compressedBytes;
+    int64_t compressUsec;
+    int64_t decompressUsec;
+
+    CompressionBenchmark(int tileCompression);
+
+    void add(const CompressionBenchmark& other);
+};
+
 // Flags to determine the kind of areas and which abilities they support
 // TODO: Implement different/dynamic areas
 enum PolyAreaType
@@ -88,20 +175,138 @@ struct TileCacheData
 };
 
 // Helper struct for rasterization
+// Kept alive between tiles, so the span pools, compact heightfield and buffers only need to grow, not be reallocated for every tile
 struct RasterizationContext
 {
     RasterizationContext(int layerCount);
 
     ~RasterizationContext();
 
+    /**
+     * @brief Frees whatever the last tile left behind (tile data not handed out, heightfield layers).
+     */
+    void reset();
+
+    /**
+     * @brief Makes sure the compact heightfield can hold the passed number of cells and spans. Does not touch the header.
+     */
+    bool reserveCompactHeightfield(int cellCount, int spanCount);
+
+    /**
+     * @brief Does the same as rcBuildCompactHeightfield (solid -> chf), but reuses the arrays of the previous tile if they are large enough.
+     */
+    bool buildCompactHeightfield(rcContext* context, const int walkableHeight, const int walkableClimb);
+
     rcHeightfield* solid;
-    unsigned char* triareas;
     rcHeightfieldLayerSet* lset;
     rcCompactHeightfield* chf;
+    int chfCellCapacity;
+    int chfSpanCapacity;
     TileCacheData* tiles;
     int ntiles;
     int numLayers;
 };
 
+// Helper struct to store built navmesh tile data
+struct NavMeshTileData
+{
+    unsigned char* data;
+    int dataSize;
+};
+
+// Helper struct to store the layers of a tile column built on demand, until they are added to the tile cache
+struct LazyTile
+{
+    int tileX;
+    int tileZ;
+    std::vector<TileCacheData> layers;
+    bool fromSaveFile = false;  // Read from the save file as it was saved, so there is nothing new to save
+};
+
+// Helper struct to find the layers of a tile column within the save file, to read them once the column is needed
+struct SavedRegion
+{
+    int64_t             offset;     // From the start of the file
+    int64_t             size;       // Of all layers, each aligned
+    uint32_t            checksum;
+    std::vector<int>    layerSizes;
+    std::vector<unsigned char> data;    // Read ahead for saving, empty otherwise
+};
+
+// Everything a single thread needs to rasterize tiles and build navmesh tiles on its own
+struct TileBuildWorkspace
+{
+    TileBuildWorkspace(const size_t allocatorCapacity, int layerCount, dtTileCacheCompressor* tileCompressor);
+
+    RecastContext           context;
+    dtTileCacheCompressor*  compressor;     // The navmesh's compressor, not owned
+    LinearAllocator         allocator;
+    RasterizationContext    rasterization;
+    bool                    resetProfileOnRelease;  // The profile was reset while the workspace was in use
+};
+
+// Counts the tiles done while building or loading and reports them in intervals, from whatever thread finished a tile
+struct BuildProgress
+{
+    BuildProgress(std::function<void(int, int)> reportFunction, int reportIntervalMs);
+
+    /**
+     * @brief Adds tiles that will have to be built.
+     */
+    void addTiles(int numTiles);
+
+    /**
+     * @brief Marks a tile as done and reports if the last report is long enough ago.
+     */
+    void tileDone();
+
+    /**
+     * @brief Reports the current progress. Unless forced, only if the last report is long enough ago and nobody else is reporting right now.
+     */
+    void report(bool force = false);
+
+    std::atomic_int tilesDone;
+    std::atomic_int tilesTotal;
+
+private:
+    std::function<void(int, int)>           _reportFunction;
+    std::chrono::milliseconds               _reportInterval;
+    std::chrono::steady_clock::time_point   _lastReport;
+    std::mutex                              _reportMutex;
+};
+
 int calcLayerBufferSize(const int gridWidth, const int gridHeight);
+
+/**
+ * @brief Creates the compressor for the passed TileCompression. Returns nullptr for unknown values.
+ */
+dtTileCacheCompressor* createTileCompressor(int compression);
+
+/**
+ * @brief Returns the name of the passed TileCompression.
+ */
+const char* getTileCompressionName(int compression);
+
+/**
+ * @brief Does the same as rcCreateHeightfield, but keeps the span pools (and, if the size did not change, the columns)
+ *          of a previously used heightfield instead of leaking them. All spans are put back into the free list.
+ */
+bool resetHeightfield(rcContext* context, rcHeightfield& hf, int width, int height, const float* bmin, const float* bmax, float cs, float ch);
+
+/**
+ * @brief Builds the navmesh tile data for the compressed tile, without adding it to a navmesh.
+ *          Does the same as dtTileCache::buildNavMeshTile, but with the passed allocator and compressor instead of the
+ *          tile cache's own ones, so multiple tiles of the same tile cache can be built in parallel.
+ *          result->data will be 0 if the tile does not contain any polygons.
+ */
+dtStatus buildNavMeshTileData(const dtTileCache* tileCache, dtCompressedTileRef ref, dtTileCacheAlloc* alloc,
+                              dtTileCacheCompressor* compressor, dtTileCacheMeshProcess* meshProcess, NavMeshTileData* result);
+
+/**
+ * @brief Does the same as rcMarkConvexPolyArea, but on a (decompressed) tile cache layer instead of a compact heightfield,
+ *          the way dtMarkBoxArea does for obstacles. Only walkable cells are marked.
+ * @return True if the area of any cell changed.
+ */
+bool markConvexLayerArea(dtTileCacheLayer& layer, const float cs, const float ch, const float* verts, const int nverts,
+                         const float hmin, const float hmax, const unsigned char areaId);
 #endif // NAVIGATIONMESHHELPERS_H
@@ -1,17 +1,250 @@
 #include "recastcontext.h"
-#include <OS.hpp>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
 
 using namespace godot;
 
+// Same order as rcTimerLabel
+static const char* timerLabelNames[RC_MAX_TIMERS] =
+{
+    "total",
+    "temp",
+    "rasterizeTriangles",
+    "buildCompactHeightfield",
+    "buildContours",
+    "buildContoursTrace",
+    "buildContoursSimplify",
+    "filterBorder",
+    "filterWalkable",
+    "medianArea",
+    "filterLowObstacles",
+    "buildPolymesh",
+    "mergePolymesh",
+    "erodeArea",
+    "markBoxArea",
+    "markCylinderArea",
+    "markConvexPolyArea",
+    "buildDistanceField",
+    "buildDistanceFieldDist",
+    "buildDistanceFieldBlur",
+    "buildRegions",
+    "buildRegionsWatershed",
+    "buildRegionsExpand",
+    "buildRegionsFlood",
+    "buildRegionsFilter",
+    "buildLayers",
+    "buildPolymeshDetail",
+    "mergePolymeshDetail"
+};
+
+/**
+ * @brief Returns the histogram bucket for the duration: 0 for below 1 usec, then one bucket per power of two usec.
+ */
+static int
+getHistogramBucket(int64_t duration)
+{
+    int64_t usec = duration / 1000;
+    int bucket = 0;
+    while (usec > 0 && bucket < RECAST_HISTOGRAM_BUCKETS - 1)
+    {
+        usec >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
 RecastContext::RecastContext()
+    : _inTile(false)
+{
+    resetProfile();
+}
+
+void
+RecastContext::beginTile(int navMeshIndex, int tileX, int tileZ)
+{
+    _inTile = true;
+    _currentTile.navMeshIndex = navMeshIndex;
+    _currentTile.tileX = tileX;
+    _currentTile.tileZ = tileZ;
+    _currentTile.time = now();
+    memcpy(_tileStartTime, _accumulatedTime, sizeof(_accumulatedTime));
+}
+
+void
+RecastContext::endTile()
+{
+    if (!_inTile)
+    {
+        return;
+    }
+    _inTile = false;
+
+    _currentTile.time = now() - _currentTile.time;
+    for (int i = 0; i < RC_MAX_TIMERS; ++i)
+    {
+        _currentTile.stageTimes[i] = _accumulatedTime[i] - _tileStartTime[i];
+    }
+    _tileCount++;
+    _tileTime += _currentTile.time;
+    keepTileTiming(_currentTile);
+}
+
+void
+RecastContext::mergeProfile(const RecastContext& other)
+{
+    for (int i = 0; i < RC_MAX_TIMERS; ++i)
+    {
+        _accumulatedTime[i] += other._accumulatedTime[i];
+        _timerCalls[i] += other._timerCalls[i];
+        for (int j = 0; j < RECAST_HISTOGRAM_BUCKETS; ++j)
+        {
+            _histograms[i][j] += other._histograms[i][j];
+        }
+    }
+
+    _tileCount += other._tileCount;
+    _tileTime += other._tileTime;
+    for (int i = 0; i < other._slowestTiles.size(); ++i)
+    {
+        keepTileTiming(other._slowestTiles[i]);
+    }
+
+    for (int i = 0; i < other._logCount; ++i)
+    {
+        addLogEntry(other._log[(other._logStart + i) % RECAST_LOG_CAPACITY]);
+    }
+}
+
+void
+RecastContext::resetProfile()
 {
     doResetTimers();
+    doResetLog();
+    _inTile = false;
+    _slowestTiles.clear();
+    _tileCount = 0;
+    _tileTime = 0;
+}
+
+Dictionary
+RecastContext::getProfile(int numSlowestTiles) const
+{
+    Dictionary profile;
+
+    // Stages
+    Dictionary stages;
+    for (int i = 0; i < RC_MAX_TIMERS; ++i)
+    {
+        if (_timerCalls[i] == 0)
+        {
+            continue;
+        }
+
+        Array histogram;
+        for (int j = 0; j < RECAST_HISTOGRAM_BUCKETS; ++j)
+        {
+            histogram.append(_histograms[i][j]);
+        }
+
+        Dictionary stage;
+        stage["calls"] = _timerCalls[i];
+        stage["totalUsec"] = _accumulatedTime[i] / 1000.0;
+        stage["histogram"] = histogram;
+        stages[timerLabelNames[i]] = stage;
+    }
+    profile["stages"] = stages;
+
+    // Upper bounds of the histogram buckets (the last one is open)
+    Array bucketLimits;
+    for (int j = 0; j < RECAST_HISTOGRAM_BUCKETS - 1; ++j)
+    {
+        bucketLimits.append(1 << j);
+    }
+    profile["histogramBucketsUsec"] = bucketLimits;
+
+    // Tile totals
+    profile["tileCount"] = _tileCount;
+    profile["tileTimeUsec"] = _tileTime / 1000.0;
+
+    // Slowest tiles
+    std::vector<const TileTiming*> tileOrder;
+    for (int i = 0; i < _slowestTiles.size(); ++i)
+    {
+        tileOrder.push_back(&_slowestTiles[i]);
+    }
+    numSlowestTiles = std::min(numSlowestTiles, (int)tileOrder.size());
+    std::partial_sort(tileOrder.begin(), tileOrder.begin() + numSlowestTiles, tileOrder.end(), [](const TileTiming* a, const TileTiming* b) {
+        return a->time > b->time;
+    });
+    Array slowestTiles;
+    for (int i = 0; i < numSlowestTiles; ++i)
+    {
+        const TileTiming& timing = *tileOrder[i];
+        const int64_t* stageTimes = timing.stageTimes;
+
+        Dictionary tileStages;
+        for (int j = 0; j < RC_MAX_TIMERS; ++j)
+        {
+            if (stageTimes[j] > 0)
+            {
+                tileStages[timerLabelNames[j]] = stageTimes[j] / 1000.0;
+            }
+        }
+
+        Dictionary tile;
+        tile["navMesh"] = timing.navMeshIndex;
+        tile["x"] = timing.tileX;
+        tile["z"] = timing.tileZ;
+        tile["timeUsec"] = timing.time / 1000.0;
+        tile["stagesUsec"] = tileStages;
+        slowestTiles.append(tile);
+    }
+    profile["slowestTiles"] = slowestTiles;
+
+    // Log, oldest first
+    std::vector<const LogEntry*> entries;
+    for (int i = 0; i < _logCount; ++i)
+    {
+        entries.push_back(&_log[(_logStart + i) % RECAST_LOG_CAPACITY]);
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const LogEntry* a, const LogEntry* b) {
+        return a->time < b->time;
+    });
+    Array log;
+    for (int i = 0; i < entries.size(); ++i)
+    {
+        String catMsg;
+        switch (entries[i]->category)
+        {
+        case RC_LOG_PROGRESS:
+            catMsg = "progress";
+            break;
+
+        case RC_LOG_WARNING:
+            catMsg = "warning";
+            break;
+
+        case RC_LOG_ERROR:
+            catMsg = "error";
+            break;
+
+        default:
+            catMsg = "unknown";
+            break;
+        }
+        log.append(String("{0}: {1}").format(Array::make(catMsg, String(entries[i]->message))));
+    }
+    profile["log"] = log;
+
+    return profile;
 }
 
 void
 RecastContext::doResetLog()
 {
-    // ???
+    _logStart = 0;
+    _logCount = 0;
 }
 
 void
@@ -24,31 +257,19 @@ RecastContext::doLog(const rcLogCategory category, const char* msg, const int le
         return;
     }
 
-    // Assemble the message
-    String message = "recast: {0}: {1}";
-    String catMsg = "";
-    switch (category)
-    {
-    case RC_LOG_PROGRESS:
-        catMsg = "progress";
-        break;
-
-    case RC_LOG_WARNING:
-        catMsg = "warning";
-        break;
-
-    case RC_LOG_ERROR:
-        catMsg = "error";
-        break;
+    LogEntry entry;
+    entry.time = now();
+    entry.category = category;
+    int length = std::min(len, RECAST_LOG_MESSAGE_LENGTH - 1);
+    memcpy(entry.message, msg, length);
+    entry.message[length] = '\0';
+    addLogEntry(entry);
 
-    default:
-        catMsg = "unknown";
-        break;
+    // Errors should not go unnoticed
+    if (category == RC_LOG_ERROR)
+    {
+        ERR_PRINT(String("recast: error: {0}").format(Array::make(String(entry.message))));
     }
-    message = message.format(Array::make(catMsg, String(msg)));
-
-    // Print
-    Godot::print(message);
 }
 
 void
@@ -56,34 +277,77 @@ RecastContext::doResetTimers()
 {
     for (int i = 0; i < RC_MAX_TIMERS; ++i)
     {
-        _timers[(rcTimerLabel)i] = -1;
-        _accumulatedTime[(rcTimerLabel)i] = -1;
+        _timerStart[i] = -1;
+        _accumulatedTime[i] = 0;
+        _timerCalls[i] = 0;
+        for (int j = 0; j < RECAST_HISTOGRAM_BUCKETS; ++j)
+        {
+            _histograms[i][j] = 0;
+        }
     }
 }
 
 void
 RecastContext::doStartTimer(const rcTimerLabel label)
 {
-    _timers[label] = OS::get_singleton()->get_ticks_msec();
+    _timerStart[label] = now();
 }
 
 void
 RecastContext::doStopTimer(const rcTimerLabel label)
 {
-    int64_t now = OS::get_singleton()->get_ticks_msec();
-    int64_t deltaTime = now - _timers[label];
-    if (_accumulatedTime[label] == -1)
+    int64_t deltaTime = now() - _timerStart[label];
+    _accumulatedTime[label] += deltaTime;
+    _timerCalls[label]++;
+    _histograms[label][getHistogramBucket(deltaTime)]++;
+}
+
+int
+RecastContext::doGetAccumulatedTime(const rcTimerLabel label) const
+{
+    // Recast expects microseconds
+    if (_timerCalls[label] == 0)
+    {
+        return -1;
+    }
+    return (int)(_accumulatedTime[label] / 1000);
+}
+
+int64_t
+RecastContext::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void
+RecastContext::addLogEntry(const LogEntry& entry)
+{
+    if (_logCount < RECAST_LOG_CAPACITY)
     {
-        _accumulatedTime[label] = deltaTime;
+        _log[(_logStart + _logCount) % RECAST_LOG_CAPACITY] = entry;
+        _logCount++;
     }
     else
     {
-        _accumulatedTime[label] += deltaTime;
+        _log[_logStart] = entry;
+        _logStart = (_logStart + 1) % RECAST_LOG_CAPACITY;
     }
 }
 
-int
-RecastContext::doGetAccumulatedTime(const rcTimerLabel label) const
+void
+RecastContext::keepTileTiming(const TileTiming& timing)
 {
-    return _accumulatedTime.at(label);
+    if (_slowestTiles.size() < RECAST_SLOWEST_TILES)
+    {
+        _slowestTiles.push_back(timing);
+        return;
+    }
+
+    auto fastest = std::min_element(_slowestTiles.begin(), _slowestTiles.end(), [](const TileTiming& a, const TileTiming& b) {
+        return a.time < b.time;
+    });
+    if (timing.time > fastest->time)
+    {
+        *fastest = timing;
+    }
 }
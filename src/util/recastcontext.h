@@ -2,17 +2,54 @@
 #define RECASTCONTEXT_H
 
 #include <Godot.hpp>
+#include <Dictionary.hpp>
 #include <Recast.h>
-#include <map>
+#include <vector>
+#include <cstdint>
+
+#define RECAST_LOG_CAPACITY 256
+#define RECAST_LOG_MESSAGE_LENGTH 256
+#define RECAST_HISTOGRAM_BUCKETS 24
+#define RECAST_SLOWEST_TILES 16
 
 /**
  * @brief Provides recast an interface for logging, performance timers, etc.
+ *          Timers use a monotonic nanosecond clock. Besides the accumulated time, each stage (rcTimerLabel) keeps
+ *          a histogram of how long its single runs took, and the time spent in each stage is recorded for the slowest tiles.
+ *          Log messages are kept in a ring buffer instead of being printed (except errors).
+ *          Not thread-safe, each thread needs its own context.
  */
 class RecastContext : public rcContext
 {
 public:
     RecastContext();
 
+    /**
+     * @brief Starts recording the stage timings of a tile.
+     */
+    void beginTile(int navMeshIndex, int tileX, int tileZ);
+
+    /**
+     * @brief Stops recording the current tile and keeps its timings if it is one of the RECAST_SLOWEST_TILES slowest.
+     */
+    void endTile();
+
+    /**
+     * @brief Adds the timings, tiles and log messages of the other context to this one.
+     */
+    void mergeProfile(const RecastContext& other);
+
+    /**
+     * @brief Clears all timings, tiles and log messages.
+     */
+    void resetProfile();
+
+    /**
+     * @brief Returns the profile as a dictionary.
+     * @param numSlowestTiles   How many of the slowest tiles to include, at most RECAST_SLOWEST_TILES.
+     */
+    godot::Dictionary getProfile(int numSlowestTiles) const;
+
 protected:
     virtual void doResetLog();
     virtual void doLog(const rcLogCategory category, const char* msg, const int len);
@@ -22,8 +59,55 @@ protected:
     virtual int doGetAccumulatedTime(const rcTimerLabel label) const;
 
 private:
-    std::map<rcTimerLabel, int64_t> _timers;
-    std::map<rcTimerLabel, int64_t> _accumulatedTime;
+    struct LogEntry
+    {
+        int64_t         time;
+        rcLogCategory   category;
+        char            message[RECAST_LOG_MESSAGE_LENGTH];
+    };
+
+    struct TileTiming
+    {
+        int     navMeshIndex;
+        int     tileX;
+        int     tileZ;
+        int64_t time;
+        int64_t stageTimes[RC_MAX_TIMERS];
+    };
+
+    /**
+     * @brief Returns the current time of the monotonic clock in nanoseconds.
+     */
+    static int64_t now();
+
+    /**
+     * @brief Adds the message to the ring buffer, overwriting the oldest one if full.
+     */
+    void addLogEntry(const LogEntry& entry);
+
+    /**
+     * @brief Keeps the timing if it is one of the slowest, replacing the fastest kept one if needed.
+     */
+    void keepTileTiming(const TileTiming& timing);
+
+private:
+    int64_t _timerStart[RC_MAX_TIMERS];
+    int64_t _accumulatedTime[RC_MAX_TIMERS];
+    int     _timerCalls[RC_MAX_TIMERS];
+    int     _histograms[RC_MAX_TIMERS][RECAST_HISTOGRAM_BUCKETS];
+
+    bool        _inTile;
+    TileTiming  _currentTile;
+    int64_t     _tileStartTime[RC_MAX_TIMERS];
+
+    // Only the slowest tiles are kept, as tiles built lazily or rebuilt over and over would otherwise pile up
+    std::vector<TileTiming> _slowestTiles;
+    int         _tileCount;
+    int64_t     _tileTime;
+
+    LogEntry    _log[RECAST_LOG_CAPACITY];
+    int         _logStart;
+    int         _logCount;
 };
 
 #endif // RECASTCONTEXT_H
@@ -0,0 +1,111 @@
+#include "savebuffer.h"
+#include <StreamPeerBuffer.hpp>
+#include <algorithm>
+#include <cstring>
+
+using namespace godot;
+
+// Written in pieces, so the file never needs a second copy of the whole buffer
+#define WRITE_CHUNK_SIZE (16 * 1024 * 1024)
+
+SaveBuffer::SaveBuffer()
+{
+}
+
+void
+SaveBuffer::store_8(uint8_t value)
+{
+    _data.push_back(value);
+}
+
+void
+SaveBuffer::store_16(uint16_t value)
+{
+    uint8_t* pos = append(2);
+    pos[0] = value & 0xff;
+    pos[1] = value >> 8;
+}
+
+void
+SaveBuffer::store_32(uint32_t value)
+{
+    uint8_t* pos = append(4);
+    for (int i = 0; i < 4; ++i)
+    {
+        pos[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+
+void
+SaveBuffer::store_64(uint64_t value)
+{
+    uint8_t* pos = append(8);
+    for (int i = 0; i < 8; ++i)
+    {
+        pos[i] = (value >> (i * 8)) & 0xff;
+    }
+}
+
+void
+SaveBuffer::store_float(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    store_32(bits);
+}
+
+void
+SaveBuffer::store_buffer(const PoolByteArray& buffer)
+{
+    if (buffer.size() == 0)
+    {
+        return;
+    }
+    PoolByteArray::Read reader = buffer.read();
+    memcpy(append(buffer.size()), reader.ptr(), buffer.size());
+}
+
+void
+SaveBuffer::store_pascal_string(const String& string)
+{
+    // Same as File: the length of the UTF-8 data, followed by it
+    CharString utf8 = string.utf8();
+    store_32(utf8.length());
+    if (utf8.length() > 0)
+    {
+        memcpy(append(utf8.length()), utf8.get_data(), utf8.length());
+    }
+}
+
+void
+SaveBuffer::store_var(const Variant& value, bool fullObjects)
+{
+    // StreamPeer encodes variants exactly like File does, including the leading size
+    Ref<StreamPeerBuffer> peer = StreamPeerBuffer::_new();
+    peer->put_var(value, fullObjects);
+    store_buffer(peer->get_data_array());
+}
+
+uint8_t*
+SaveBuffer::append(size_t bytes)
+{
+    const size_t start = _data.size();
+    _data.resize(start + bytes);
+    return _data.data() + start;
+}
+
+void
+SaveBuffer::writeTo(Ref<File> file) const
+{
+    PoolByteArray chunk;
+    for (size_t start = 0; start < _data.size(); start += WRITE_CHUNK_SIZE)
+    {
+        const size_t size = std::min(_data.size() - start, (size_t)WRITE_CHUNK_SIZE);
+        chunk.resize(size);
+        {
+            PoolByteArray::Write writer = chunk.write();
+            memcpy(writer.ptr(), _data.data() + start, size);
+        }
+        file->store_buffer(chunk);
+    }
+}
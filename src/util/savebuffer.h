@@ -0,0 +1,61 @@
+#ifndef SAVEBUFFER_H
+#define SAVEBUFFER_H
+
+#include <Godot.hpp>
+#include <File.hpp>
+#include <PoolArrays.hpp>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Collects save data in memory, so the navigation only has to be locked while copying into it
+ *          and writing (and compressing) the file happens afterwards.
+ *          The store methods match those of godot::File and produce the same bytes (little-endian),
+ *          so the save functions work the same whether they write to a file or a buffer.
+ */
+class SaveBuffer
+{
+public:
+    /**
+     * @brief Constructor.
+     */
+    SaveBuffer();
+
+    void store_8(uint8_t value);
+    void store_16(uint16_t value);
+    void store_32(uint32_t value);
+    void store_64(uint64_t value);
+    void store_float(float value);
+    void store_buffer(const godot::PoolByteArray& buffer);
+    void store_pascal_string(const godot::String& string);
+    void store_var(const godot::Variant& value, bool fullObjects = false);
+
+    /**
+     * @brief Returns how many bytes were stored, i.e. the position in the file they end up in if written from its start.
+     */
+    int64_t get_position() const;
+
+    /**
+     * @brief Appends the passed number of bytes without initializing them.
+     * @return Where the bytes are, valid until the next store.
+     */
+    uint8_t* append(size_t bytes);
+
+    /**
+     * @brief Writes everything stored to the file, at its current position.
+     */
+    void writeTo(godot::Ref<godot::File> file) const;
+
+private:
+    std::vector<uint8_t>    _data;
+};
+
+// INLINES
+inline int64_t
+SaveBuffer::get_position() const
+{
+    return _data.size();
+}
+
+#endif // SAVEBUFFER_H
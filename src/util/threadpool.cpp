@@ -0,0 +1,115 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int numThreads)
+    : _stop(false)
+{
+    if (numThreads <= 0)
+    {
+        numThreads = std::thread::hardware_concurrency();
+    }
+
+    // The waiting thread counts as one of them
+    for (int i = 1; i < numThreads; ++i)
+    {
+        _workers.emplace_back(&ThreadPool::workerFunction, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _taskAvailable.notify_all();
+
+    for (int i = 0; i < _workers.size(); ++i)
+    {
+        _workers[i].join();
+    }
+
+    // Without workers, whatever is left has to be done here
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_tasks.empty())
+    {
+        Task task = std::move(_tasks.front());
+        _tasks.pop_front();
+        runTask(task, lock);
+    }
+}
+
+void
+ThreadPool::submit(TaskGroup& group, std::function<void()> task)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        group.pending++;
+        _tasks.push_back({&group, std::move(task)});
+    }
+    _taskAvailable.notify_one();
+}
+
+void
+ThreadPool::wait(TaskGroup& group)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (group.pending > 0)
+    {
+        // Help out with a task of this group, if there is one left in the queue
+        bool foundTask = false;
+        for (auto it = _tasks.begin(); it != _tasks.end(); ++it)
+        {
+            if (it->group == &group)
+            {
+                Task task = std::move(*it);
+                _tasks.erase(it);
+                runTask(task, lock);
+                foundTask = true;
+                break;
+            }
+        }
+
+        // Otherwise, the remaining tasks are being worked on by others
+        if (!foundTask && group.pending > 0)
+        {
+            _taskDone.wait(lock);
+        }
+    }
+}
+
+bool
+ThreadPool::isDone(TaskGroup& group)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return group.pending == 0;
+}
+
+void
+ThreadPool::runTask(Task& task, std::unique_lock<std::mutex>& lock)
+{
+    lock.unlock();
+    task.function();
+    lock.lock();
+
+    task.group->pending--;
+    _taskDone.notify_all();
+}
+
+void
+ThreadPool::workerFunction()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _taskAvailable.wait(lock, [this] { return _stop || !_tasks.empty(); });
+        if (_tasks.empty())
+        {
+            // Stopped and nothing left to do
+            return;
+        }
+
+        Task task = std::move(_tasks.front());
+        _tasks.pop_front();
+        runTask(task, lock);
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief A set of tasks that can be waited on together.
+ */
+struct TaskGroup
+{
+    int pending = 0;
+};
+
+/**
+ * @brief Simple pool of worker threads executing queued tasks.
+ *          The thread calling wait() will help executing the tasks of the group it waits for, so a pool
+ *          created with a thread count of 1 has no workers at all and runs everything on the waiting thread.
+ *          This also makes it safe to submit and wait for tasks from within tasks.
+ */
+class ThreadPool
+{
+public:
+    /**
+     * @brief Constructor.
+     * @param numThreads    How many threads (including the waiting thread) shall work on tasks. <= 0 means one per hardware thread.
+     */
+    ThreadPool(int numThreads);
+
+    /**
+     * @brief Destructor. Will finish all queued tasks before returning.
+     */
+    ~ThreadPool();
+
+    /**
+     * @brief Returns the number of threads working on tasks, including the waiting thread.
+     */
+    int getThreadCount() const;
+
+    /**
+     * @brief Queues the task as part of the passed group.
+     */
+    void submit(TaskGroup& group, std::function<void()> task);
+
+    /**
+     * @brief Blocks until all tasks of the group are done, executing tasks of that group in the meantime.
+     */
+    void wait(TaskGroup& group);
+
+    /**
+     * @brief Returns true if all tasks of the group are done, without blocking.
+     */
+    bool isDone(TaskGroup& group);
+
+private:
+    struct Task
+    {
+        TaskGroup*              group;
+        std::function<void()>   function;
+    };
+
+    /**
+     * @brief Runs the task and marks it as done in its group. Expects the lock to be held, will temporarily release it.
+     */
+    void runTask(Task& task, std::unique_lock<std::mutex>& lock);
+
+    /**
+     * @brief The function running in each worker thread.
+     */
+    void workerFunction();
+
+private:
+    std::vector<std::thread>    _workers;
+    std::deque<Task>            _tasks;
+    std::mutex                  _mutex;
+    std::condition_variable     _taskAvailable;
+    std::condition_variable     _taskDone;
+    bool                        _stop;
+};
+
+// INLINES
+inline int
+ThreadPool::getThreadCount() const
+{
+    return _workers.size() + 1;
+}
+
+#endif // THREADPOOL_H